@@ -1,4 +1,5 @@
 #define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE     // huge pages mappings, threads affinity
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,15 +13,25 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <alsa/asoundlib.h>
 #include <fcntl.h>
+#include <sys/inotify.h>
 #include <png.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
 #include <hiredis/hiredis.h>
+#include <zlib.h>
+#include "../controller/feedback.h"
+
+#if !defined(__x86_64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
 
 #define LOGGER_SIZE 32
 #define SEGMENTS    24
@@ -30,6 +41,47 @@
 #define BUFSIZE     1024
 #define TARGET_FPS  30
 
+#define FRAME_CHECKSUMS 64       // checksums sent kept, compared with feedback
+#define LINK_SAMPLES  64         // feedback samples kept (5 per second)
+#define LINK_WINDOWS  3          // 1 second, 10 seconds, session
+#define POWER_SAMPLES 128        // metrics board frames kept (100 per second)
+#define POWER_WINDOW  1000000    // us, peak current and freshness window
+
+#define RATE_MINIMUM  10.0       // send rate bounds (fps), whatever controller says
+#define RATE_MAXIMUM  40.0
+#define RATE_PROBE    1.0        // fps tried above what controller presents
+#define RATE_STEP     0.5        // fps added per clean feedback
+#define RATE_BACKOFF  0.85
+#define RATE_SMOOTH   0.25       // weight of new controller fps (sent by 5 fps steps)
+#define RATE_LOSS     2.0        // % lost over last second meaning congestion
+
+#define RECORD_MAGIC   0x43524c53 // "SLRC", recording file
+#define RECORD_CHUNK   0x4b434c53 // "SLCK", compressed chunk
+#define RECORD_VERSION 2
+#define RECORD_FRAMES  64         // frames per chunk (~2 seconds)
+#define RECORD_QUEUE   128        // frames waiting for recorder thread
+#define RECORD_SLIDERS 8
+
+#define BAKE_MAGIC     0x4b424c53 // "SLBK", baked show
+#define BAKE_VERSION   1
+#define BAKE_OFFSET    4096       // frames start, page aligned for mapping
+#define BAKE_CUES      512
+
+#define STROBE_RATE_MINIMUM 0.5  // Hz, refresh slider at 1
+#define STROBE_RATE_MAXIMUM 25.0 // Hz, refresh slider at 255
+#define STROBE_DUTY_MINIMUM 0.05 // on fraction of period, flash slider at 0
+
+#define METRICS_MAGIC    0x484d4c53 // "SLMH", metrics history file
+#define METRICS_CHUNK    0x434d4c53 // "SLMC", compressed samples
+#define METRICS_VERSION  1
+#define METRICS_INTERVAL 1000000    // us between samples
+#define METRICS_RING     3600       // samples kept in memory (1 hour)
+#define METRICS_FLUSH    60         // samples per history chunk
+#define METRICS_PORT     9180       // prometheus endpoint, localhost only
+
+#define POOL_WORKERS   64
+#define POOL_BATCH     4          // tasks taken at once from own range
+
 #define CRST        "\033[0m"
 #define CWARN       "\033[1;33m"
 #define CGOOD       "\033[1;32m"
@@ -78,7 +130,36 @@
 #define APC_BLINK_1_4         0x9E
 #define APC_BLINK_1_2         0x9F
 
-#define TEMPLATE_PREFIX       "/home/maxux/git/stageled/templates"
+#define APC_NOTES             128   // note space tracked for pad feedback
+#define APC_PADS              64    // rgb pads matrix (sysex addressable)
+#define APC_UNKNOWN_MODE      0xff  // led state unknown or not managed
+
+#define SURFACE_CONTROL       128   // control changes offset in dispatch table
+#define SURFACE_DISPATCH      256   // notes then control changes
+#define SURFACE_MAXIMUM       8
+
+#define MAP_GROUPS            3     // segments faders of default map
+#define GROUPS_TOTAL          4     // segments faders (sliders 1 to 4)
+
+#define LAYERS_MAXIMUM        8     // preset, show layers, mask
+#define LAYERS_EXTRA          (LAYERS_MAXIMUM - 2)
+
+#define SHOW_SLOTS            24    // presets and masks slots (3 banks of 8)
+#define SHOW_BANK             8
+#define SHOW_DEFAULT          "shows/default.conf"
+#define SHOW_SETTLE           200   // ms without changes before reloading
+
+#define LOADER_WORKERS        2
+#define LOADER_CACHE          8     // frames prepared for pads neighbours
+
+#define ARENA_SIZE            (2 << 20) // real-time buffers, one huge page
+#define ARENA_ALIGN           64        // cache line and vector size
+
+#define FRAMEPOOL_CLASSES     12    // pooled frames up to 2048 rows
+#define FRAMEPOOL_IDLE        (32 << 20) // bytes kept for reuse
+
+#define STREAM_ROWS           64    // lookahead rows decoded ahead of playback
+#define STREAM_THRESHOLD      512   // templates taller than this are streamed
 
 //
 // global context
@@ -103,80 +184,739 @@ typedef struct slider_t {
 typedef struct transform_t {
     int lines;
     slider_t *sliders;
-    uint8_t strip_rgb[3]; // strip red, green, blue
-    uint8_t master;
-
-    uint8_t *presets;
-    uint8_t *masks;
 
 } transform_t;
 
+typedef struct stream_t {
+    char path[512];
+    FILE *fp;
+    png_structp ctx;
+    png_infop info;
+    png_bytep raw;  // decoding row
+    int rows;       // ring capacity
+    int decoded;    // rows decoded since first row
+    int failed;
+
+} stream_t;
+
 typedef struct frame_t {
-    uint32_t *pixels;
+    uint32_t *pixels; // whole image, or lookahead ring when streamed
     int width;
     int height;
     size_t length;
+    stream_t *stream; // NULL when fully decoded
+
+    atomic_int refs;  // frames are shared, never written once loaded
+    int pool;         // allocator size class, -1 outside pool
+    size_t size;      // allocated block
+    struct frame_t *next; // pool free list
 
 } frame_t;
 
+typedef enum thread_id_t {
+    THREAD_NETSEND,
+    THREAD_FEEDBACK,
+    THREAD_MIDI,
+    THREAD_ANIMATE,
+    THREAD_LOADER,
+    THREAD_SHOW,
+    THREAD_CONSOLE,
+    THREAD_RECORDER,
+    THREAD_METRICS,
+    THREADS_TOTAL,
+
+} thread_id_t;
+
+static const char *thread_names[] = {
+    [THREAD_NETSEND] = "netsend",
+    [THREAD_FEEDBACK] = "feedback",
+    [THREAD_MIDI] = "midi",
+    [THREAD_ANIMATE] = "animate",
+    [THREAD_LOADER] = "loader",
+    [THREAD_SHOW] = "show",
+    [THREAD_CONSOLE] = "console",
+    [THREAD_RECORDER] = "recorder",
+    [THREAD_METRICS] = "metrics",
+};
+
+typedef struct rtthread_t {
+    uint8_t configured;
+    uint8_t pinned;
+    int policy;
+    int priority;
+    cpu_set_t cpus;
+
+} rtthread_t;
+
+typedef struct realtime_t {
+    rtthread_t threads[THREADS_TOTAL];
+    uint8_t lockall;
+
+} realtime_t;
+
+typedef struct wakeup_t {
+    uint64_t count;
+    uint64_t total; // ns late, summed
+    uint64_t last;
+    uint64_t max;
+
+} wakeup_t;
+
+// bump events from surfaces, waking netsend before its deadline
+typedef struct trigger_t {
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // monotonic clock
+    uint64_t pressed;    // ns of first event not sent yet, 0 when none
+    wakeup_t latency;    // event to packet sent, written by netsend
+
+} trigger_t;
+
+typedef struct arena_t {
+    uint8_t *base;
+    size_t size;
+    atomic_size_t used;
+    uint8_t hugepages;
+    uint8_t locked;
+
+} arena_t;
+
+typedef struct framepool_t {
+    pthread_mutex_t lock;
+    frame_t *free[FRAMEPOOL_CLASSES];
+    size_t idle;
+
+} framepool_t;
+
+// output control state, never modified once published
+typedef struct control_t {
+    uint64_t version;
+    uint8_t master;
+    uint8_t blackout;
+    uint8_t fullon;
+    uint8_t strip_rgb[3]; // strip red, green, blue
+    uint8_t sliders[RECORD_SLIDERS];
+    uint8_t strobe;       // refresh, disabled when 0
+    uint8_t strobe_duty;  // flash length
+    uint8_t strobe_mode;
+    uint8_t strobe_bars;  // chase length, in bars per period
+    uint32_t flashes;     // flash presses
+    uint16_t attack;      // bumps envelopes (ms)
+    uint16_t decay;
+    uint8_t calibration[3];
+    uint8_t bargroups[SEGMENTS]; // segments faders mask of each bar
+    float gains[SEGMENTS];       // product of bar faders, on commit
+
+    // replaced, waiting for readers
+    uint64_t retired; // epoch when replaced
+    struct control_t *next;
+
+} control_t;
+
+// render path reads current snapshot without lock, writers publish
+// a modified copy, old ones are freed once no reader can hold them
+typedef struct controls_t {
+    _Atomic(control_t *) current;
+    atomic_uint_fast64_t epoch;
+    atomic_uint_fast64_t readers[THREADS_TOTAL]; // epoch at enter, 0 outside
+
+    pthread_mutex_t writer; // one update at a time
+    control_t *retired;     // owned by writer
+
+} controls_t;
+
+typedef enum strobe_mode_t {
+    STROBE_SYNC,   // every bar at once
+    STROBE_CHASE,  // phase shifted from one bar to next one
+    STROBE_RANDOM, // random bars each period
+    STROBE_MODES,
+
+} strobe_mode_t;
+
+static const char *strobe_names[] = {
+    [STROBE_SYNC] = "sync",
+    [STROBE_CHASE] = "chase",
+    [STROBE_RANDOM] = "random",
+};
+
+// render local strobe position, in periods from strobe start
+typedef struct strobe_t {
+    double cycles;
+    uint64_t last; // monotonic ns of last evaluation
+
+} strobe_t;
+
+// bump envelope, from live output (0) to constant frame (1)
+typedef struct envelope_t {
+    double level;
+    double from;
+    uint64_t start; // ns, last edge
+    uint8_t target;
+
+} envelope_t;
+
+// render local bumps, with full on output precomputed for
+// current control snapshot
+typedef struct bumps_t {
+    envelope_t fullon;
+    envelope_t flash;
+    envelope_t blackout;
+    uint32_t flashes; // flash presses seen
+    uint8_t flashing; // pressed, full level until one frame is sent
+    uint64_t version; // snapshot of precomputed frame
+    uint8_t *frame;
+    pixel_t *white;
+
+} bumps_t;
+
+typedef enum blend_t {
+    BLEND_ADD,
+    BLEND_ALPHA,
+    BLEND_MULTIPLY,
+    BLEND_SCREEN,
+    BLEND_MAX,
+    BLEND_MASK,
+    BLEND_MODES,
+
+} blend_t;
+
+typedef struct layer_t {
+    uint8_t blend;
+    uint8_t opacity; // layer fader
+    uint16_t speed;  // percent of animation speed
+
+} layer_t;
+
+typedef struct composite_t {
+    const pixel_t *row;
+    uint8_t blend;
+    uint8_t opacity;
+
+} composite_t;
+
+typedef struct padled_t {
+    uint8_t mode;  // midi channel: solid, pulse, blink
+    uint8_t color; // palette color (velocity)
+
+} padled_t;
+
+typedef struct padqueue_t {
+    padled_t wanted[APC_NOTES]; // state requested by handlers
+    padled_t sent[APC_NOTES];   // state last sent to the surface
+    uint8_t sysex;              // bulk update solid pads via sysex
+
+} padqueue_t;
+
+typedef struct mapbar_t {
+    float x0, y0;   // first led center, in canvas units
+    float x1, y1;   // last led center
+    uint8_t group;  // segments fader, 0 for none
+
+} mapbar_t;
+
+typedef struct pixelmap_t {
+    char *path;
+    int width;      // canvas of spatial templates
+    int height;
+    mapbar_t bars[SEGMENTS];
+
+    uint32_t (*index)[4];  // per led, canvas source pixels
+    uint16_t (*weight)[4]; // per led, bilinear weights (sum is 256)
+
+} pixelmap_t;
+
+typedef struct source_t {
+    char *name;      // display name, NULL when slot is empty
+    char *path;      // template file, NULL for generators
+    uint8_t spatial; // template drawn on map canvas
+    frame_t *frame;  // pre-decoded frame, or stream for long templates
+
+} source_t;
+
+typedef struct showlayer_t {
+    source_t source;
+    layer_t layer;
+
+} showlayer_t;
+
+typedef struct show_t {
+    char *path;
+    char *name;
+    char *prefix;   // templates directory
+    char *mappath;
+    pixelmap_t *map;
+    useconds_t speed;
+    uint8_t calibration[3];
+    uint8_t strobe_mode;
+    uint8_t strobe_bars;
+    uint16_t attack; // bumps envelopes (ms)
+    uint16_t decay;
+
+    source_t presets[SHOW_SLOTS];
+    source_t masks[SHOW_SLOTS];
+
+    // static layers between preset and mask
+    showlayer_t layers[LAYERS_EXTRA];
+    int layers_total;
+
+    // names lists, in the format used by main context
+    char *presets_names[SHOW_SLOTS];
+    char *masks_names[SHOW_SLOTS];
+
+    char *surfaces[SURFACE_MAXIMUM];
+    int surfaces_total;
+
+} show_t;
+
+typedef enum loaderkind_t {
+    LOADER_PRESET,
+    LOADER_MASK,
+    LOADER_KINDS,
+
+} loaderkind_t;
+
+typedef struct prepared_t {
+    int kind;
+    int slot;
+    int version;    // show version frame belongs to
+    uint64_t stamp; // eviction order
+    frame_t *frame;
+
+} prepared_t;
+
+typedef struct loader_t {
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+
+    int pending[LOADER_KINDS];     // requested slot, -1 when none
+    uint64_t serial[LOADER_KINDS]; // latest request, older loads are dropped
+
+    int prefetch[LOADER_KINDS][4]; // neighbours still to prepare
+    int prefetch_total[LOADER_KINDS];
+
+    prepared_t cache[LOADER_CACHE];
+    uint64_t stamp;
+
+} loader_t;
+
+typedef enum action_t {
+    ACTION_NONE,
+    ACTION_PRESET,     // argument: preset index
+    ACTION_MASK,       // argument: mask index
+    ACTION_MASK_RESET,
+    ACTION_BLACKOUT,
+    ACTION_FULLON,
+    ACTION_STRIP,      // argument: color channel
+    ACTION_SEGMENT,    // argument: segment configuration
+    ACTION_SLIDER,     // argument: slider index
+    ACTION_MASTER,
+    ACTION_OPACITY,    // argument: layer index
+    ACTION_STROBE,     // argument: strobe mode
+    ACTION_FLASH,
+
+} action_t;
+
+typedef struct binding_t {
+    uint8_t action;
+    uint8_t argument;
+
+} binding_t;
+
+typedef struct surface_t {
+    char *name;
+    char *port;       // alsa sequencer address
+    uint8_t feedback; // send leds state to the surface
+
+    binding_t dispatch[SURFACE_DISPATCH];
+    uint8_t clears[APC_NOTES]; // leds reset on connect
+
+    // runtime state, only used by midi thread
+    snd_seq_t *seq;
+    padqueue_t leds;
+    uint8_t interface; // not found, found, lost
+    int show_version;  // show reflected by leds
+    time_t retried;
+    int pfds;
+    int npfds;
+
+} surface_t;
+
+// control state applied to a recorded frame
+typedef struct __attribute__ ((packed)) record_control_t {
+    uint8_t master;
+    uint8_t strip_rgb[3];
+    uint8_t sliders[RECORD_SLIDERS];
+    uint8_t blackout;
+    uint8_t fullon;
+    uint8_t strobe;
+    uint8_t strobe_duty;
+    uint8_t strobe_mode;
+    uint8_t strobe_bars;
+
+} record_control_t;
+
+typedef struct __attribute__ ((packed)) record_frame_t {
+    uint64_t timestamp; // us since recording started
+    uint32_t sequence;
+    record_control_t control;
+    uint8_t bitmap[BITMAPSIZE]; // xor previous frame of the chunk
+
+} record_frame_t;
+
+typedef struct __attribute__ ((packed)) record_header_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t leds;
+    uint32_t length;  // sizeof(record_frame_t)
+    uint32_t padding;
+    uint64_t created; // unix time
+
+} record_header_t;
+
+// chunks are independent: first frame is never delta encoded
+typedef struct __attribute__ ((packed)) record_chunk_t {
+    uint32_t magic;
+    uint32_t frames;
+    uint32_t compressed; // deflate stream following
+    uint32_t checksum;   // crc32 of decompressed frames
+
+} record_chunk_t;
+
+typedef struct recorder_t {
+    char *path;
+    FILE *fp;
+    uint64_t start; // ns, monotonic
+
+    // single producer (netsend), single consumer (recorder) ring
+    record_frame_t *queue;
+    atomic_uint head;
+    atomic_uint tail;
+
+    record_frame_t *chunk; // frames being packed
+    int chunked;
+    uint8_t previous[BITMAPSIZE]; // last frame packed, not delta encoded
+    uint8_t *deflated;
+    size_t deflatesize;
+
+    // counters, written by recorder thread only except dropped
+    atomic_ulong dropped; // queue full, netsend never waits
+    uint64_t frames;
+    uint64_t written;     // bytes on disk
+    int failed;
+
+    pthread_t thread;
+
+} recorder_t;
+
+// counters sampled at fixed rate, also history file record
+typedef struct __attribute__ ((packed)) metrics_sample_t {
+    uint64_t time;       // ms, unix time
+    uint32_t fps;        // displayed by controller
+    uint32_t frames;     // committed by netsend
+    uint32_t dropped;
+    float droprate;
+    float lossrate;      // last second
+    float rate;          // send rate (fps)
+    uint32_t rtt;        // us, last 10 seconds average
+    uint32_t transform;  // us
+    uint32_t late;       // us, last netsend wakeup
+    uint32_t show;       // us, last controller show()
+    uint32_t busy;
+    uint16_t volts[FEEDBACK_PSUS]; // values * 100
+    uint16_t amps[FEEDBACK_PSUS];
+    uint16_t mains;
+    int16_t temperatures[4]; // main core, monitoring core, power, compute
+
+} metrics_sample_t;
+
+typedef struct __attribute__ ((packed)) metrics_header_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t length; // sizeof(metrics_sample_t)
+    uint64_t created;
+
+} metrics_header_t;
+
+// ring and history owned by metrics thread, no locking
+typedef struct metrics_t {
+    char *path;  // history, NULL when disabled
+    FILE *fp;
+    int port;    // 0 when disabled
+    int listener;
+
+    metrics_sample_t ring[METRICS_RING];
+    uint64_t total; // samples taken, next one at total % ring
+
+    int pending;    // samples not in history yet
+    uint8_t *deflated;
+    size_t deflatesize;
+
+    pthread_t thread;
+    int started; // thread running, joined on cleanup
+
+} metrics_t;
+
+// cue list baked offline, values can fade from previous one
+typedef enum cuekind_t {
+    CUE_PRESET,
+    CUE_MASK,
+    CUE_MASTER,
+    CUE_RED,
+    CUE_GREEN,
+    CUE_BLUE,
+    CUE_SEGMENT1,
+    CUE_SEGMENT2,
+    CUE_SEGMENT3,
+    CUE_SEGMENT4,
+    CUE_SPEED,
+    CUE_PRESET_OPACITY,
+    CUE_MASK_OPACITY,
+    CUE_BLACKOUT,
+    CUE_FULLON,
+    CUE_STROBE,
+    CUE_STROBE_DUTY,
+    CUE_KINDS,
+
+} cuekind_t;
+
+static const char *cue_names[] = {
+    [CUE_PRESET] = "preset",
+    [CUE_MASK] = "mask",
+    [CUE_MASTER] = "master",
+    [CUE_RED] = "red",
+    [CUE_GREEN] = "green",
+    [CUE_BLUE] = "blue",
+    [CUE_SEGMENT1] = "segment1",
+    [CUE_SEGMENT2] = "segment2",
+    [CUE_SEGMENT3] = "segment3",
+    [CUE_SEGMENT4] = "segment4",
+    [CUE_SPEED] = "speed",
+    [CUE_PRESET_OPACITY] = "preset-opacity",
+    [CUE_MASK_OPACITY] = "mask-opacity",
+    [CUE_BLACKOUT] = "blackout",
+    [CUE_FULLON] = "fullon",
+    [CUE_STROBE] = "strobe",
+    [CUE_STROBE_DUTY] = "strobe-duty",
+};
+
+typedef struct cue_t {
+    double at;    // seconds
+    int kind;
+    double value; // slot (-1 for off), or target value
+    double fade;  // seconds to reach value
+
+} cue_t;
+
+typedef struct cuelist_t {
+    char *showpath;
+    int fps;       // baked frame rate
+    double length; // seconds
+    cue_t cues[BAKE_CUES];
+    int cues_total;
+
+} cuelist_t;
+
+typedef struct __attribute__ ((packed)) bake_header_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t leds;
+    uint32_t fps;
+    uint32_t frames;
+    uint32_t length; // bytes per frame, wire format
+    uint32_t offset; // first frame
+
+} bake_header_t;
+
+// immutable control state, a frame can be rendered at any time after it
+typedef struct render_state_t {
+    double time;        // seconds, positions origin
+    double speed;       // rows per second at 100%
+    int8_t preset;      // slots, -1 when none
+    int8_t mask;
+    uint8_t opacity[2]; // preset, mask
+    double positions[LAYERS_MAXIMUM]; // rows at state time
+    double strobe;      // strobe periods at state time
+    record_control_t control;
+
+} render_state_t;
+
+// rendering context of a worker, owning its sources (streams)
+typedef struct renderer_t {
+    show_t *show;
+    frame_t *presets[SHOW_SLOTS];
+    frame_t *masks[SHOW_SLOTS];
+    frame_t *statics[LAYERS_EXTRA];
+    uint8_t bargroups[SEGMENTS];
+    pixel_t *pixels;
+
+} renderer_t;
+
+typedef void (*pool_task_t)(void *context, int worker, int index);
+
+// tasks still owned by a worker, idle workers steal upper half
+typedef struct poolworker_t {
+    struct pool_t *pool;
+    int id;
+    pthread_t thread;
+
+    pthread_mutex_t lock;
+    int start;
+    int end;
+
+    uint64_t done;
+    uint64_t steals;
+
+} poolworker_t;
+
+typedef struct pool_t {
+    int size;
+    pool_task_t task;
+    void *context;
+    poolworker_t workers[POOL_WORKERS];
+
+} pool_t;
+
+typedef struct baker_t {
+    renderer_t *renderers[POOL_WORKERS];
+    render_state_t *states;
+    uint8_t *output; // mapped file, first frame
+
+} baker_t;
+
+// controller feedback, decoded from its records (see feedback.h)
 typedef struct controller_stats_t {
     uint64_t state;
-    uint64_t old_frames;
     uint64_t frames;
     uint64_t fps;
     uint64_t time_last_frame;
-
     uint64_t time_current;
 
+    uint32_t sequence;  // highest frame sequence received
+    uint32_t reordered; // frames received behind highest one, not shown
+    uint32_t invalid;   // packets rejected (size, magic)
+    uint32_t echo_age;  // us since highest frame was received
+    uint64_t echo;      // timestamp of highest frame
+
+    uint8_t lanes;
+    uint32_t show_last; // us, all lanes sent at once
+    uint32_t show_max;
+    uint32_t busy;      // frames arrived while previous one was sent
+
     uint16_t main_ac_voltage;
 
-    uint16_t main_core_temperature;
-    uint16_t mon_core_temperature;
-    uint16_t ext_power_temperature;
-    uint16_t ext_compute_temperature;
+    int16_t main_core_temperature;
+    int16_t mon_core_temperature;
+    int16_t ext_power_temperature;
+    int16_t ext_compute_temperature;
+
+    uint16_t psu_volts[FEEDBACK_PSUS];
+    uint16_t psu_amps[FEEDBACK_PSUS];
 
-    uint16_t psu0_volt;
-    uint16_t psu0_amps;
-    uint16_t psu1_volt;
-    uint16_t psu1_amps;
-    uint16_t psu2_volt;
-    uint16_t psu2_amps;
+    uint32_t telemetry_frames; // metrics board serial link
+    uint32_t telemetry_errors;
 
-    uint16_t padding;
+    uint32_t integrity_sequence; // last frame with a valid checksum
+    uint32_t integrity_checksum;
+    uint32_t integrity_checked;
+    uint32_t integrity_errors;   // frames rejected by controller
+
+    feedback_power_t power; // power datagrams only
 
 } controller_stats_t;
 
+typedef struct frame_checksum_t {
+    uint32_t sequence;
+    uint32_t checksum;
+
+} frame_checksum_t;
+
+// metrics board frames, forwarded by controller as they arrive
+typedef struct power_sample_t {
+    uint64_t time; // us, local monotonic clock
+    feedback_power_t power;
+
+} power_sample_t;
+
+typedef struct power_stats_t {
+    power_sample_t samples[POWER_SAMPLES];
+    int next;
+    uint64_t received;
+    uint64_t missing;  // metrics board frames lost on the way (sequence)
+    uint64_t last;     // us, local time of latest frame
+
+    uint16_t amps[FEEDBACK_PSUS]; // latest, values * 100
+    uint16_t peak[FEEDBACK_PSUS]; // highest over window
+    uint8_t age;                  // ms, oldest current sample of latest frame
+
+} power_stats_t;
+
+typedef struct linksample_t {
+    uint64_t time;      // us, local monotonic clock
+    uint32_t sent;      // sequence numbers elapsed
+    uint32_t lost;
+    uint32_t reordered;
+    uint32_t rtt;       // us
+
+} linksample_t;
+
+typedef struct linkwindow_t {
+    uint64_t sent;
+    uint64_t lost;
+    uint64_t reordered;
+    double lossrate;
+    uint32_t rtt_average;
+    uint32_t rtt_maximum;
+
+} linkwindow_t;
+
 typedef struct control_stats_t {
     uint64_t frames;
-    uint64_t ctrl_initial_frames;
     uint64_t ctrl_initial_time;
     uint64_t showframes;
     uint64_t dropped;
     double droprate;
     struct timeval ctrl_last_feedback;
 
+    // link quality from sequence numbers echoed by controller
+    linksample_t samples[LINK_SAMPLES];
+    int samples_next;
+    linkwindow_t windows[LINK_WINDOWS]; // 1 s, 10 s, session
+    uint64_t reboots;
+    uint64_t invalid; // feedback packets rejected
+
+    // checksums sent, by sequence, against the ones controller verified
+    frame_checksum_t checksums[FRAME_CHECKSUMS];
+    uint64_t mismatches;
+
+    // send rate matched to what controller presents
+    double rate;
+    double presented;   // controller fps, smoothed
+    uint64_t rate_hold; // us, no change until last second window is renewed
+
     double time_transform;
 
 } control_stats_t;
 
 typedef struct kntxt_t {
-    pixel_t *pixels;
-    pixel_t *maskpixels;
+    pixel_t *pixels;  // composited layers
     pixel_t *monitor; // monitoring output
     pixel_t *preview; // monitoring without master
 
+    // next frames, handed to animate thread
     frame_t *frame;
     frame_t *maskframe;
-    frame_t *maskreset; // special flag
+    uint8_t maskpending; // maskframe to be taken, even empty (reset)
+
+    // layers stack: preset, show layers, mask
+    layer_t layers[LAYERS_MAXIMUM];
+    int layers_total;
 
     transform_t midi;
+    uint8_t grouping; // segment button held (1 to 4), presets pads are bars
     useconds_t speed;
-    uint8_t blackout;
-    uint8_t fullon;
-    uint8_t strobe;
-    uint8_t strobe_state;
-    uint32_t strobe_index;
-    uint32_t strobe_duration;
+    useconds_t defspeed; // speed without speed fader
+
+    // output settings, published snapshots
+    controls_t controls;
 
     char **presets;
     int presets_total;
@@ -186,22 +926,38 @@ typedef struct kntxt_t {
     char *preset;
     char *mask;
 
+    // current show, swapped on reload (protected by showlock)
+    show_t *show;
+    int show_version;
+    pthread_rwlock_t showlock;
+
     // remote and local stats
     controller_stats_t controller;
     control_stats_t client;
+    power_stats_t power;
     char *controladdr;
 
-    // flags to monitor interface presence
-    uint8_t interface; // not found, found, lost
+    // control surfaces loaded from profiles
+    surface_t *surfaces[SURFACE_MAXIMUM];
+    int surfaces_total;
 
     // master thread locking (FIXME)
     pthread_mutex_t lock;
 
-    pthread_cond_t cond_presets;
-    pthread_mutex_t mutcond_presets; // condition mutex
+    // presets and masks loading workers
+    loader_t loader;
+
+    // late wakeups of periodic threads
+    wakeup_t wakeups[THREADS_TOTAL];
 
-    pthread_cond_t cond_masks;
-    pthread_mutex_t mutcond_masks; // condition mutex
+    // bumps sent right away
+    trigger_t trigger;
+
+    // output capture, NULL when not recording
+    recorder_t *recorder;
+
+    // counters history and export
+    metrics_t *metrics;
 
     atomic_char keepgoing;
 
@@ -219,6 +975,17 @@ typedef struct logger_t {
 
 logger_t mainlog;
 
+// context stopped by SIGINT and SIGTERM, threads leave their loop and flush
+kntxt_t *signaled = NULL;
+
+int frame_checksums = 1; // frames sent with pixels checksum
+
+arena_t arena;
+
+framepool_t framepool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
 //
 // helpers
 //
@@ -237,11 +1004,6 @@ void diea(char *str, int err) {
     exit(EXIT_FAILURE);
 }
 
-void *imgerr(char *str) {
-    fprintf(stderr, "image: %s\n", str);
-    return NULL;
-}
-
 double timediff(struct timeval *n, struct timeval *b) {
     return (double)(n->tv_usec - b->tv_usec) / 1000000 + (double)(n->tv_sec - b->tv_sec);
 }
@@ -259,6 +1021,72 @@ char *uptime_prettify(size_t usec) {
     return strdup(buffer);
 }
 
+uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void wakeup_record(wakeup_t *wakeup, int64_t late) {
+    // single writer (thread itself), read without lock by console
+    if(late < 0)
+        late = 0;
+
+    wakeup->count += 1;
+    wakeup->total += late;
+    wakeup->last = late;
+
+    if((uint64_t) late > wakeup->max)
+        wakeup->max = late;
+}
+
+void trigger_init(trigger_t *trigger) {
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+    pthread_mutex_init(&trigger->lock, NULL);
+    pthread_cond_init(&trigger->wake, &attr);
+
+    pthread_condattr_destroy(&attr);
+}
+
+void trigger_fire(trigger_t *trigger) {
+    uint64_t now = monotonic_ns();
+
+    pthread_mutex_lock(&trigger->lock);
+
+    // latency counted from oldest event not sent
+    if(!trigger->pressed)
+        trigger->pressed = now;
+
+    pthread_cond_signal(&trigger->wake);
+    pthread_mutex_unlock(&trigger->lock);
+}
+
+// sleeping until deadline (monotonic ns) or until an event, returns
+// time of the event, 0 when deadline was reached without event
+uint64_t trigger_wait(trigger_t *trigger, uint64_t deadline) {
+    struct timespec next = {
+        .tv_sec = deadline / 1000000000,
+        .tv_nsec = deadline % 1000000000,
+    };
+
+    pthread_mutex_lock(&trigger->lock);
+
+    while(!trigger->pressed)
+        if(pthread_cond_timedwait(&trigger->wake, &trigger->lock, &next) == ETIMEDOUT)
+            break;
+
+    uint64_t pressed = trigger->pressed;
+    trigger->pressed = 0;
+
+    pthread_mutex_unlock(&trigger->lock);
+
+    return pressed;
+}
+
 void thread_wait(int ms) {
     struct timespec ts = {
         .tv_sec = 0,
@@ -276,6 +1104,128 @@ int list_index_search(char **list, char *entry, int length) {
     return -1;
 }
 
+//
+// segments groups
+//
+// a bar belongs to any of the GROUPS_TOTAL segments faders (bargroups
+// mask), its gain is the product of the faders of every group it is in
+//
+void groups_gains(const uint8_t *bargroups, const uint8_t *sliders, float *gains) {
+    for(int bar = 0; bar < SEGMENTS; bar++) {
+        gains[bar] = 1.0;
+
+        for(int group = 0; group < GROUPS_TOTAL; group++)
+            if(bargroups[bar] & (1 << group))
+                gains[bar] *= sliders[group] / 255.0;
+    }
+}
+
+//
+// control snapshots
+//
+// epoch based reclamation: a reader announces epoch it entered in, a
+// snapshot replaced at epoch e is freed once every reader is outside
+// or entered after e (then it could only load a newer one)
+//
+void control_init(controls_t *controls) {
+    control_t *initial;
+
+    if(!(initial = calloc(sizeof(control_t), 1)))
+        diep("control: calloc");
+
+    memset(initial->calibration, 255, sizeof(initial->calibration));
+    groups_gains(initial->bargroups, initial->sliders, initial->gains);
+
+    atomic_init(&controls->current, initial);
+    atomic_init(&controls->epoch, 1);
+
+    for(int i = 0; i < THREADS_TOTAL; i++)
+        atomic_init(&controls->readers[i], 0);
+
+    pthread_mutex_init(&controls->writer, NULL);
+    controls->retired = NULL;
+}
+
+void control_free(controls_t *controls) {
+    // no reader left
+    while(controls->retired) {
+        control_t *next = controls->retired->next;
+        free(controls->retired);
+        controls->retired = next;
+    }
+
+    free(atomic_load(&controls->current));
+}
+
+// snapshot stays valid until control_leave, one section per reader
+control_t *control_enter(controls_t *controls, int reader) {
+    atomic_store(&controls->readers[reader], atomic_load(&controls->epoch));
+    return atomic_load(&controls->current);
+}
+
+void control_leave(controls_t *controls, int reader) {
+    atomic_store(&controls->readers[reader], 0);
+}
+
+// writers get a private copy of current state, published by commit
+control_t *control_begin(controls_t *controls) {
+    control_t *next;
+
+    pthread_mutex_lock(&controls->writer);
+
+    if(!(next = malloc(sizeof(control_t))))
+        diep("control: malloc");
+
+    memcpy(next, atomic_load(&controls->current), sizeof(control_t));
+
+    return next;
+}
+
+static void control_reclaim(controls_t *controls) {
+    uint64_t oldest = UINT64_MAX;
+
+    for(int i = 0; i < THREADS_TOTAL; i++) {
+        uint64_t entered = atomic_load(&controls->readers[i]);
+
+        if(entered && entered < oldest)
+            oldest = entered;
+    }
+
+    control_t **link = &controls->retired;
+
+    while(*link) {
+        control_t *control = *link;
+
+        if(control->retired < oldest) {
+            *link = control->next;
+            free(control);
+            continue;
+        }
+
+        link = &control->next;
+    }
+}
+
+void control_commit(controls_t *controls, control_t *next) {
+    control_t *previous = atomic_load(&controls->current);
+
+    groups_gains(next->bargroups, next->sliders, next->gains);
+
+    next->version = previous->version + 1;
+    next->next = NULL;
+
+    atomic_store(&controls->current, next);
+
+    // readers entering from now cannot load previous anymore
+    previous->retired = atomic_fetch_add(&controls->epoch, 1);
+    previous->next = controls->retired;
+    controls->retired = previous;
+
+    control_reclaim(controls);
+
+    pthread_mutex_unlock(&controls->writer);
+}
+
 //
 // logging
 //
@@ -309,607 +1259,4767 @@ void logger(char *fmt, ...) {
 }
 
 //
-// image and transformation management
+// real-time buffers arena
 //
-frame_t *frame_loadfile(char *imgfile) {
-    FILE *fp;
-    png_structp ctx;
-    png_infop info;
-    frame_t *frame = NULL;
-    char prefixed[256];
-
-    unsigned char header[8]; // 8 is the maximum size that can be checked
-
-    sprintf(prefixed, "%s/%s", TEMPLATE_PREFIX, imgfile);
+// every buffer used per frame by real-time threads comes from one
+// mapping made at startup, aligned, prefaulted and locked if allowed,
+// compositing and sending do not fault nor allocate on their own
+//
+// streamed templates are not covered: animate still reopens and decodes
+// them (libpng, stdio, frames pool) when they loop or a preset changes
+//
+void arena_init(size_t size) {
+    arena.size = size;
+    arena.base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    arena.hugepages = (arena.base != MAP_FAILED);
 
-    if(!(fp = fopen(prefixed, "r")))
-        dieptr(prefixed);
+    if(!arena.hugepages) {
+        // no huge pages reserved, asking for transparent ones
+        if((arena.base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+            diep("arena: mmap");
 
-    if(fread(header, 1, 8, fp) != 8)
-        diep("fread");
+        madvise(arena.base, size, MADV_HUGEPAGE);
+    }
 
-    if(png_sig_cmp(header, 0, 8))
-        return imgerr("unknown file signature (not a png image)");
+    if(mlock(arena.base, size) == 0)
+        arena.locked = 1;
 
-    if(!(ctx = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL)))
-        return imgerr("cannot create png struct");
+    // faulting every page now
+    memset(arena.base, 0, size);
 
-    if(!(info = png_create_info_struct(ctx)))
-        return imgerr("cannot create info struct");
+    printf("[+] arena: %zu KB, huge pages: %s, locked: %s\n", size >> 10,
+        arena.hugepages ? "yes" : "no", arena.locked ? "yes" : "no (not permitted)");
+}
 
-    png_init_io(ctx, fp);
-    png_set_sig_bytes(ctx, 8);
-    png_read_info(ctx, info);
+void *arena_alloc(size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    size_t offset = atomic_fetch_add(&arena.used, size);
 
-    int width = png_get_image_width(ctx, info);
-    int height = png_get_image_height(ctx, info);
+    if(offset + size > arena.size) {
+        fprintf(stderr, "[-] arena: exhausted (%zu bytes)\n", arena.size);
+        exit(EXIT_FAILURE);
+    }
 
-    if(width != 2880)
-        logger("[+] loader: warning: image dimension: %d x %d px", width, height);
+    // zeroed when mapped, never released
+    return arena.base + offset;
+}
 
-    png_bytep *lines = (png_bytep *) malloc(sizeof(png_bytep) * height);
-    for(int y = 0; y < height; y++)
-        lines[y] = (png_byte *) malloc(png_get_rowbytes(ctx, info));
+//
+// frames allocator
+//
+// frame header, stream state and pixels are one block, blocks of
+// 2880 pixels wide rows are pooled by power of two size classes
+// and recycled instead of being freed
+//
+#define FRAME_HEADER ((sizeof(frame_t) + sizeof(stream_t) + 63) & ~(size_t) 63)
 
-    png_read_image(ctx, lines);
+frame_t *frame_alloc(int width, int rows, int streamed) {
+    frame_t *frame = NULL;
+    int pool = -1;
 
-    fclose(fp);
+    // streamed frames keep their decoding row after the ring
+    int needed = rows + (streamed ? 1 : 0);
 
-    if(png_get_color_type(ctx, info) == PNG_COLOR_TYPE_RGB)
-        return imgerr("alpha channel required");
+    for(int i = 0; i < FRAMEPOOL_CLASSES && width == LEDSTOTAL && pool < 0; i++)
+        if(needed <= (1 << i))
+            pool = i;
 
-    if(png_get_color_type(ctx, info) != PNG_COLOR_TYPE_RGBA)
-        return imgerr("only RGBA supported for now");
+    size_t size = FRAME_HEADER + sizeof(uint32_t) * width * ((pool >= 0) ? (1 << pool) : needed);
 
-    // allocate frame
-    if(!(frame = malloc(sizeof(frame_t))))
-        diep("malloc");
+    if(pool >= 0) {
+        pthread_mutex_lock(&framepool.lock);
 
-    frame->length = width * height;
-    frame->width = width;
-    frame->height = height;
+        if((frame = framepool.free[pool])) {
+            framepool.free[pool] = frame->next;
+            framepool.idle -= frame->size;
+        }
 
-    if(!(frame->pixels = (uint32_t *) malloc(sizeof(uint32_t) * frame->length)))
-        diep("malloc");
+        pthread_mutex_unlock(&framepool.lock);
+    }
 
-    uint32_t *pixel = frame->pixels;
+    // aligned block, rows of 2880 pixels keep vector alignment
+    if(!frame && posix_memalign((void **) &frame, ARENA_ALIGN, size))
+        diep("posix_memalign");
 
-    for(int y = 0; y < height; y++) {
-        png_byte *row = lines[y];
+    memset(frame, 0, FRAME_HEADER);
 
-        for(int x = 0; x < width; x++) {
-            png_byte *ptr = &(row[x * 4]);
-            *pixel = ptr[0] | ptr[1] << 8 | ptr[2] << 16 | ptr[3] << 24;
-            pixel += 1;
-        }
+    frame->pixels = (uint32_t *) ((uint8_t *) frame + FRAME_HEADER);
+    frame->width = width;
+    frame->height = rows;
+    frame->length = width * rows;
+    frame->pool = pool;
+    frame->size = size;
+    atomic_init(&frame->refs, 1);
+
+    if(streamed) {
+        frame->stream = (stream_t *) (frame + 1);
+        frame->stream->raw = (png_bytep) (frame->pixels + frame->length);
     }
 
-    // cleanup working png stuff
-    for(int y = 0; y < height; y++)
-        free(lines[y]);
+    return frame;
+}
+
+//
+// image and transformation management
+//
+static void stream_error(png_structp ctx, png_const_charp str) {
+    // libpng would print on console, logging then back to decoder
+    logger("[-] loader: png: %s", str);
+    png_longjmp(ctx, 1);
+}
+
+frame_t *frame_loadfile(char *imgfile) {
+    FILE *fp;
+    png_structp ctx = NULL;
+    png_infop info = NULL;
+    png_bytep *volatile lines = NULL;
+    volatile int height = 0;
+    frame_t *volatile frame = NULL;
+    char *volatile error = NULL;
+
+    unsigned char header[8]; // 8 is the maximum size that can be checked
+
+    // missing template should not stop a running show
+    if(!(fp = fopen(imgfile, "r"))) {
+        logger("[-] loader: %s: %s", imgfile, strerror(errno));
+        return NULL;
+    }
+
+    if(fread(header, 1, 8, fp) != 8 || png_sig_cmp(header, 0, 8)) {
+        error = "unknown file signature (not a png image)";
+        goto cleanup;
+    }
+
+    if(!(ctx = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, stream_error, NULL)))
+        diep("png_create_read_struct");
+
+    if(!(info = png_create_info_struct(ctx)))
+        diep("png_create_info_struct");
+
+    // template half written while reloading, decoder comes back here
+    if(setjmp(png_jmpbuf(ctx))) {
+        error = "decoding failed (truncated file ?)";
+        goto cleanup;
+    }
+
+    png_init_io(ctx, fp);
+    png_set_sig_bytes(ctx, 8);
+    png_read_info(ctx, info);
+
+    int width = png_get_image_width(ctx, info);
+    int rows = png_get_image_height(ctx, info);
+    int color = png_get_color_type(ctx, info);
+
+    if(color == PNG_COLOR_TYPE_RGB) {
+        error = "alpha channel required";
+        goto cleanup;
+    }
+
+    if(color != PNG_COLOR_TYPE_RGBA || png_get_bit_depth(ctx, info) != 8) {
+        error = "only 8 bits RGBA supported for now";
+        goto cleanup;
+    }
+
+    if(width != 2880)
+        logger("[+] loader: warning: image dimension: %d x %d px", width, rows);
+
+    if(!(lines = (png_bytep *) calloc(sizeof(png_bytep), rows)))
+        diep("frame: calloc");
+
+    for(height = 0; height < rows; height++)
+        if(!(lines[height] = (png_byte *) malloc(png_get_rowbytes(ctx, info))))
+            diep("frame: malloc");
+
+    png_read_image(ctx, lines);
+
+    // allocate frame
+    frame = frame_alloc(width, height, 0);
+    uint32_t *pixel = frame->pixels;
+
+    for(int y = 0; y < height; y++) {
+        png_byte *row = lines[y];
+
+        for(int x = 0; x < width; x++) {
+            png_byte *ptr = &(row[x * 4]);
+            *pixel = ptr[0] | ptr[1] << 8 | ptr[2] << 16 | ptr[3] << 24;
+            pixel += 1;
+        }
+    }
+
+cleanup:
+    // cleanup working png stuff
+    if(lines) {
+        for(int y = 0; y < height; y++)
+            free(lines[y]);
+
+        free(lines);
+    }
+
+    png_destroy_read_struct(&ctx, &info, NULL);
+    fclose(fp);
+
+    if(error)
+        logger("[-] loader: %s: %s", imgfile, error);
+
+    return frame;
+}
+
+frame_t *frame_generate_solid(uint8_t r, uint8_t g, uint8_t b) {
+    frame_t *frame = frame_alloc(LEDSTOTAL, 1, 0);
+
+    for(size_t i = 0; i < frame->length; i++)
+        frame->pixels[i] = r | g << 8 | b << 16;
+
+    return frame;
+}
+
+//
+// streamed templates, rows are decoded while playing with a small
+// lookahead ring, memory does not depend on animation length
+//
+void stream_close(stream_t *stream) {
+    if(stream->ctx)
+        png_destroy_read_struct(&stream->ctx, &stream->info, NULL);
+
+    if(stream->fp)
+        fclose(stream->fp);
+
+    stream->ctx = NULL;
+    stream->info = NULL;
+    stream->fp = NULL;
+}
+
+void frame_release(frame_t *frame) {
+    if(!frame)
+        return;
+
+    if(atomic_fetch_sub(&frame->refs, 1) > 1)
+        return;
+
+    // last reference dropped
+    if(frame->stream)
+        stream_close(frame->stream);
+
+    if(frame->pool >= 0) {
+        pthread_mutex_lock(&framepool.lock);
+
+        if(framepool.idle + frame->size <= FRAMEPOOL_IDLE) {
+            frame->next = framepool.free[frame->pool];
+            framepool.free[frame->pool] = frame;
+            framepool.idle += frame->size;
+            frame = NULL;
+        }
+
+        pthread_mutex_unlock(&framepool.lock);
+    }
+
+    free(frame);
+}
+
+static void stream_fail(frame_t *frame, char *str) {
+    logger("[-] loader: %s: %s", frame->stream->path, str);
+
+    // black rows from now, a broken template never stops output
+    stream_close(frame->stream);
+    if(frame->pixels)
+        memset(frame->pixels, 0, sizeof(uint32_t) * frame->length);
+
+    frame->stream->failed = 1;
+}
+
+static int stream_restart(frame_t *frame) {
+    stream_t *stream = frame->stream;
+    unsigned char header[8];
+
+    stream_close(stream);
+
+    if(!(stream->fp = fopen(stream->path, "r"))) {
+        stream_fail(frame, strerror(errno));
+        return -1;
+    }
+
+    if(fread(header, 1, 8, stream->fp) != 8 || png_sig_cmp(header, 0, 8)) {
+        stream_fail(frame, "unknown file signature (not a png image)");
+        return -1;
+    }
+
+    if(!(stream->ctx = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, stream_error, NULL)))
+        diep("png_create_read_struct");
+
+    if(!(stream->info = png_create_info_struct(stream->ctx)))
+        diep("png_create_info_struct");
+
+    if(setjmp(png_jmpbuf(stream->ctx))) {
+        stream_fail(frame, "invalid png header");
+        return -1;
+    }
+
+    png_init_io(stream->ctx, stream->fp);
+    png_set_sig_bytes(stream->ctx, 8);
+    png_read_info(stream->ctx, stream->info);
+
+    int width = png_get_image_width(stream->ctx, stream->info);
+    int height = png_get_image_height(stream->ctx, stream->info);
+
+    if(png_get_color_type(stream->ctx, stream->info) != PNG_COLOR_TYPE_RGBA || png_get_bit_depth(stream->ctx, stream->info) != 8) {
+        stream_fail(frame, "only 8 bits RGBA can be streamed");
+        return -1;
+    }
+
+    if(png_get_interlace_type(stream->ctx, stream->info) != PNG_INTERLACE_NONE) {
+        stream_fail(frame, "interlaced image cannot be streamed");
+        return -1;
+    }
+
+    // file replaced while playing, show reload takes care of it
+    if(frame->width && (frame->width != width || frame->height != height)) {
+        stream_fail(frame, "image dimension changed");
+        return -1;
+    }
+
+    frame->width = width;
+    frame->height = height;
+    stream->decoded = 0;
+
+    return 0;
+}
+
+static void stream_decode(frame_t *frame, int until) {
+    stream_t *stream = frame->stream;
+
+    if(stream->failed)
+        return;
+
+    // not modified past setjmp, safe after a longjmp
+    const int last = (until > frame->height) ? frame->height : until;
+
+    if(setjmp(png_jmpbuf(stream->ctx))) {
+        stream_fail(frame, "decoding failed (truncated file ?)");
+        return;
+    }
+
+    while(stream->decoded < last) {
+        png_read_row(stream->ctx, stream->raw, NULL);
+
+        uint32_t *pixel = &frame->pixels[(stream->decoded % stream->rows) * frame->width];
+
+        for(int x = 0; x < frame->width; x++) {
+            png_byte *ptr = &(stream->raw[x * 4]);
+            pixel[x] = ptr[0] | ptr[1] << 8 | ptr[2] << 16 | ptr[3] << 24;
+        }
+
+        stream->decoded += 1;
+    }
+}
+
+// signature and IHDR only, nothing logged: templates not matching
+// are loaded whole and errors are reported there, once
+static int stream_candidate(char *imgfile) {
+    unsigned char header[33];
+    FILE *fp;
+
+    if(!(fp = fopen(imgfile, "r")))
+        return 0;
+
+    size_t length = fread(header, 1, sizeof(header), fp);
+    fclose(fp);
+
+    if(length != sizeof(header) || png_sig_cmp(header, 0, 8) || memcmp(header + 12, "IHDR", 4))
+        return 0;
+
+    uint32_t height;
+    memcpy(&height, header + 20, sizeof(height));
+
+    // bit depth, color type and interlace method follow dimensions
+    if(header[24] != 8 || header[25] != PNG_COLOR_TYPE_RGBA || header[28] != PNG_INTERLACE_NONE)
+        return 0;
+
+    return ntohl(height) > STREAM_THRESHOLD;
+}
+
+frame_t *frame_stream_open(char *imgfile) {
+    stream_t stream = {0};
+    frame_t header = {.stream = &stream};
+    frame_t *frame;
+
+    // path is reopened on each loop, never truncated
+    if(snprintf(stream.path, sizeof(stream.path), "%s", imgfile) >= (int) sizeof(stream.path)) {
+        logger("[-] loader: %s: path too long to stream (maximum %zu)", imgfile, sizeof(stream.path) - 1);
+        return NULL;
+    }
+
+    // header is read before knowing the ring size
+
+    if(stream_restart(&header) < 0)
+        return NULL;
+
+    if(header.width != 2880)
+        logger("[+] loader: warning: image dimension: %d x %d px", header.width, header.height);
+
+    // short images stay entirely in the ring once decoded
+    int rows = (header.height < STREAM_ROWS) ? header.height : STREAM_ROWS;
+
+    frame = frame_alloc(header.width, rows, 1);
+    frame->height = header.height;
+
+    png_bytep raw = frame->stream->raw;
+    *frame->stream = stream;
+    frame->stream->raw = raw;
+    frame->stream->rows = rows;
+
+    // playback can start as soon as first row is there
+    stream_decode(frame, 1);
+
+    if(frame->stream->failed) {
+        frame_release(frame);
+        return NULL;
+    }
+
+    return frame;
+}
+
+uint32_t *frame_row(frame_t *frame, int line) {
+    stream_t *stream = frame->stream;
+
+    if(!stream)
+        return &frame->pixels[line * frame->width];
+
+    // row already dropped from ring (looping), decoding again from start
+    if(line < stream->decoded - stream->rows && !stream->failed)
+        stream_restart(frame);
+
+    if(line >= stream->decoded)
+        stream_decode(frame, line + 1);
+
+    return &frame->pixels[(line % stream->rows) * frame->width];
+}
+
+void frame_prefetch(frame_t *frame, int line) {
+    // filling the ring ahead of playback, called between frames
+    if(!frame->stream)
+        return;
+
+    frame_row(frame, line);
+    stream_decode(frame, line + frame->stream->rows);
+}
+
+frame_t *frame_share(frame_t *source) {
+    // decoder state cannot be shared, streaming again from first row
+    if(source->stream)
+        return frame_stream_open(source->stream->path);
+
+    atomic_fetch_add(&source->refs, 1);
+    return source;
+}
+
+//
+// spatial pixel mapping
+//
+// a pixel map describes where each bar physically is on stage, inside a
+// canvas of spatial templates (one pixel per canvas unit), a table of
+// source pixels and bilinear weights is precomputed for each led, then
+// applied as a gather to resample canvas frames into leds order
+//
+// map syntax, one statement per line, # for comments:
+//   canvas <width> <height>
+//   bar <n> <x-first> <y-first> <x-last> <y-last> [group <g>] [reversed]
+//
+// first and last are the centers of first and last led of the bar
+// (data input side first), reversed swaps them, group is the segment
+// fader controlling this bar (1 to 4, 0 for none), changed at runtime
+// by holding a segment button and pressing presets pads (one per bar)
+//
+void *maperr(char *path, int line, char *str) {
+    fprintf(stderr, "map: %s: line %d: %s\n", path, line, str);
+    logger("[-] map: %s: line %d: %s", path, line, str);
+    return NULL;
+}
+
+void pixelmap_free(pixelmap_t *map) {
+    if(!map)
+        return;
+
+    free(map->path);
+    free(map->index);
+    free(map->weight);
+    free(map);
+}
+
+uint8_t pixelmap_groups(pixelmap_t *map, int bar) {
+    // map group as segments faders mask
+    uint8_t group = map->bars[bar].group;
+    return group ? (1 << (group - 1)) : 0;
+}
+
+pixelmap_t *pixelmap_default() {
+    pixelmap_t *map;
+
+    if(!(map = calloc(sizeof(pixelmap_t), 1)))
+        diep("calloc");
+
+    // bars stacked as rows, same layout than linear templates
+    map->width = PERSEGMENT;
+    map->height = SEGMENTS;
+
+    for(int bar = 0; bar < SEGMENTS; bar++) {
+        map->bars[bar] = (mapbar_t) {
+            .x0 = 0, .y0 = bar,
+            .x1 = PERSEGMENT - 1, .y1 = bar,
+            .group = (bar / (SEGMENTS / MAP_GROUPS)) + 1,
+        };
+    }
+
+    return map;
+}
+
+void pixelmap_build(pixelmap_t *map) {
+    if(!(map->index = malloc(sizeof(*map->index) * LEDSTOTAL)))
+        diep("malloc");
+
+    if(!(map->weight = malloc(sizeof(*map->weight) * LEDSTOTAL)))
+        diep("malloc");
+
+    for(int bar = 0; bar < SEGMENTS; bar++) {
+        mapbar_t *source = &map->bars[bar];
+
+        for(int led = 0; led < PERSEGMENT; led++) {
+            int target = (bar * PERSEGMENT) + led;
+            float t = led / (float) (PERSEGMENT - 1);
+
+            float x = source->x0 + (source->x1 - source->x0) * t;
+            float y = source->y0 + (source->y1 - source->y0) * t;
+
+            // clamp inside canvas
+            x = (x < 0) ? 0 : (x > map->width - 1) ? map->width - 1 : x;
+            y = (y < 0) ? 0 : (y > map->height - 1) ? map->height - 1 : y;
+
+            int ix = (int) x, iy = (int) y;
+            int nx = (ix + 1 < map->width) ? ix + 1 : ix;
+            int ny = (iy + 1 < map->height) ? iy + 1 : iy;
+            float fx = x - ix, fy = y - iy;
+
+            map->index[target][0] = (iy * map->width) + ix;
+            map->index[target][1] = (iy * map->width) + nx;
+            map->index[target][2] = (ny * map->width) + ix;
+            map->index[target][3] = (ny * map->width) + nx;
+
+            uint16_t *weight = map->weight[target];
+
+            weight[1] = (uint16_t) (fx * (1 - fy) * 256 + 0.5);
+            weight[2] = (uint16_t) ((1 - fx) * fy * 256 + 0.5);
+            weight[3] = (uint16_t) (fx * fy * 256 + 0.5);
+
+            // rounding rest on main pixel, weights sum is always 256
+            weight[0] = 256 - weight[1] - weight[2] - weight[3];
+        }
+    }
+}
+
+pixelmap_t *pixelmap_loadfile(char *path) {
+    pixelmap_t *map;
+    char buffer[256];
+    FILE *fp;
+    int line = 0;
+
+    if(!(fp = fopen(path, "r"))) {
+        logger("[-] map: %s: %s", path, strerror(errno));
+        fprintf(stderr, "[-] map: %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    // unspecified bars keep default layout
+    map = pixelmap_default();
+    map->path = strdup(path);
+
+    while(fgets(buffer, sizeof(buffer), fp)) {
+        char *key, *value, *saveptr;
+        char *args[8] = {NULL};
+
+        line += 1;
+
+        if((value = strchr(buffer, '#')))
+            *value = '\0';
+
+        if(!(key = strtok_r(buffer, " \t\r\n", &saveptr)))
+            continue;
+
+        for(int i = 0; i < 8; i++)
+            args[i] = strtok_r(NULL, " \t\r\n", &saveptr);
+
+        if(strcmp(key, "canvas") == 0) {
+            map->width = args[0] ? atoi(args[0]) : 0;
+            map->height = args[1] ? atoi(args[1]) : 0;
+
+            if(map->width <= 0 || map->height <= 0) {
+                fclose(fp);
+                pixelmap_free(map);
+                return maperr(path, line, "invalid canvas size");
+            }
+
+            continue;
+        }
+
+        if(strcmp(key, "bar") != 0) {
+            fclose(fp);
+            pixelmap_free(map);
+            return maperr(path, line, "unknown statement");
+        }
+
+        int bar = args[0] ? atoi(args[0]) - 1 : -1;
+
+        if(bar < 0 || bar >= SEGMENTS || !args[4]) {
+            fclose(fp);
+            pixelmap_free(map);
+            return maperr(path, line, "invalid bar");
+        }
+
+        mapbar_t *target = &map->bars[bar];
+
+        target->x0 = atof(args[1]);
+        target->y0 = atof(args[2]);
+        target->x1 = atof(args[3]);
+        target->y1 = atof(args[4]);
+
+        for(int i = 5; i < 8 && args[i]; i++) {
+            if(strcmp(args[i], "reversed") == 0) {
+                mapbar_t original = *target;
+
+                target->x0 = original.x1;
+                target->y0 = original.y1;
+                target->x1 = original.x0;
+                target->y1 = original.y0;
+
+            } else if(strcmp(args[i], "group") == 0 && i + 1 < 8 && args[i + 1]) {
+                int group = atoi(args[++i]);
+
+                if(group < 0 || group > GROUPS_TOTAL) {
+                    fclose(fp);
+                    pixelmap_free(map);
+                    return maperr(path, line, "invalid group");
+                }
+
+                target->group = group;
+
+            } else {
+                fclose(fp);
+                pixelmap_free(map);
+                return maperr(path, line, "invalid bar option");
+            }
+        }
+    }
+
+    fclose(fp);
+
+    return map;
+}
+
+void pixelmap_gather(pixelmap_t *map, const pixel_t *canvas, pixel_t *output) {
+    for(int i = 0; i < LEDSTOTAL; i++) {
+        const uint32_t *index = map->index[i];
+        const uint16_t *weight = map->weight[i];
+        uint32_t r = 0, g = 0, b = 0, a = 0;
+
+        for(int k = 0; k < 4; k++) {
+            const pixel_t *source = &canvas[index[k]];
+
+            r += source->r * weight[k];
+            g += source->g * weight[k];
+            b += source->b * weight[k];
+            a += source->a * weight[k];
+        }
+
+        output[i].r = r >> 8;
+        output[i].g = g >> 8;
+        output[i].b = b >> 8;
+        output[i].a = a >> 8;
+    }
+}
+
+frame_t *pixelmap_resample(pixelmap_t *map, frame_t *canvas) {
+    frame_t *frame;
+
+    // spatial animation is a vertical strip of canvas images
+    if(canvas->width != map->width || canvas->height % map->height != 0) {
+        logger("[-] map: template %dx%d does not fit %dx%d canvas",
+            canvas->width, canvas->height, map->width, map->height);
+        return NULL;
+    }
+
+    frame = frame_alloc(LEDSTOTAL, canvas->height / map->height, 0);
+
+    size_t area = map->width * map->height;
+
+    for(int line = 0; line < frame->height; line++) {
+        pixel_t *source = (pixel_t *) &canvas->pixels[line * area];
+        pixel_t *target = (pixel_t *) &frame->pixels[line * LEDSTOTAL];
+
+        pixelmap_gather(map, source, target);
+    }
+
+    return frame;
+}
+
+//
+// layers compositing
+//
+// layers are composited bottom to top in a single pass, for each block
+// of pixels the destination stays in vector registers while every layer
+// is blended in, kernels use gcc vector extensions (sse, avx or neon
+// depending on target) with exact integer division by 255
+//
+typedef uint8_t v64u8 __attribute__ ((vector_size(64)));
+typedef uint16_t v64u16 __attribute__ ((vector_size(128)));
+typedef uint32_t v16u32 __attribute__ ((vector_size(64)));
+
+#define COMPOSITE_BLOCK       16    // pixels per vector block (64 bytes)
+
+static const char *blend_names[] = {
+    [BLEND_ADD] = "add",
+    [BLEND_ALPHA] = "alpha",
+    [BLEND_MULTIPLY] = "multiply",
+    [BLEND_SCREEN] = "screen",
+    [BLEND_MAX] = "max",
+    [BLEND_MASK] = "mask",
+};
+
+// vectors by address: wider than registers, gcc notes its changed psabi
+// for any vector argument on every build, even always inlined
+static inline void composite_div255(v64u16 *x) {
+    // exact x / 255 for x in [0, 255 * 255]
+    *x = (*x + 1 + (*x >> 8)) >> 8;
+}
+
+static inline void composite_alpha(v64u16 *alpha, const v64u8 *raw) {
+    // broadcast alpha byte of each pixel to its four channels,
+    // without byte shuffle (not available on plain sse2)
+    v16u32 broadcast = ((v16u32) *raw >> 24) * 0x01010101;
+    *alpha = __builtin_convertvector((v64u8) broadcast, v64u16);
+}
+
+static inline void composite_kernel(v64u16 *output, const v64u8 *raw, uint8_t blend, uint16_t opacity) {
+    v64u16 dst = *output;
+    v64u16 src = __builtin_convertvector(*raw, v64u16);
+    v64u16 full = dst * 0 + 255;
+    v64u16 weight = full * 0 + opacity;
+    v64u16 blended, diff;
+
+    switch(blend) {
+    case BLEND_ADD:
+        // saturate, sum is at most 510
+        blended = dst + src;
+        blended = (blended | -(blended >> 8)) & 0xff;
+        break;
+
+    case BLEND_ALPHA:
+        composite_alpha(&weight, raw);
+        weight *= opacity;
+        composite_div255(&weight);
+        blended = src;
+        break;
+
+    case BLEND_MULTIPLY:
+        blended = dst * src;
+        composite_div255(&blended);
+        break;
+
+    case BLEND_SCREEN:
+        blended = (full - dst) * (full - src);
+        composite_div255(&blended);
+        blended = full - blended;
+        break;
+
+    case BLEND_MAX:
+        // difference sign bit is set when source is lower
+        diff = src - dst;
+        blended = dst + (diff & ((diff >> 15) - 1));
+        break;
+
+    case BLEND_MASK:
+        // attenuate destination by source alpha, like a stencil
+        composite_alpha(&weight, raw);
+        weight *= opacity;
+        composite_div255(&weight);
+
+        dst *= full - weight;
+        composite_div255(&dst);
+        *output = dst;
+        return;
+
+    default:
+        return;
+    }
+
+    dst = dst * (full - weight) + blended * weight;
+    composite_div255(&dst);
+    *output = dst;
+}
+
+void layers_composite(pixel_t *output, composite_t *inputs, int count, int length) {
+    // output comes from arena, stores are aligned
+    output = __builtin_assume_aligned(output, ARENA_ALIGN);
+
+    for(int offset = 0; offset < length; offset += COMPOSITE_BLOCK) {
+        v64u16 dst = {0};
+        v64u8 raw;
+
+        for(int i = 0; i < count; i++) {
+            composite_t *input = &inputs[i];
+
+            memcpy(&raw, &input->row[offset], sizeof(raw));
+            composite_kernel(&dst, &raw, input->blend, input->opacity);
+        }
+
+        raw = __builtin_convertvector(dst, v64u8);
+        memcpy(&output[offset], &raw, sizeof(raw));
+    }
+}
+
+int layers_blend_parse(char *name) {
+    for(size_t i = 0; i < sizeof(blend_names) / sizeof(char *); i++)
+        if(blend_names[i] && strcmp(name, blend_names[i]) == 0)
+            return i;
+
+    return -1;
+}
+
+void layers_benchmark() {
+    int layers = 8, iterations = 20000;
+    composite_t inputs[8];
+    pixel_t *output, *rows[8];
+    struct timeval before, after;
+
+    printf("[+] benchmark: compositing %d layers of %d pixels\n", layers, LEDSTOTAL);
+
+    output = arena_alloc(sizeof(pixel_t) * LEDSTOTAL);
+
+    for(int i = 0; i < layers; i++) {
+        rows[i] = arena_alloc(sizeof(pixel_t) * LEDSTOTAL);
+
+        for(int p = 0; p < LEDSTOTAL; p++)
+            rows[i][p].raw = (uint32_t) rand();
+
+        inputs[i].row = rows[i];
+        inputs[i].blend = i % BLEND_MODES;
+        inputs[i].opacity = 255 - (i * 16);
+    }
+
+    for(int mode = -1; mode < BLEND_MODES; mode++) {
+        // single mode on all layers, then mixed modes
+        for(int i = 0; i < layers; i++)
+            inputs[i].blend = (mode < 0) ? i % BLEND_MODES : mode;
+
+        gettimeofday(&before, NULL);
+
+        for(int i = 0; i < iterations; i++)
+            layers_composite(output, inputs, layers, LEDSTOTAL);
+
+        gettimeofday(&after, NULL);
+
+        double frame = (timediff(&after, &before) / iterations) * 1000000;
+
+        printf("[+] benchmark: %-8s %7.2f us per frame %s\n",
+            (mode < 0) ? "mixed" : blend_names[mode], frame, (frame < 1000) ? "" : "(over budget)");
+    }
+}
+
+//
+// presets and masks loader
+//
+// requests are kept per layer (latest wins), a pool of workers prepares
+// frames from the show and commits them unless a newer request superseded
+// them, neighbours of selected pads are prepared ahead of time, switching
+// to a nearby slot is then a pointer handoff
+//
+// locking order: showlock, loader lock, main lock
+//
+static int loader_neighbours(int slot, int *neighbours) {
+    int column = slot % SHOW_BANK;
+    int total = 0;
+
+    // same row on the surface, then same column on other banks
+    if(column > 0)
+        neighbours[total++] = slot - 1;
+
+    if(column < SHOW_BANK - 1)
+        neighbours[total++] = slot + 1;
+
+    if(slot >= SHOW_BANK)
+        neighbours[total++] = slot - SHOW_BANK;
+
+    if(slot + SHOW_BANK < SHOW_SLOTS)
+        neighbours[total++] = slot + SHOW_BANK;
+
+    return total;
+}
+
+void loader_prefetch(kntxt_t *kntxt, int kind, int slot) {
+    loader_t *loader = &kntxt->loader;
+
+    pthread_mutex_lock(&loader->lock);
+
+    // previous speculative work is not relevant anymore
+    loader->prefetch_total[kind] = loader_neighbours(slot, loader->prefetch[kind]);
+    pthread_cond_broadcast(&loader->wakeup);
+
+    pthread_mutex_unlock(&loader->lock);
+}
+
+void loader_request(kntxt_t *kntxt, int kind, int slot) {
+    loader_t *loader = &kntxt->loader;
+
+    pthread_mutex_lock(&loader->lock);
+
+    loader->serial[kind] += 1;
+    loader->pending[kind] = slot;
+    pthread_cond_broadcast(&loader->wakeup);
+
+    pthread_mutex_unlock(&loader->lock);
+
+    loader_prefetch(kntxt, kind, slot);
+}
+
+void loader_cancel(kntxt_t *kntxt, int kind) {
+    loader_t *loader = &kntxt->loader;
+
+    // loads in progress will be dropped when done
+    pthread_mutex_lock(&loader->lock);
+    loader->serial[kind] += 1;
+    loader->pending[kind] = -1;
+    pthread_mutex_unlock(&loader->lock);
+}
+
+static prepared_t *loader_cache_search(loader_t *loader, int kind, int slot, int version) {
+    for(int i = 0; i < LOADER_CACHE; i++) {
+        prepared_t *entry = &loader->cache[i];
+
+        // content of another show, not usable anymore
+        if(entry->frame && entry->version != version) {
+            frame_release(entry->frame);
+            entry->frame = NULL;
+        }
+
+        if(entry->frame && entry->kind == kind && entry->slot == slot)
+            return entry;
+    }
+
+    return NULL;
+}
+
+static void loader_cache_insert(loader_t *loader, int kind, int slot, int version, frame_t *frame) {
+    prepared_t *entry = loader_cache_search(loader, kind, slot, version);
+
+    // already prepared by another worker
+    if(entry) {
+        frame_release(frame);
+        return;
+    }
+
+    // free entry, or least recently prepared one
+    entry = &loader->cache[0];
+
+    for(int i = 0; i < LOADER_CACHE && entry->frame; i++)
+        if(!loader->cache[i].frame || loader->cache[i].stamp < entry->stamp)
+            entry = &loader->cache[i];
+
+    frame_release(entry->frame);
+
+    entry->kind = kind;
+    entry->slot = slot;
+    entry->version = version;
+    entry->stamp = loader->stamp++;
+    entry->frame = frame;
+}
+
+static int loader_next(loader_t *loader, int *kind, int *slot, int *prefetch, uint64_t *serial) {
+    // called with loader lock held, requested slots first
+    for(int i = 0; i < LOADER_KINDS; i++) {
+        if(loader->pending[i] < 0)
+            continue;
+
+        *kind = i;
+        *slot = loader->pending[i];
+        *serial = loader->serial[i];
+        *prefetch = 0;
+
+        loader->pending[i] = -1;
+        return 1;
+    }
+
+    for(int i = 0; i < LOADER_KINDS; i++) {
+        if(loader->prefetch_total[i] == 0)
+            continue;
+
+        *kind = i;
+        *slot = loader->prefetch[i][--loader->prefetch_total[i]];
+        *prefetch = 1;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+void *thread_loader(void *extra) {
+    kntxt_t *kntxt = (kntxt_t *) extra;
+    loader_t *loader = &kntxt->loader;
+    char *names[LOADER_KINDS] = {"preset", "mask"};
+
+    while(kntxt->keepgoing) {
+        int kind = 0, slot = 0, prefetch = 0;
+        uint64_t serial = 0;
+        frame_t *frame = NULL;
+
+        // predicate checked on each wakeup, no request can be lost
+        pthread_mutex_lock(&loader->lock);
+
+        while(kntxt->keepgoing && !loader_next(loader, &kind, &slot, &prefetch, &serial))
+            pthread_cond_wait(&loader->wakeup, &loader->lock);
+
+        pthread_mutex_unlock(&loader->lock);
+
+        if(!kntxt->keepgoing)
+            break;
+
+        // fetching pre-decoded frame of slot, or already prepared one
+        pthread_rwlock_rdlock(&kntxt->showlock);
+
+        int version = kntxt->show_version;
+        source_t *source = (kind == LOADER_PRESET) ? &kntxt->show->presets[slot] : &kntxt->show->masks[slot];
+
+        pthread_mutex_lock(&loader->lock);
+
+        prepared_t *entry = loader_cache_search(loader, kind, slot, version);
+
+        if(entry && !prefetch) {
+            frame = entry->frame;
+            entry->frame = NULL;
+        }
+
+        pthread_mutex_unlock(&loader->lock);
+
+        if(!entry && source->frame)
+            frame = frame_share(source->frame);
+
+        if(frame && !prefetch)
+            logger("[+] loader: loading %s %d: %s%s", names[kind], slot + 1, source->name, entry ? " (prepared)" : "");
+
+        pthread_rwlock_unlock(&kntxt->showlock);
+
+        // slot empty, not available or already prepared
+        if(!frame)
+            continue;
+
+        // streamed templates get their lookahead rows ready
+        frame_prefetch(frame, 0);
+
+        pthread_mutex_lock(&loader->lock);
+
+        if(prefetch) {
+            loader_cache_insert(loader, kind, slot, version, frame);
+
+        } else if(serial != loader->serial[kind]) {
+            // another slot selected meanwhile, or layer reset
+            frame_release(frame);
+
+        } else {
+            // commit frame, free previous one not yet acquired by animate thread
+            pthread_mutex_lock(&kntxt->lock);
+
+            if(kind == LOADER_PRESET) {
+                frame_release(kntxt->frame);
+                kntxt->frame = frame;
+
+            } else {
+                frame_release(kntxt->maskframe);
+                kntxt->maskframe = frame;
+                kntxt->maskpending = 1;
+            }
+
+            pthread_mutex_unlock(&kntxt->lock);
+        }
+
+        pthread_mutex_unlock(&loader->lock);
+    }
+
+    return NULL;
+}
+
+//
+// show management
+//
+// a show declares presets and masks slots with their source, default
+// speed and calibration, everything is decoded before being used (long
+// templates only have their header checked, they are streamed while
+// playing), reloading a show never interrupts current output
+//
+// show syntax, one statement per line, # for comments:
+//   name <pretty name>
+//   prefix <directory>           (templates, relative to show file)
+//   speed <fps>                  (animation speed without fader)
+//   calibration <r> <g> <b>      (output channels gain, 0-255)
+//   surface <profile>            (used when none given on command line)
+//   map <pixel-map>              (bars layout, default is linear)
+//   bank <n>                     (following slots are relative to bank)
+//   preset <slot> template <file>
+//   preset <slot> spatial <file> (drawn on pixel map canvas)
+//   preset <slot> solid <r> <g> <b>
+//   mask <slot> template|spatial <file>
+//   layer <blend> <opacity> <speed%> template|spatial <file>
+//
+// layers are stacked in declaration order between preset and mask,
+// blend is one of: add, alpha, multiply, screen, max, mask
+//
+void *showerr(char *path, int line, char *str) {
+    fprintf(stderr, "show: %s: line %d: %s\n", path, line, str);
+    logger("[-] show: %s: line %d: %s", path, line, str);
+    return NULL;
+}
+
+char *show_path_resolve(char *directory, char *file) {
+    char buffer[512];
+
+    if(file[0] == '/' || !directory)
+        return strdup(file);
+
+    snprintf(buffer, sizeof(buffer), "%s/%s", directory, file);
+    return strdup(buffer);
+}
+
+char *show_directory(char *path) {
+    char *directory = strdup(path);
+    char *slash = strrchr(directory, '/');
+
+    if(!slash) {
+        free(directory);
+        return strdup(".");
+    }
+
+    *slash = '\0';
+    return directory;
+}
+
+void show_free(show_t *show) {
+    if(!show)
+        return;
+
+    for(int i = 0; i < SHOW_SLOTS; i++) {
+        source_t *sources[] = {&show->presets[i], &show->masks[i]};
+
+        for(int j = 0; j < 2; j++) {
+            free(sources[j]->name);
+            free(sources[j]->path);
+            frame_release(sources[j]->frame);
+        }
+    }
+
+    for(int i = 0; i < show->layers_total; i++) {
+        free(show->layers[i].source.name);
+        free(show->layers[i].source.path);
+        frame_release(show->layers[i].source.frame);
+    }
+
+    for(int i = 0; i < show->surfaces_total; i++)
+        free(show->surfaces[i]);
+
+    pixelmap_free(show->map);
+
+    free(show->path);
+    free(show->name);
+    free(show->prefix);
+    free(show->mappath);
+    free(show);
+}
+
+static show_t *show_parse_error(show_t *show, FILE *fp, int line, char *str) {
+    showerr(show->path, line, str);
+    fclose(fp);
+    show_free(show);
+    return NULL;
+}
+
+show_t *show_parsefile(char *path) {
+    show_t *show;
+    char buffer[512];
+    FILE *fp;
+    int line = 0;
+    int bank = 0;
+
+    if(!(fp = fopen(path, "r"))) {
+        logger("[-] show: %s: %s", path, strerror(errno));
+        fprintf(stderr, "[-] show: %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    if(!(show = calloc(sizeof(show_t), 1)))
+        diep("calloc");
+
+    char *directory = show_directory(path);
+
+    show->path = strdup(path);
+    show->speed = 1000000 / TARGET_FPS;
+    memset(show->calibration, 255, sizeof(show->calibration));
+    show->strobe_bars = SEGMENTS;
+
+    while(fgets(buffer, sizeof(buffer), fp)) {
+        char *key, *value, *saveptr;
+        char *args[5] = {NULL, NULL, NULL, NULL, NULL};
+
+        line += 1;
+
+        if((value = strchr(buffer, '#')))
+            *value = '\0';
+
+        if(!(key = strtok_r(buffer, " \t\r\n", &saveptr)))
+            continue;
+
+        if(strcmp(key, "name") == 0) {
+            if(!(value = strtok_r(NULL, "\r\n", &saveptr))) {
+                free(directory);
+                return show_parse_error(show, fp, line, "missing value");
+            }
+
+            while(*value == ' ' || *value == '\t')
+                value += 1;
+
+            free(show->name);
+            show->name = strdup(value);
+            continue;
+        }
+
+        for(int i = 0; i < 5; i++)
+            args[i] = strtok_r(NULL, " \t\r\n", &saveptr);
+
+        if(!args[0]) {
+            free(directory);
+            return show_parse_error(show, fp, line, "missing value");
+        }
+
+        if(strcmp(key, "prefix") == 0) {
+            free(show->prefix);
+            show->prefix = show_path_resolve(directory, args[0]);
+            continue;
+        }
+
+        if(strcmp(key, "speed") == 0) {
+            int fps = atoi(args[0]);
+
+            if(fps <= 0 || fps > 1000) {
+                free(directory);
+                return show_parse_error(show, fp, line, "invalid speed");
+            }
+
+            show->speed = 1000000 / fps;
+            continue;
+        }
+
+        if(strcmp(key, "calibration") == 0) {
+            for(int i = 0; i < 3; i++) {
+                int gain = args[i] ? atoi(args[i]) : -1;
+
+                if(gain < 0 || gain > 255) {
+                    free(directory);
+                    return show_parse_error(show, fp, line, "invalid calibration");
+                }
+
+                show->calibration[i] = gain;
+            }
+
+            continue;
+        }
+
+        if(strcmp(key, "strobe") == 0) {
+            int mode = 0;
+
+            while(mode < STROBE_MODES && strcmp(strobe_names[mode], args[0]) != 0)
+                mode += 1;
+
+            int bars = args[1] ? atoi(args[1]) : SEGMENTS;
+
+            if(mode == STROBE_MODES || bars < 1 || bars > 255) {
+                free(directory);
+                return show_parse_error(show, fp, line, "invalid strobe");
+            }
+
+            show->strobe_mode = mode;
+            show->strobe_bars = bars;
+            continue;
+        }
+
+        if(strcmp(key, "bump") == 0) {
+            int attack = atoi(args[0]);
+            int decay = args[1] ? atoi(args[1]) : -1;
+
+            if(attack < 0 || attack > 10000 || decay < 0 || decay > 10000) {
+                free(directory);
+                return show_parse_error(show, fp, line, "invalid bump envelope");
+            }
+
+            show->attack = attack;
+            show->decay = decay;
+            continue;
+        }
+
+        if(strcmp(key, "map") == 0) {
+            free(show->mappath);
+            show->mappath = show_path_resolve(directory, args[0]);
+            continue;
+        }
+
+        if(strcmp(key, "surface") == 0) {
+            if(show->surfaces_total == SURFACE_MAXIMUM) {
+                free(directory);
+                return show_parse_error(show, fp, line, "too many surfaces");
+            }
+
+            show->surfaces[show->surfaces_total++] = show_path_resolve(directory, args[0]);
+            continue;
+        }
+
+        if(strcmp(key, "bank") == 0) {
+            bank = atoi(args[0]);
+
+            if(bank < 1 || bank * SHOW_BANK > SHOW_SLOTS) {
+                free(directory);
+                return show_parse_error(show, fp, line, "invalid bank");
+            }
+
+            continue;
+        }
+
+        if(strcmp(key, "layer") == 0) {
+            int blend = layers_blend_parse(args[0]);
+            int opacity = args[1] ? atoi(args[1]) : -1;
+            int speed = args[2] ? atoi(args[2]) : -1;
+
+            if(show->layers_total == LAYERS_EXTRA) {
+                free(directory);
+                return show_parse_error(show, fp, line, "too many layers");
+            }
+
+            if(blend < 0 || opacity < 0 || opacity > 255 || speed < 0 || speed > 1000) {
+                free(directory);
+                return show_parse_error(show, fp, line, "invalid layer settings");
+            }
+
+            int spatial = args[3] && strcmp(args[3], "spatial") == 0;
+
+            if(!args[3] || (!spatial && strcmp(args[3], "template") != 0) || !args[4]) {
+                free(directory);
+                return show_parse_error(show, fp, line, "invalid layer source");
+            }
+
+            showlayer_t *layer = &show->layers[show->layers_total++];
+
+            layer->source.spatial = spatial;
+            layer->layer.blend = blend;
+            layer->layer.opacity = opacity;
+            layer->layer.speed = speed;
+            layer->source.name = strdup(args[4]);
+            layer->source.path = strdup(args[4]); // resolved when prefix is known
+
+            continue;
+        }
+
+        if(strcmp(key, "preset") != 0 && strcmp(key, "mask") != 0) {
+            free(directory);
+            return show_parse_error(show, fp, line, "unknown statement");
+        }
+
+        // slots are numbered from 1, inside bank if any
+        int slot = atoi(args[0]) - 1;
+        int limit = bank ? SHOW_BANK : SHOW_SLOTS;
+
+        if(slot < 0 || slot >= limit || !args[1] || !args[2]) {
+            free(directory);
+            return show_parse_error(show, fp, line, "invalid slot");
+        }
+
+        if(bank)
+            slot += (bank - 1) * SHOW_BANK;
+
+        source_t *source = (key[0] == 'p') ? &show->presets[slot] : &show->masks[slot];
+        char name[64];
+
+        free(source->name);
+        free(source->path);
+        source->path = NULL;
+
+        if(strcmp(args[1], "template") == 0 || strcmp(args[1], "spatial") == 0) {
+            source->name = strdup(args[2]);
+            source->path = strdup(args[2]); // resolved when prefix is known
+            source->spatial = (args[1][0] == 's');
+
+        } else if(strcmp(args[1], "solid") == 0 && key[0] == 'p' && args[3] && args[4]) {
+            snprintf(name, sizeof(name), "solid #%02x%02x%02x", atoi(args[2]), atoi(args[3]), atoi(args[4]));
+            source->name = strdup(name);
+            source->frame = frame_generate_solid(atoi(args[2]), atoi(args[3]), atoi(args[4]));
+
+        } else {
+            source->name = NULL;
+            free(directory);
+            return show_parse_error(show, fp, line, "invalid source");
+        }
+    }
+
+    fclose(fp);
+
+    if(!show->name)
+        show->name = strdup(path);
+
+    if(!show->prefix)
+        show->prefix = strdup(directory);
+
+    free(directory);
+
+    // resolve templates path against final prefix
+    for(int i = 0; i < show->layers_total; i++) {
+        char *resolved = show_path_resolve(show->prefix, show->layers[i].source.path);
+        free(show->layers[i].source.path);
+        show->layers[i].source.path = resolved;
+    }
+
+    for(int i = 0; i < SHOW_SLOTS; i++) {
+        source_t *sources[] = {&show->presets[i], &show->masks[i]};
+
+        for(int j = 0; j < 2; j++) {
+            if(!sources[j]->path)
+                continue;
+
+            char *resolved = show_path_resolve(show->prefix, sources[j]->path);
+            free(sources[j]->path);
+            sources[j]->path = resolved;
+        }
+    }
+
+    return show;
+}
+
+frame_t *show_source_load(show_t *show, source_t *source) {
+    frame_t *canvas, *frame;
+
+    // long linear templates are streamed while playing, only
+    // header and first row are decoded now
+    if(!source->spatial && stream_candidate(source->path))
+        return frame_stream_open(source->path);
+
+    if(!(canvas = frame_loadfile(source->path)))
+        return NULL;
+
+    if(!source->spatial)
+        return canvas;
+
+    // resampling canvas into leds order once, while loading
+    frame = pixelmap_resample(show->map, canvas);
+    frame_release(canvas);
+
+    return frame;
+}
+
+show_t *show_loadfile(char *path) {
+    show_t *show;
+    int failed = 0;
+
+    if(!(show = show_parsefile(path)))
+        return NULL;
+
+    // bars layout, precomputing resampling table
+    if(show->mappath) {
+        if(!(show->map = pixelmap_loadfile(show->mappath))) {
+            show_free(show);
+            return NULL;
+        }
+
+    } else {
+        show->map = pixelmap_default();
+    }
+
+    pixelmap_build(show->map);
+
+    // pre-decode every template, slots which cannot be loaded are dropped
+    for(int i = 0; i < SHOW_SLOTS; i++) {
+        source_t *sources[] = {&show->presets[i], &show->masks[i]};
+
+        for(int j = 0; j < 2; j++) {
+            source_t *source = sources[j];
+
+            // loader already logged the reason
+            if(source->path && !(source->frame = show_source_load(show, source))) {
+                free(source->name);
+                source->name = NULL;
+                failed += 1;
+            }
+        }
+
+        show->presets_names[i] = show->presets[i].name;
+        show->masks_names[i] = show->masks[i].name;
+    }
+
+    // a layer which cannot be loaded stays in stack, but empty
+    for(int i = 0; i < show->layers_total; i++) {
+        source_t *source = &show->layers[i].source;
+
+        if(!(source->frame = show_source_load(show, source)))
+            failed += 1;
+    }
+
+    logger("[+] show: %s loaded (%d sources failed)", show->name, failed);
+
+    return show;
+}
+
+int show_uses_file(show_t *show, char *filename) {
+    // does the show depends on this (base)name
+    char *base = strrchr(show->path, '/');
+    if(strcmp(base ? base + 1 : show->path, filename) == 0)
+        return 1;
+
+    if(show->mappath) {
+        base = strrchr(show->mappath, '/');
+        if(strcmp(base ? base + 1 : show->mappath, filename) == 0)
+            return 1;
+    }
+
+    for(int i = 0; i < show->layers_total; i++) {
+        base = strrchr(show->layers[i].source.path, '/');
+        if(strcmp(base ? base + 1 : show->layers[i].source.path, filename) == 0)
+            return 1;
+    }
+
+    for(int i = 0; i < SHOW_SLOTS; i++) {
+        source_t *sources[] = {&show->presets[i], &show->masks[i]};
+
+        for(int j = 0; j < 2; j++) {
+            if(!sources[j]->path)
+                continue;
+
+            base = strrchr(sources[j]->path, '/');
+            if(strcmp(base ? base + 1 : sources[j]->path, filename) == 0)
+                return 1;
+        }
+    }
+
+    return 0;
+}
+
+void show_apply(kntxt_t *kntxt, show_t *show) {
+    show_t *previous;
+
+    pthread_rwlock_wrlock(&kntxt->showlock);
+
+    // loads in progress belong to previous show
+    loader_cancel(kntxt, LOADER_PRESET);
+    loader_cancel(kntxt, LOADER_MASK);
+
+    pthread_mutex_lock(&kntxt->lock);
+
+    previous = kntxt->show;
+
+    // keep selected slots, names are pointers inside show lists
+    int preset = list_index_search(kntxt->presets, kntxt->preset, kntxt->presets_total);
+    int mask = list_index_search(kntxt->masks, kntxt->mask, kntxt->masks_total);
+
+    kntxt->show = show;
+    kntxt->presets = show->presets_names;
+    kntxt->presets_total = SHOW_SLOTS;
+    kntxt->masks = show->masks_names;
+    kntxt->masks_total = SHOW_SLOTS;
+
+    // slot of current preset can be empty now, then previous
+    // frame keeps playing until another preset is selected
+    kntxt->preset = (preset >= 0) ? kntxt->presets[preset] : NULL;
+    kntxt->mask = (mask >= 0) ? kntxt->masks[mask] : NULL;
+
+    if(kntxt->midi.sliders[7].value == 0)
+        kntxt->speed = show->speed;
+
+    kntxt->defspeed = show->speed;
+    control_t *control = control_begin(&kntxt->controls);
+
+    memcpy(control->calibration, show->calibration, sizeof(control->calibration));
+    control->attack = show->attack;
+    control->decay = show->decay;
+
+    // strobe mode selected from surface is kept, unless show changed it
+    if(!previous || previous->strobe_mode != show->strobe_mode || previous->strobe_bars != show->strobe_bars) {
+        control->strobe_mode = show->strobe_mode;
+        control->strobe_bars = show->strobe_bars;
+    }
+
+    // groups changed at runtime are kept, unless map changed them
+    for(int bar = 0; bar < SEGMENTS; bar++)
+        if(!previous || pixelmap_groups(previous->map, bar) != pixelmap_groups(show->map, bar))
+            control->bargroups[bar] = pixelmap_groups(show->map, bar);
+
+    control_commit(&kntxt->controls, control);
+
+    // rebuild layers stack, preset and mask keep their faders
+    layer_t preset_layer = {.blend = BLEND_ADD, .opacity = 255, .speed = 100};
+    layer_t mask_layer = {.blend = BLEND_MASK, .opacity = 255, .speed = 100};
+
+    if(previous) {
+        preset_layer = kntxt->layers[0];
+        mask_layer = kntxt->layers[kntxt->layers_total - 1];
+    }
+
+    kntxt->layers_total = show->layers_total + 2;
+    kntxt->layers[0] = preset_layer;
+
+    for(int i = 0; i < show->layers_total; i++)
+        kntxt->layers[i + 1] = show->layers[i].layer;
+
+    kntxt->layers[kntxt->layers_total - 1] = mask_layer;
+
+    kntxt->show_version += 1;
+
+    if(previous && mask >= 0 && !kntxt->mask) {
+        frame_release(kntxt->maskframe);
+        kntxt->maskframe = NULL;
+        kntxt->maskpending = 1;
+    }
+
+    pthread_mutex_unlock(&kntxt->lock);
+    pthread_rwlock_unlock(&kntxt->showlock);
+
+    // nobody can reference previous show anymore
+    show_free(previous);
+
+    // refresh playing frames with new content
+    if(previous && preset >= 0 && kntxt->presets[preset])
+        loader_request(kntxt, LOADER_PRESET, preset);
+
+    if(previous && mask >= 0 && kntxt->masks[mask])
+        loader_request(kntxt, LOADER_MASK, mask);
+}
+
+void *thread_show(void *extra) {
+    kntxt_t *kntxt = (kntxt_t *) extra;
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    int watches[3] = {-1, -1, -1};
+    int fd;
+
+    if((fd = inotify_init1(IN_NONBLOCK)) < 0) {
+        logger("[-] show: inotify: %s, live reload disabled", strerror(errno));
+        return NULL;
+    }
+
+    pthread_rwlock_rdlock(&kntxt->showlock);
+    char *path = strdup(kntxt->show->path);
+    pthread_rwlock_unlock(&kntxt->showlock);
+
+    logger("[+] show: watching %s for changes", path);
+
+    int reload = 1; // initial watches setup
+    struct timespec changed = {0, 0};
+
+    while(kntxt->keepgoing) {
+        if(reload == 1) {
+            // (re)watch show, templates and map directories, editors
+            // usually replace files instead of writing them in place
+            pthread_rwlock_rdlock(&kntxt->showlock);
+            char *directories[3] = {
+                show_directory(path),
+                strdup(kntxt->show->prefix),
+                kntxt->show->mappath ? show_directory(kntxt->show->mappath) : NULL,
+            };
+            pthread_rwlock_unlock(&kntxt->showlock);
+
+            for(int i = 0; i < 3; i++) {
+                if(watches[i] >= 0)
+                    inotify_rm_watch(fd, watches[i]);
+
+                watches[i] = -1;
+
+                if(!directories[i])
+                    continue;
+
+                watches[i] = inotify_add_watch(fd, directories[i], IN_CLOSE_WRITE | IN_MOVED_TO);
+                if(watches[i] < 0)
+                    logger("[-] show: watch %s: %s", directories[i], strerror(errno));
+
+                free(directories[i]);
+            }
+
+            reload = 0;
+        }
+
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+
+        if(poll(&pfd, 1, 100) < 0)
+            diep("show: poll");
+
+        ssize_t length;
+
+        while((length = read(fd, buffer, sizeof(buffer))) > 0) {
+            for(char *ptr = buffer; ptr < buffer + length; ) {
+                struct inotify_event *event = (struct inotify_event *) ptr;
+                ptr += sizeof(struct inotify_event) + event->len;
+
+                if(!event->len)
+                    continue;
+
+                pthread_rwlock_rdlock(&kntxt->showlock);
+                int used = show_uses_file(kntxt->show, event->name);
+                pthread_rwlock_unlock(&kntxt->showlock);
+
+                if(used) {
+                    // wait for changes to settle, files are often
+                    // written in multiple steps
+                    clock_gettime(CLOCK_MONOTONIC, &changed);
+                    reload = 2;
+                }
+            }
+        }
+
+        if(reload != 2)
+            continue;
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        long elapsed = (now.tv_sec - changed.tv_sec) * 1000 + (now.tv_nsec - changed.tv_nsec) / 1000000;
+        if(elapsed < SHOW_SETTLE)
+            continue;
+
+        // decoding the whole show in this thread, output untouched
+        logger("[+] show: changes detected, reloading");
+
+        show_t *show;
+        if(!(show = show_loadfile(path))) {
+            logger("[-] show: reload failed, keeping current show");
+            reload = 0;
+            continue;
+        }
+
+        show_apply(kntxt, show);
+        reload = 1;
+    }
+
+    close(fd);
+    free(path);
+
+    return NULL;
+}
+
+void animate_static_layers(kntxt_t *kntxt, frame_t **frames, int *total, double *positions) {
+    // called with showlock and main lock held, show changed
+    show_t *show = kntxt->show;
+    int current = *total;
+    int updated = 2 + show->layers_total;
+
+    // mask frame moves on top of new stack
+    frame_t *maskframe = (current > 1) ? frames[current - 1] : NULL;
+    double maskposition = (current > 1) ? positions[current - 1] : 0;
+
+    for(int i = 1; i < current - 1; i++)
+        frame_release(frames[i]);
+
+    for(int i = 0; i < show->layers_total; i++) {
+        frame_t *frame = show->layers[i].source.frame;
+
+        frames[i + 1] = frame ? frame_share(frame) : NULL;
+        positions[i + 1] = 0;
+    }
+
+    frames[updated - 1] = maskframe;
+    positions[updated - 1] = maskposition;
+
+    *total = updated;
+}
+
+void *thread_animate(void *extra) {
+    kntxt_t *kntxt = (kntxt_t *) extra;
+    frame_t *frames[LAYERS_MAXIMUM] = {NULL};
+    double positions[LAYERS_MAXIMUM] = {0};
+    layer_t layers[LAYERS_MAXIMUM];
+    composite_t inputs[LAYERS_MAXIMUM];
+    int total = 0, version = -1;
+
+    // allocate local copy of pixels
+    pixel_t *localpixels = arena_alloc(sizeof(pixel_t) * LEDSTOTAL);
+
+    // fetch initial frame already loaded by loader
+    pthread_mutex_lock(&kntxt->lock);
+
+    // remove frame from context, keeping it for us
+    frames[0] = kntxt->frame;
+    kntxt->frame = NULL;
+
+    pthread_mutex_unlock(&kntxt->lock);
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while(kntxt->keepgoing) {
+        // checking for changes
+        pthread_rwlock_rdlock(&kntxt->showlock);
+        pthread_mutex_lock(&kntxt->lock);
+
+        if(version != kntxt->show_version) {
+            animate_static_layers(kntxt, frames, &total, positions);
+            version = kntxt->show_version;
+        }
+
+        pthread_rwlock_unlock(&kntxt->showlock);
+
+        int mask = total - 1;
+
+        if(kntxt->frame != NULL) {
+            // cleaning frame not used anymore
+            frame_release(frames[0]);
+
+            // acquiring new frame, start from the begining of that frame
+            frames[0] = kntxt->frame;
+            kntxt->frame = NULL;
+            positions[0] = 0;
+        }
+
+        if(kntxt->maskpending) {
+            // cleaning frame not used anymore
+            frame_release(frames[mask]);
+
+            // acquiring new frame, none when mask was reset
+            frames[mask] = kntxt->maskframe;
+            kntxt->maskframe = NULL;
+            kntxt->maskpending = 0;
+            positions[mask] = 0;
+        }
+
+        memcpy(layers, kntxt->layers, sizeof(layer_t) * total);
+        useconds_t waiting = kntxt->speed;
+
+        pthread_mutex_unlock(&kntxt->lock);
+
+        // compositing current line of each visible layer
+        int count = 0;
+
+        for(int i = 0; i < total; i++) {
+            if(!frames[i] || layers[i].opacity == 0)
+                continue;
+
+            int line = (int) positions[i];
+
+            inputs[count].row = (pixel_t *) frame_row(frames[i], line);
+            inputs[count].blend = layers[i].blend;
+            inputs[count].opacity = layers[i].opacity;
+            count += 1;
+        }
+
+        layers_composite(localpixels, inputs, count, LEDSTOTAL);
+
+        // commit this frame pixel to main context
+        pthread_mutex_lock(&kntxt->lock);
+        memcpy(kntxt->pixels, localpixels, sizeof(pixel_t) * LEDSTOTAL);
+        pthread_mutex_unlock(&kntxt->lock);
+
+        // ticking at the pace of the fastest layer, each layer
+        // moves forward relative to its own speed
+        int fastest = 1;
+        for(int i = 0; i < total; i++)
+            if(frames[i] && layers[i].speed > fastest)
+                fastest = layers[i].speed;
+
+        for(int i = 0; i < total; i++) {
+            if(!frames[i])
+                continue;
+
+            positions[i] += layers[i].speed / (double) fastest;
+            while(positions[i] >= frames[i]->height)
+                positions[i] -= frames[i]->height;
+
+            // streamed templates decode next rows before deadline
+            frame_prefetch(frames[i], (int) positions[i]);
+        }
+
+        // wait relative to speed for the next frame, on absolute
+        // deadlines to keep animation speed exact
+        long interval = (long) waiting * 100 / fastest * 1000;
+
+        next.tv_nsec += interval;
+        while(next.tv_nsec >= 1000000000) {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec += 1;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        // too late (speed changed or stalled), restart from now
+        // instead of catching up with a burst of frames
+        long behind = (now.tv_sec - next.tv_sec) * 1000000000 + (now.tv_nsec - next.tv_nsec);
+        if(behind > interval)
+            next = now;
+
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        // how late we woke up after deadline
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        behind = (now.tv_sec - next.tv_sec) * 1000000000 + (now.tv_nsec - next.tv_nsec);
+        wakeup_record(&kntxt->wakeups[THREAD_ANIMATE], behind);
+    }
+
+    for(int i = 0; i < total; i++)
+        frame_release(frames[i]);
+
+    return NULL;
+}
+
+//
+// frames checksum, crc32c (castagnoli)
+//
+// crc instruction when available, three streams at once to hide its latency
+// and merged by shifting registers through zero bytes from tables
+//
+#define CRC32C_POLY  0x82f63b78 // reflected
+#define CRC32C_BLOCK 960        // bytes per stream, bitmap is 9 blocks
+
+uint32_t crc32c_table[8][256]; // slicing by 8
+uint32_t crc32c_shift[4][256]; // register through CRC32C_BLOCK zero bytes
+uint32_t (*crc32c_update)(uint32_t crc, const uint8_t *data, size_t length);
+char *crc32c_engine = "software";
+
+uint32_t crc32c_software(uint32_t crc, const uint8_t *data, size_t length) {
+    uint32_t (*t)[256] = crc32c_table;
+
+    for(; length >= 8; data += 8, length -= 8) {
+        uint64_t value;
+        memcpy(&value, data, sizeof(value));
+        value ^= crc;
+
+        crc = t[7][value & 0xff] ^ t[6][(value >> 8) & 0xff] ^
+              t[5][(value >> 16) & 0xff] ^ t[4][(value >> 24) & 0xff] ^
+              t[3][(value >> 32) & 0xff] ^ t[2][(value >> 40) & 0xff] ^
+              t[1][(value >> 48) & 0xff] ^ t[0][value >> 56];
+    }
+
+    while(length--)
+        crc = t[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+
+    return crc;
+}
+
+static inline uint32_t crc32c_shifted(uint32_t crc) {
+    return crc32c_shift[0][crc & 0xff] ^ crc32c_shift[1][(crc >> 8) & 0xff] ^
+           crc32c_shift[2][(crc >> 16) & 0xff] ^ crc32c_shift[3][crc >> 24];
+}
+
+#if defined(__x86_64__)
+#define CRC32C_HARDWARE __attribute__ ((target("sse4.2")))
+#define crc32c_u64(crc, value) ((uint32_t) __builtin_ia32_crc32di(crc, value))
+#define crc32c_u8(crc, value) __builtin_ia32_crc32qi(crc, value)
+
+#elif defined(__ARM_FEATURE_CRC32)
+#define CRC32C_HARDWARE
+#define crc32c_u64(crc, value) __crc32cd(crc, value)
+#define crc32c_u8(crc, value) __crc32cb(crc, value)
+#endif
+
+#ifdef CRC32C_HARDWARE
+CRC32C_HARDWARE uint32_t crc32c_hardware(uint32_t crc, const uint8_t *data, size_t length) {
+    uint64_t value;
+
+    for(; length >= CRC32C_BLOCK * 3; data += CRC32C_BLOCK * 3, length -= CRC32C_BLOCK * 3) {
+        uint32_t second = 0, third = 0;
+
+        for(int i = 0; i < CRC32C_BLOCK; i += 8) {
+            memcpy(&value, data + i, sizeof(value));
+            crc = crc32c_u64(crc, value);
+
+            memcpy(&value, data + CRC32C_BLOCK + i, sizeof(value));
+            second = crc32c_u64(second, value);
+
+            memcpy(&value, data + (CRC32C_BLOCK * 2) + i, sizeof(value));
+            third = crc32c_u64(third, value);
+        }
+
+        crc = crc32c_shifted(crc32c_shifted(crc) ^ second) ^ third;
+    }
+
+    for(; length >= 8; data += 8, length -= 8) {
+        memcpy(&value, data, sizeof(value));
+        crc = crc32c_u64(crc, value);
+    }
+
+    while(length--)
+        crc = crc32c_u8(crc, *data++);
+
+    return crc;
+}
+#endif
+
+void crc32c_init() {
+    static const uint8_t zeros[CRC32C_BLOCK] = {0};
+    uint32_t basis[32];
+
+    for(int i = 0; i < 256; i++) {
+        uint32_t crc = i;
+
+        for(int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+
+        crc32c_table[0][i] = crc;
+    }
+
+    for(int k = 1; k < 8; k++)
+        for(int i = 0; i < 256; i++)
+            crc32c_table[k][i] = (crc32c_table[k - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[k - 1][i] & 0xff];
+
+    // shifting is linear, built from each register bit alone
+    for(int bit = 0; bit < 32; bit++)
+        basis[bit] = crc32c_software(1U << bit, zeros, sizeof(zeros));
+
+    for(int k = 0; k < 4; k++) {
+        for(int i = 0; i < 256; i++) {
+            uint32_t crc = 0;
+
+            for(int bit = 0; bit < 8; bit++)
+                if(i & (1 << bit))
+                    crc ^= basis[(k * 8) + bit];
+
+            crc32c_shift[k][i] = crc;
+        }
+    }
+
+    crc32c_update = crc32c_software;
+
+#if defined(__x86_64__)
+    if(__builtin_cpu_supports("sse4.2")) {
+        crc32c_update = crc32c_hardware;
+        crc32c_engine = "sse4.2";
+    }
+#elif defined(CRC32C_HARDWARE)
+    crc32c_update = crc32c_hardware;
+    crc32c_engine = "armv8 crc";
+#endif
+}
+
+uint32_t crc32c(const uint8_t *data, size_t length) {
+    return ~crc32c_update(0xffffffff, data, length);
+}
+
+// flags and checksum of a frame about to be sent
+void frame_checksum(frame_header_t *header, uint8_t *bitmap) {
+    header->flags = frame_checksums ? FRAME_CHECKSUM : 0;
+    header->checksum = frame_checksums ? crc32c(bitmap, BITMAPSIZE) : 0;
+}
+
+void checksum_benchmark() {
+    uint8_t *bitmap = malloc(BITMAPSIZE);
+    int iterations = 100000;
+    uint32_t checksum = 0;
+    struct timeval before, after;
+
+    if(!bitmap)
+        diep("checksum: malloc");
+
+    for(int i = 0; i < BITMAPSIZE; i++)
+        bitmap[i] = rand();
+
+    gettimeofday(&before, NULL);
+
+    for(int i = 0; i < iterations; i++) {
+        bitmap[0] = i;
+        checksum ^= crc32c(bitmap, BITMAPSIZE);
+    }
+
+    gettimeofday(&after, NULL);
+
+    double frame = (timediff(&after, &before) / iterations) * 1000000;
+    int valid = crc32c((uint8_t *) "123456789", 9) == 0xe3069283;
+
+    // engine in use against the table one, whole and unaligned frames
+    valid &= crc32c_update(0xffffffff, bitmap, BITMAPSIZE) == crc32c_software(0xffffffff, bitmap, BITMAPSIZE);
+    valid &= crc32c_update(0xffffffff, bitmap + 1, BITMAPSIZE - 3) == crc32c_software(0xffffffff, bitmap + 1, BITMAPSIZE - 3);
+
+    printf("[+] benchmark: checksum %-9s %5.2f us per frame %s\n",
+        crc32c_engine, frame, valid ? "" : "(invalid)");
+
+    free(bitmap);
+}
+
+//
+// network transmitter management
+//
+int netsend_transmit_frame(frame_header_t *header, uint8_t *bitmap, char *target) {
+    struct sockaddr_in serveraddr;
+    struct hostent *hent;
+    int sockfd;
+
+    char *hostname = target;
+    int portno = 1111;
+
+    if((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        diep("socket");
+
+    if((hent = gethostbyname(hostname)) == NULL) {
+        logger("[-] netsend: cannot resolve target host");
+        return 1;
+    }
+
+    memset(&serveraddr, 0x00, sizeof(serveraddr));
+    serveraddr.sin_family = AF_INET;
+    serveraddr.sin_port = htons(portno);
+
+    memcpy(&serveraddr.sin_addr, hent->h_addr_list[0], hent->h_length);
+
+    int serverlen = sizeof(serveraddr);
+
+    // sending header and bitmap as one datagram, without copy
+    struct iovec parts[2] = {
+        {.iov_base = header, .iov_len = sizeof(frame_header_t)},
+        {.iov_base = bitmap, .iov_len = BITMAPSIZE},
+    };
+
+    struct msghdr packet = {
+        .msg_name = &serveraddr,
+        .msg_namelen = serverlen,
+        .msg_iov = parts,
+        .msg_iovlen = 2,
+    };
+
+    if(sendmsg(sockfd, &packet, 0) < 0)
+        diep("sendmsg");
+
+    close(sockfd);
+
+    return 0;
+}
+
+//
+// strobe engine
+//
+double strobe_rate(uint8_t refresh) {
+    double ratio = refresh / 255.0;
+
+    // finer steps on slow rates
+    return STROBE_RATE_MINIMUM + (STROBE_RATE_MAXIMUM - STROBE_RATE_MINIMUM) * ratio * ratio;
+}
+
+double strobe_duty(uint8_t flash) {
+    return STROBE_DUTY_MINIMUM + (1.0 - 2 * STROBE_DUTY_MINIMUM) * (flash / 255.0);
+}
+
+// stateless, same period and bar always get the same draw
+static uint32_t strobe_hash(uint64_t period, int bar) {
+    uint64_t x = period * 0x9e3779b97f4a7c15ull + bar * 0xbf58476d1ce4e5b9ull;
+
+    x ^= x >> 31;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 29;
+
+    return x;
+}
+
+// per bar on/off, folded in bars gains, cycles is the strobe position
+// in periods since it was enabled: only depends on time, not on frames
+void strobe_gains(const record_control_t *control, double cycles, float *gains) {
+    if(!control->strobe)
+        return;
+
+    double duty = strobe_duty(control->strobe_duty);
+    uint64_t period = cycles;
+
+    for(int bar = 0; bar < SEGMENTS; bar++) {
+        double phase = cycles;
+
+        // each bar late by a fraction of period, running along bars
+        if(control->strobe_mode == STROBE_CHASE && control->strobe_bars) {
+            double offset = bar / (double) control->strobe_bars;
+            phase += 1.0 - (offset - (uint64_t) offset);
+        }
+
+        phase -= (uint64_t) phase;
+
+        int on = (phase < duty);
+
+        // about half the bars, drawn again every period
+        if(control->strobe_mode == STROBE_RANDOM)
+            on = on && (strobe_hash(period, bar) & 0x80000000);
+
+        if(!on)
+            gains[bar] = 0;
+    }
+}
+
+// final output from composited pixels and control state, no shared state
+// involved (live transform and offline baking)
+void pixels_transform(const record_control_t *control, const uint8_t *calibration, const float *gains, pixel_t *monitor, uint8_t *localbitmap) {
+    const uint8_t *colorize = control->strip_rgb;
+    uint8_t rawmaster = control->master;
+
+    // applying settings to frame
+    if(control->blackout)
+        rawmaster = 0;
+
+    if(control->fullon)
+        memset(monitor, 0xffffffff, LEDSTOTAL * sizeof(pixel_t));
+
+    // strip color cut, calibration and master are the same for every bar
+    float channels[3];
+
+    for(int c = 0; c < 3; c++)
+        channels[c] = ((255 - colorize[c]) / 255.0) * (calibration[c] / 255.0) * (rawmaster / 255.0);
+
+    // one pass, bar gain folded in 16 bits fixed point multipliers
+    for(int bar = 0; bar < SEGMENTS; bar++) {
+        uint32_t red = channels[0] * gains[bar] * 65536 + 0.5;
+        uint32_t green = channels[1] * gains[bar] * 65536 + 0.5;
+        uint32_t blue = channels[2] * gains[bar] * 65536 + 0.5;
+
+        for(int i = (bar * PERSEGMENT); i < ((bar + 1) * PERSEGMENT); i++) {
+            monitor[i].r = (monitor[i].r * red) >> 16;
+            monitor[i].g = (monitor[i].g * green) >> 16;
+            monitor[i].b = (monitor[i].b * blue) >> 16;
+
+            // network frame bitmap
+            localbitmap[(i * 3) + 0] = monitor[i].r;
+            localbitmap[(i * 3) + 1] = monitor[i].g;
+            localbitmap[(i * 3) + 2] = monitor[i].b;
+        }
+    }
+}
+
+//
+// bumps
+//
+double envelope_level(envelope_t *envelope, uint8_t target, double attack, double decay, uint64_t now) {
+    if(target != envelope->target) {
+        envelope->from = envelope->level;
+        envelope->start = now;
+        envelope->target = target;
+    }
+
+    double duration = target ? attack : decay;
+    double elapsed = (now - envelope->start) / 1e6;
+
+    envelope->level = target;
+
+    if(duration > 0 && elapsed < duration)
+        envelope->level = envelope->from + (target - envelope->from) * elapsed / duration;
+
+    return envelope->level;
+}
+
+// blending output with a constant frame, black when frame is NULL
+// bars masked out (strobe off) are bumped to black, like without frame
+void bump_mix(uint8_t *bitmap, const uint8_t *frame, const float *mask, double level) {
+    uint32_t weight = level * 256 + 0.5;
+
+    if(weight == 0)
+        return;
+
+    for(int bar = 0; bar < SEGMENTS; bar++) {
+        uint8_t *target = bitmap + (bar * PERSEGMENT * 3);
+        const uint8_t *source = NULL;
+
+        if(frame && (!mask || mask[bar] > 0))
+            source = frame + (bar * PERSEGMENT * 3);
+
+        // fully bumped, constant frame sent as is
+        if(weight >= 256) {
+            if(source) {
+                memcpy(target, source, PERSEGMENT * 3);
+
+            } else {
+                memset(target, 0x00, PERSEGMENT * 3);
+            }
+
+            continue;
+        }
+
+        for(int i = 0; i < PERSEGMENT * 3; i++)
+            target[i] = (target[i] * (256 - weight) + (source ? source[i] : 0) * weight) >> 8;
+    }
+}
+
+void netsend_pixels_transform(kntxt_t *kntxt, strobe_t *phase, bumps_t *bumps, pixel_t *monitor, pixel_t *preview, uint8_t *localbitmap, record_control_t *record) {
+    uint8_t calibration[3];
+    float gains[SEGMENTS];
+    uint64_t version;
+    uint32_t flashes;
+    double attack, decay;
+
+    // current settings, without lock
+    control_t *control = control_enter(&kntxt->controls, THREAD_NETSEND);
+
+    record->master = control->master;
+    record->blackout = control->blackout;
+    record->fullon = control->fullon;
+    record->strobe = control->strobe;
+    record->strobe_duty = control->strobe_duty;
+    record->strobe_mode = control->strobe_mode;
+    record->strobe_bars = control->strobe_bars;
+    memcpy(record->strip_rgb, control->strip_rgb, sizeof(record->strip_rgb));
+    memcpy(record->sliders, control->sliders, sizeof(record->sliders));
+
+    memcpy(calibration, control->calibration, sizeof(calibration));
+    memcpy(gains, control->gains, sizeof(gains));
+
+    version = control->version;
+    flashes = control->flashes;
+    attack = control->attack;
+    decay = control->decay;
+
+    control_leave(&kntxt->controls, THREAD_NETSEND);
+
+    // blackout and full on are bumps here, record keeps published state
+    record_control_t live = *record;
+    live.blackout = 0;
+    live.fullon = 0;
+
+    // full on output only changes with settings, ready before any press
+    if(bumps->version != version) {
+        memset(bumps->white, 0xff, sizeof(pixel_t) * LEDSTOTAL);
+        pixels_transform(&live, calibration, gains, bumps->white, bumps->frame);
+        bumps->version = version;
+    }
+
+    // strobe position belongs to render, restarting (on) when strobe is
+    // enabled, integrated from clock so rate changes keep it continuous
+    uint64_t now = monotonic_ns();
+
+    if(!record->strobe)
+        phase->cycles = 0;
+
+    if(record->strobe && phase->last)
+        phase->cycles += (now - phase->last) / 1e9 * strobe_rate(record->strobe);
+
+    phase->last = now;
+
+    // strobe applies to bumps as well, like full on used to be
+    float strobed[SEGMENTS];
+
+    for(int bar = 0; bar < SEGMENTS; bar++)
+        strobed[bar] = 1;
+
+    strobe_gains(record, phase->cycles, strobed);
+
+    for(int bar = 0; bar < SEGMENTS; bar++)
+        gains[bar] *= strobed[bar];
+
+    // copy current state to preview, which is monitor without master applied
+    memcpy(preview, monitor, sizeof(pixel_t) * LEDSTOTAL);
+
+    pixels_transform(&live, calibration, gains, monitor, localbitmap);
+
+    // flash restarts its decay on each press, once the pressed frame
+    // went out at full level (even without decay)
+    if(flashes != bumps->flashes) {
+        bumps->flashes = flashes;
+        bumps->flashing = 1;
+        bumps->flash = (envelope_t) {.level = 1, .from = 1, .start = now, .target = 1};
+    }
+
+    double fullon = envelope_level(&bumps->fullon, record->fullon, attack, decay, now);
+    double flash = envelope_level(&bumps->flash, bumps->flashing, attack, decay, now);
+    bumps->flashing = 0;
+    double blackout = envelope_level(&bumps->blackout, record->blackout, attack, decay, now);
+
+    if(flash > fullon)
+        fullon = flash;
+
+    // blackout wins over full on, like before
+    bump_mix(localbitmap, bumps->frame, strobed, fullon);
+    bump_mix(localbitmap, NULL, NULL, blackout);
+
+    if(fullon == 0 && blackout == 0)
+        return;
+
+    for(int i = 0; i < LEDSTOTAL; i++) {
+        monitor[i].r = localbitmap[(i * 3) + 0];
+        monitor[i].g = localbitmap[(i * 3) + 1];
+        monitor[i].b = localbitmap[(i * 3) + 2];
+    }
+}
+
+//
+// output recorder
+//
+recorder_t *recorder_open(char *path) {
+    recorder_t *recorder;
+
+    if(!(recorder = calloc(sizeof(recorder_t), 1)))
+        diep("recorder: calloc");
+
+    if(!(recorder->fp = fopen(path, "w"))) {
+        perror(path);
+        free(recorder);
+        return NULL;
+    }
+
+    recorder->path = path;
+    recorder->deflatesize = compressBound(sizeof(record_frame_t) * RECORD_FRAMES);
+
+    if(!(recorder->queue = malloc(sizeof(record_frame_t) * RECORD_QUEUE)))
+        diep("recorder: queue malloc");
+
+    if(!(recorder->chunk = malloc(sizeof(record_frame_t) * RECORD_FRAMES)))
+        diep("recorder: chunk malloc");
+
+    if(!(recorder->deflated = malloc(recorder->deflatesize)))
+        diep("recorder: deflate malloc");
+
+    record_header_t header = {
+        .magic = RECORD_MAGIC,
+        .version = RECORD_VERSION,
+        .leds = LEDSTOTAL,
+        .length = sizeof(record_frame_t),
+        .created = time(NULL),
+    };
+
+    if(fwrite(&header, sizeof(header), 1, recorder->fp) != 1) {
+        perror(path);
+        fclose(recorder->fp);
+        free(recorder->queue);
+        free(recorder->chunk);
+        free(recorder->deflated);
+        free(recorder);
+        return NULL;
+    }
+
+    recorder->written = sizeof(header);
+    recorder->start = monotonic_ns();
+
+    return recorder;
+}
+
+void recorder_free(recorder_t *recorder) {
+    free(recorder->queue);
+    free(recorder->chunk);
+    free(recorder->deflated);
+    free(recorder);
+}
+
+// called by netsend, copying frame to the queue without ever waiting
+void recorder_push(recorder_t *recorder, frame_header_t *header, record_control_t *control, uint8_t *bitmap) {
+    unsigned int head = atomic_load_explicit(&recorder->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&recorder->tail, memory_order_acquire);
+
+    if(head - tail >= RECORD_QUEUE) {
+        atomic_fetch_add(&recorder->dropped, 1);
+        return;
+    }
+
+    record_frame_t *frame = &recorder->queue[head % RECORD_QUEUE];
+
+    frame->timestamp = (monotonic_ns() - recorder->start) / 1000;
+    frame->sequence = header->sequence;
+    frame->control = *control;
+    memcpy(frame->bitmap, bitmap, BITMAPSIZE);
+
+    atomic_store_explicit(&recorder->head, head + 1, memory_order_release);
+}
+
+int recorder_flush(recorder_t *recorder) {
+    if(recorder->chunked == 0 || recorder->failed)
+        return 0;
+
+    uLong rawsize = sizeof(record_frame_t) * recorder->chunked;
+    uLongf compressed = recorder->deflatesize;
+    Bytef *raw = (Bytef *) recorder->chunk;
+
+    recorder->chunked = 0;
+
+    // fastest level, deltas are mostly zeroes anyway
+    if(compress2(recorder->deflated, &compressed, raw, rawsize, Z_BEST_SPEED) != Z_OK) {
+        logger("[-] recorder: chunk compression failed, recording stopped");
+        recorder->failed = 1;
+        return 1;
+    }
+
+    record_chunk_t chunk = {
+        .magic = RECORD_CHUNK,
+        .frames = rawsize / sizeof(record_frame_t),
+        .compressed = compressed,
+        .checksum = crc32(0, raw, rawsize),
+    };
+
+    if(fwrite(&chunk, sizeof(chunk), 1, recorder->fp) != 1 || fwrite(recorder->deflated, compressed, 1, recorder->fp) != 1) {
+        logger("[-] recorder: %s: %s, recording stopped", recorder->path, strerror(errno));
+        recorder->failed = 1;
+        return 1;
+    }
+
+    // chunk complete on disk, a crash never leaves it half written
+    if(fflush(recorder->fp)) {
+        logger("[-] recorder: %s: %s, recording stopped", recorder->path, strerror(errno));
+        recorder->failed = 1;
+        return 1;
+    }
+
+    recorder->written += sizeof(chunk) + compressed;
+
+    return 0;
+}
+
+void recorder_pack(recorder_t *recorder, record_frame_t *frame) {
+    record_frame_t *target = &recorder->chunk[recorder->chunked];
+
+    memcpy(target, frame, sizeof(record_frame_t));
+
+    // delta against previous frame of the chunk
+    if(recorder->chunked > 0) {
+        for(int i = 0; i < BITMAPSIZE; i++)
+            target->bitmap[i] ^= recorder->previous[i];
+    }
+
+    memcpy(recorder->previous, frame->bitmap, BITMAPSIZE);
+
+    recorder->chunked += 1;
+    recorder->frames += 1;
+}
+
+void *thread_recorder(void *extra) {
+    kntxt_t *kntxt = (kntxt_t *) extra;
+    recorder_t *recorder = kntxt->recorder;
+
+    logger("[+] recorder: capturing output to %s", recorder->path);
+
+    while(1) {
+        // checked before draining, last frames queued are kept
+        int running = kntxt->keepgoing;
+
+        unsigned int tail = atomic_load_explicit(&recorder->tail, memory_order_relaxed);
+        unsigned int head = atomic_load_explicit(&recorder->head, memory_order_acquire);
+
+        for(; tail != head; tail++) {
+            if(!recorder->failed)
+                recorder_pack(recorder, &recorder->queue[tail % RECORD_QUEUE]);
+
+            atomic_store_explicit(&recorder->tail, tail + 1, memory_order_release);
+
+            if(recorder->chunked == RECORD_FRAMES)
+                recorder_flush(recorder);
+        }
+
+        if(!running)
+            break;
+
+        thread_wait(50000);
+    }
+
+    recorder_flush(recorder);
+    fclose(recorder->fp);
+
+    return NULL;
+}
+
+//
+// metrics history and export
+//
+static int metrics_header_valid(metrics_header_t *header) {
+    if(header->magic != METRICS_MAGIC || header->version != METRICS_VERSION)
+        return 0;
+
+    return header->length == sizeof(metrics_sample_t);
+}
+
+// history of another layout moved aside, suffixed with current time
+static int metrics_rotate(char *path) {
+    metrics_header_t header = {0};
+    char rotated[1024];
+    FILE *fp;
+
+    if(!(fp = fopen(path, "r")))
+        return 0;
+
+    size_t length = fread(&header, 1, sizeof(header), fp);
+    fclose(fp);
+
+    if(length == 0 || (length == sizeof(header) && metrics_header_valid(&header)))
+        return 0;
+
+    if(snprintf(rotated, sizeof(rotated), "%s.%lu", path, (unsigned long) time(NULL)) >= (int) sizeof(rotated)) {
+        fprintf(stderr, "[-] metrics: %s: path too long to rotate history\n", path);
+        return -1;
+    }
+
+    if(rename(path, rotated) < 0) {
+        perror(rotated);
+        return -1;
+    }
+
+    printf("[+] metrics: %s: other history layout, moved to %s\n", path, rotated);
+
+    return 0;
+}
+
+metrics_t *metrics_new(char *path, int port) {
+    metrics_t *metrics;
+
+    if(!(metrics = calloc(sizeof(metrics_t), 1)))
+        diep("metrics: calloc");
+
+    metrics->path = path;
+    metrics->port = port;
+    metrics->listener = -1;
+    metrics->deflatesize = compressBound(sizeof(metrics_sample_t) * METRICS_FLUSH);
+
+    if(!(metrics->deflated = malloc(metrics->deflatesize)))
+        diep("metrics: malloc");
+
+    if(!path)
+        return metrics;
+
+    // appending to previous sessions of same layout, header only once
+    if(metrics_rotate(path) < 0) {
+        free(metrics->deflated);
+        free(metrics);
+        return NULL;
+    }
+
+    if(!(metrics->fp = fopen(path, "a"))) {
+        perror(path);
+        free(metrics->deflated);
+        free(metrics);
+        return NULL;
+    }
+
+    if(ftell(metrics->fp) == 0) {
+        metrics_header_t header = {
+            .magic = METRICS_MAGIC,
+            .version = METRICS_VERSION,
+            .length = sizeof(metrics_sample_t),
+            .created = time(NULL),
+        };
+
+        if(fwrite(&header, sizeof(header), 1, metrics->fp) != 1)
+            perror(path);
+    }
+
+    return metrics;
+}
+
+void metrics_free(metrics_t *metrics) {
+    free(metrics->deflated);
+    free(metrics);
+}
+
+void metrics_sample(kntxt_t *kntxt, metrics_sample_t *sample) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    memset(sample, 0x00, sizeof(metrics_sample_t));
+    sample->time = now.tv_sec * 1000ULL + now.tv_usec / 1000;
+
+    pthread_mutex_lock(&kntxt->lock);
+
+    control_stats_t *client = &kntxt->client;
+    controller_stats_t *controller = &kntxt->controller;
+
+    sample->fps = controller->fps;
+    sample->frames = client->frames;
+    sample->dropped = client->dropped;
+    sample->droprate = client->droprate;
+    sample->lossrate = client->windows[0].lossrate;
+    sample->rate = client->rate;
+    sample->rtt = client->windows[1].rtt_average;
+    sample->transform = client->time_transform * 1000000;
+    sample->show = controller->show_last;
+    sample->busy = controller->busy;
+    sample->mains = controller->main_ac_voltage;
+
+    memcpy(sample->volts, controller->psu_volts, sizeof(sample->volts));
+    memcpy(sample->amps, controller->psu_amps, sizeof(sample->amps));
+
+    sample->temperatures[0] = controller->main_core_temperature;
+    sample->temperatures[1] = controller->mon_core_temperature;
+    sample->temperatures[2] = controller->ext_power_temperature;
+    sample->temperatures[3] = controller->ext_compute_temperature;
+
+    pthread_mutex_unlock(&kntxt->lock);
+
+    sample->late = kntxt->wakeups[THREAD_NETSEND].last / 1000;
+}
+
+// samples not written yet are contiguous in ring, ending at last one
+void metrics_flush(metrics_t *metrics) {
+    if(!metrics->fp || metrics->pending == 0)
+        return;
+
+    metrics_sample_t samples[METRICS_FLUSH];
+
+    for(int i = 0; i < metrics->pending; i++) {
+        uint64_t index = metrics->total - metrics->pending + i;
+        samples[i] = metrics->ring[index % METRICS_RING];
+    }
+
+    uLong rawsize = sizeof(metrics_sample_t) * metrics->pending;
+    uLongf compressed = metrics->deflatesize;
+
+    metrics->pending = 0;
+
+    if(compress2(metrics->deflated, &compressed, (Bytef *) samples, rawsize, Z_BEST_COMPRESSION) != Z_OK) {
+        logger("[-] metrics: history compression failed");
+        return;
+    }
+
+    record_chunk_t chunk = {
+        .magic = METRICS_CHUNK,
+        .frames = rawsize / sizeof(metrics_sample_t),
+        .compressed = compressed,
+        .checksum = crc32(0, (Bytef *) samples, rawsize),
+    };
+
+    if(fwrite(&chunk, sizeof(chunk), 1, metrics->fp) != 1 || fwrite(metrics->deflated, compressed, 1, metrics->fp) != 1 || fflush(metrics->fp)) {
+        logger("[-] metrics: %s: %s, history stopped", metrics->path, strerror(errno));
+        fclose(metrics->fp);
+        metrics->fp = NULL;
+    }
+}
+
+int metrics_listen(int port) {
+    struct sockaddr_in name;
+    int sock, yes = 1;
+
+    if((sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0)
+        return -1;
+
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    memset(&name, 0x00, sizeof(name));
+    name.sin_family = AF_INET;
+    name.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    name.sin_port = htons(port);
+
+    if(bind(sock, (struct sockaddr *) &name, sizeof(name)) < 0 || listen(sock, 4) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+// prometheus text exposition format, from last sample
+size_t metrics_text(metrics_t *metrics, char *buffer, size_t size) {
+    metrics_sample_t *s = &metrics->ring[(metrics->total - 1) % METRICS_RING];
+    static const char *sensors[] = {"main_core", "monitoring_core", "power", "compute"};
+    size_t length = 0;
+
+    // stops appending once truncated, length never goes past size
+    #define METRIC(...) do { \
+        if(length < size) \
+            length += snprintf(buffer + length, size - length, __VA_ARGS__); \
+    } while(0)
+
+    METRIC("# TYPE stageled_controller_fps gauge\nstageled_controller_fps %u\n", s->fps);
+    METRIC("# TYPE stageled_frames_total counter\nstageled_frames_total %u\n", s->frames);
+    METRIC("# TYPE stageled_frames_dropped_total counter\nstageled_frames_dropped_total %u\n", s->dropped);
+    METRIC("# TYPE stageled_drop_ratio gauge\nstageled_drop_ratio %.4f\n", s->droprate / 100);
+    METRIC("# TYPE stageled_loss_ratio gauge\nstageled_loss_ratio %.4f\n", s->lossrate / 100);
+    METRIC("# TYPE stageled_send_rate_fps gauge\nstageled_send_rate_fps %.1f\n", s->rate);
+    METRIC("# TYPE stageled_rtt_seconds gauge\nstageled_rtt_seconds %.6f\n", s->rtt / 1e6);
+    METRIC("# TYPE stageled_transform_seconds gauge\nstageled_transform_seconds %.6f\n", s->transform / 1e6);
+    METRIC("# TYPE stageled_netsend_late_seconds gauge\nstageled_netsend_late_seconds %.6f\n", s->late / 1e6);
+    METRIC("# TYPE stageled_show_seconds gauge\nstageled_show_seconds %.6f\n", s->show / 1e6);
+    METRIC("# TYPE stageled_show_busy_total counter\nstageled_show_busy_total %u\n", s->busy);
+    METRIC("# TYPE stageled_mains_volts gauge\nstageled_mains_volts %.2f\n", s->mains / 100.0);
+
+    METRIC("# TYPE stageled_psu_volts gauge\n");
+    for(int i = 0; i < FEEDBACK_PSUS; i++)
+        METRIC("stageled_psu_volts{psu=\"%d\"} %.2f\n", i + 1, s->volts[i] / 100.0);
+
+    METRIC("# TYPE stageled_psu_amps gauge\n");
+    for(int i = 0; i < FEEDBACK_PSUS; i++)
+        METRIC("stageled_psu_amps{psu=\"%d\"} %.2f\n", i + 1, s->amps[i] / 100.0);
+
+    METRIC("# TYPE stageled_temperature_celsius gauge\n");
+    for(int i = 0; i < 4; i++)
+        METRIC("stageled_temperature_celsius{sensor=\"%s\"} %.2f\n", sensors[i], s->temperatures[i] / 100.0);
+
+    #undef METRIC
+
+    return (length < size) ? length : size - 1;
+}
+
+// one short request at a time, answered whatever the path
+void metrics_serve(metrics_t *metrics) {
+    char request[1024], body[4096], header[128];
+    int client;
+
+    if((client = accept(metrics->listener, NULL, NULL)) < 0)
+        return;
+
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = 200000};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    if(recv(client, request, sizeof(request), 0) <= 0) {
+        close(client);
+        return;
+    }
+
+    size_t length = metrics->total ? metrics_text(metrics, body, sizeof(body)) : 0;
+    int hlength = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", length);
+
+    if(send(client, header, hlength, MSG_NOSIGNAL) == hlength)
+        send(client, body, length, MSG_NOSIGNAL);
+
+    close(client);
+}
+
+void *thread_metrics(void *extra) {
+    kntxt_t *kntxt = (kntxt_t *) extra;
+    metrics_t *metrics = kntxt->metrics;
+
+    if(metrics->port) {
+        if((metrics->listener = metrics_listen(metrics->port)) < 0) {
+            logger("[-] metrics: cannot listen on localhost:%d: %s", metrics->port, strerror(errno));
+
+        } else {
+            logger("[+] metrics: exporting on http://localhost:%d/metrics", metrics->port);
+        }
+    }
+
+    if(metrics->fp)
+        logger("[+] metrics: history written to %s", metrics->path);
+
+    uint64_t next = monotonic_ns() / 1000;
+
+    while(kntxt->keepgoing) {
+        uint64_t now = monotonic_ns() / 1000;
+
+        if(now >= next) {
+            metrics_sample(kntxt, &metrics->ring[metrics->total % METRICS_RING]);
+            metrics->total += 1;
+            metrics->pending += 1;
+
+            if(metrics->pending == METRICS_FLUSH)
+                metrics_flush(metrics);
+
+            next += METRICS_INTERVAL;
+            continue;
+        }
+
+        // waiting for next sample, or for a scraper
+        struct pollfd pfd = {.fd = metrics->listener, .events = POLLIN};
+        int timeout = (next - now) / 1000 + 1;
+
+        if(metrics->listener < 0) {
+            thread_wait((next - now) < 100000 ? (next - now) : 100000);
+            continue;
+        }
+
+        if(timeout > 100)
+            timeout = 100; // keepgoing checked often enough
+
+        if(poll(&pfd, 1, timeout) > 0)
+            metrics_serve(metrics);
+    }
+
+    metrics_flush(metrics);
+
+    if(metrics->fp)
+        fclose(metrics->fp);
+
+    if(metrics->listener >= 0)
+        close(metrics->listener);
+
+    return NULL;
+}
+
+// history as text, one line per sample, tab separated
+int metrics_dump(char *path) {
+    metrics_header_t header;
+    record_chunk_t chunk;
+    FILE *fp;
+
+    if(!(fp = fopen(path, "r"))) {
+        perror(path);
+        return 1;
+    }
+
+    if(fread(&header, sizeof(header), 1, fp) != 1 || !metrics_header_valid(&header)) {
+        fprintf(stderr, "[-] metrics: %s: not a metrics history (version %d expected)\n", path, METRICS_VERSION);
+        fclose(fp);
+        return 1;
+    }
+
+    uLong deflatesize = compressBound(sizeof(metrics_sample_t) * METRICS_FLUSH);
+    metrics_sample_t *samples = malloc(sizeof(metrics_sample_t) * METRICS_FLUSH);
+    uint8_t *deflated = malloc(deflatesize);
+
+    if(!samples || !deflated)
+        diep("metrics: malloc");
+
+    printf("# time\tfps\tframes\tdropped\tdroprate\tlossrate\trate\trtt\ttransform\tlate\tshow\tbusy");
+    for(int i = 0; i < FEEDBACK_PSUS; i++)
+        printf("\tpsu%d_volts\tpsu%d_amps", i + 1, i + 1);
+    printf("\tmains\ttemp_main\ttemp_monitor\ttemp_power\ttemp_compute\n");
+
+    int corrupted = 0;
+
+    while(fread(&chunk, sizeof(chunk), 1, fp) == 1) {
+        uLongf rawsize = sizeof(metrics_sample_t) * chunk.frames;
+
+        if(chunk.magic != METRICS_CHUNK || chunk.frames == 0 || chunk.frames > METRICS_FLUSH || chunk.compressed > deflatesize) {
+            corrupted = 1;
+            break;
+        }
+
+        if(fread(deflated, chunk.compressed, 1, fp) != 1) {
+            corrupted = 1;
+            break;
+        }
+
+        if(uncompress((Bytef *) samples, &rawsize, deflated, chunk.compressed) != Z_OK) {
+            corrupted = 1;
+            break;
+        }
+
+        if(rawsize != sizeof(metrics_sample_t) * chunk.frames || crc32(0, (Bytef *) samples, rawsize) != chunk.checksum) {
+            corrupted = 1;
+            break;
+        }
+
+        for(uint32_t i = 0; i < chunk.frames; i++) {
+            metrics_sample_t *s = &samples[i];
+
+            printf("%lu\t%u\t%u\t%u\t%.2f\t%.2f\t%.1f\t%u\t%u\t%u\t%u\t%u", (unsigned long) s->time,
+                s->fps, s->frames, s->dropped, s->droprate, s->lossrate, s->rate, s->rtt, s->transform, s->late, s->show, s->busy);
+
+            for(int p = 0; p < FEEDBACK_PSUS; p++)
+                printf("\t%.2f\t%.2f", s->volts[p] / 100.0, s->amps[p] / 100.0);
+
+            printf("\t%.2f", s->mains / 100.0);
+
+            for(int t = 0; t < 4; t++)
+                printf("\t%.2f", s->temperatures[t] / 100.0);
+
+            printf("\n");
+        }
+    }
+
+    // last chunk may be cut by a crash, samples before it are fine
+    if(corrupted)
+        fprintf(stderr, "[-] metrics: %s: corrupted chunk, stopped there\n", path);
+
+    free(deflated);
+    free(samples);
+    fclose(fp);
+
+    return corrupted;
+}
+
+//
+// offline rendering
+//
+// frames rendered from an immutable state and a time, without main
+// context, on a pool of workers stealing ranges of frames from each other
+//
+renderer_t *renderer_new(show_t *show) {
+    renderer_t *renderer;
+
+    if(!(renderer = calloc(sizeof(renderer_t), 1)))
+        diep("renderer: calloc");
+
+    if(posix_memalign((void **) &renderer->pixels, ARENA_ALIGN, sizeof(pixel_t) * LEDSTOTAL))
+        diep("renderer: posix_memalign");
+
+    renderer->show = show;
+
+    for(int bar = 0; bar < SEGMENTS; bar++)
+        renderer->bargroups[bar] = pixelmap_groups(show->map, bar);
+
+    return renderer;
+}
+
+void renderer_free(renderer_t *renderer) {
+    for(int i = 0; i < SHOW_SLOTS; i++) {
+        frame_release(renderer->presets[i]);
+        frame_release(renderer->masks[i]);
+    }
+
+    for(int i = 0; i < LAYERS_EXTRA; i++)
+        frame_release(renderer->statics[i]);
+
+    free(renderer->pixels);
+    free(renderer);
+}
+
+static frame_t *renderer_source(frame_t **shared, frame_t *source) {
+    // each renderer streams its own copy of long templates
+    if(!source)
+        return NULL;
+
+    if(!*shared)
+        *shared = frame_share(source);
+
+    return *shared;
+}
+
+void render_frame(renderer_t *renderer, const render_state_t *state, double time, uint8_t *bitmap) {
+    show_t *show = renderer->show;
+    composite_t inputs[LAYERS_MAXIMUM];
+    int layers = show->layers_total + 2;
+    double elapsed = (time > state->time) ? time - state->time : 0;
+    int count = 0;
+
+    for(int i = 0; i < layers; i++) {
+        frame_t *source;
+        layer_t layer;
+
+        if(i == 0) {
+            source = (state->preset >= 0) ? renderer_source(&renderer->presets[state->preset], show->presets[state->preset].frame) : NULL;
+            layer = (layer_t) {.blend = BLEND_ADD, .opacity = state->opacity[0], .speed = 100};
+
+        } else if(i == layers - 1) {
+            source = (state->mask >= 0) ? renderer_source(&renderer->masks[state->mask], show->masks[state->mask].frame) : NULL;
+            layer = (layer_t) {.blend = BLEND_MASK, .opacity = state->opacity[1], .speed = 100};
+
+        } else {
+            source = renderer_source(&renderer->statics[i - 1], show->layers[i - 1].source.frame);
+            layer = show->layers[i - 1].layer;
+        }
+
+        if(!source || layer.opacity == 0)
+            continue;
+
+        double position = state->positions[i] + elapsed * state->speed * (layer.speed / 100.0);
+
+        inputs[count].row = (pixel_t *) frame_row(source, (uint64_t) position % source->height);
+        inputs[count].blend = layer.blend;
+        inputs[count].opacity = layer.opacity;
+        count += 1;
+    }
+
+    float gains[SEGMENTS];
+    groups_gains(renderer->bargroups, state->control.sliders, gains);
+
+    // constant rate since state time
+    double cycles = state->strobe;
+    if(state->control.strobe)
+        cycles += elapsed * strobe_rate(state->control.strobe);
+
+    strobe_gains(&state->control, cycles, gains);
+
+    layers_composite(renderer->pixels, inputs, count, LEDSTOTAL);
+    pixels_transform(&state->control, show->calibration, gains, renderer->pixels, bitmap);
+}
+
+int pool_cores() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(cores < 1)
+        return 1;
+
+    return (cores > POOL_WORKERS) ? POOL_WORKERS : cores;
+}
+
+pool_t *pool_new(int size) {
+    pool_t *pool;
+
+    if(!(pool = calloc(sizeof(pool_t), 1)))
+        diep("pool: calloc");
+
+    pool->size = size;
+
+    for(int i = 0; i < size; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        pthread_mutex_init(&pool->workers[i].lock, NULL);
+    }
+
+    return pool;
+}
+
+void pool_free(pool_t *pool) {
+    for(int i = 0; i < pool->size; i++)
+        pthread_mutex_destroy(&pool->workers[i].lock);
+
+    free(pool);
+}
+
+static int pool_take(poolworker_t *worker, int *first, int *last) {
+    int taken = 0;
+
+    pthread_mutex_lock(&worker->lock);
+
+    if(worker->start < worker->end) {
+        *first = worker->start;
+        *last = (worker->start + POOL_BATCH < worker->end) ? worker->start + POOL_BATCH : worker->end;
+        worker->start = *last;
+        taken = 1;
+    }
+
+    pthread_mutex_unlock(&worker->lock);
+
+    return taken;
+}
+
+static int pool_steal(pool_t *pool, poolworker_t *thief) {
+    // next workers first, upper half of what they did not take yet
+    for(int i = 1; i < pool->size; i++) {
+        poolworker_t *victim = &pool->workers[(thief->id + i) % pool->size];
+        int first = 0, last = 0;
+
+        pthread_mutex_lock(&victim->lock);
+
+        if(victim->start < victim->end) {
+            first = victim->start + (victim->end - victim->start) / 2;
+            last = victim->end;
+            victim->end = first;
+        }
+
+        pthread_mutex_unlock(&victim->lock);
+
+        if(first == last)
+            continue;
+
+        pthread_mutex_lock(&thief->lock);
+        thief->start = first;
+        thief->end = last;
+        pthread_mutex_unlock(&thief->lock);
+
+        thief->steals += 1;
+        return 1;
+    }
+
+    return 0;
+}
+
+void *pool_worker(void *extra) {
+    poolworker_t *worker = (poolworker_t *) extra;
+    pool_t *pool = worker->pool;
+    int first, last;
+
+    while(pool_take(worker, &first, &last) || (pool_steal(pool, worker) && pool_take(worker, &first, &last))) {
+        for(int i = first; i < last; i++)
+            pool->task(pool->context, worker->id, i);
+
+        worker->done += last - first;
+    }
+
+    return NULL;
+}
+
+// running tasks 0 to total - 1, each worker starts with its own range
+void pool_run(pool_t *pool, int total, pool_task_t task, void *context) {
+    pool->task = task;
+    pool->context = context;
+
+    for(int i = 0; i < pool->size; i++) {
+        poolworker_t *worker = &pool->workers[i];
+
+        worker->start = (int64_t) total * i / pool->size;
+        worker->end = (int64_t) total * (i + 1) / pool->size;
+        worker->done = 0;
+        worker->steals = 0;
+
+        if(pthread_create(&worker->thread, NULL, pool_worker, worker))
+            diep("pool: pthread_create");
+    }
+
+    for(int i = 0; i < pool->size; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+}
+
+typedef struct renderbench_t {
+    renderer_t *renderers[POOL_WORKERS];
+    render_state_t *state;
+    uint8_t *output; // one bitmap per worker
+
+} renderbench_t;
+
+void render_benchmark_task(void *context, int worker, int index) {
+    renderbench_t *bench = (renderbench_t *) context;
+    double time = index / (double) TARGET_FPS;
+
+    render_frame(bench->renderers[worker], bench->state, time, bench->output + ((size_t) worker * BITMAPSIZE));
+}
+
+void render_benchmark() {
+    int frames = 4000, rows = 256;
+    int cores = pool_cores();
+    show_t *show;
+
+    // synthetic show: preset, two static layers and mask
+    if(!(show = calloc(sizeof(show_t), 1)))
+        diep("calloc");
+
+    show->map = pixelmap_default();
+    pixelmap_build(show->map);
+    memset(show->calibration, 255, sizeof(show->calibration));
+
+    frame_t **sources[] = {
+        &show->presets[0].frame,
+        &show->layers[0].source.frame,
+        &show->layers[1].source.frame,
+        &show->masks[0].frame,
+    };
+
+    for(int i = 0; i < 4; i++) {
+        frame_t *frame = frame_alloc(LEDSTOTAL, rows, 0);
+
+        for(size_t p = 0; p < frame->length; p++)
+            frame->pixels[p] = (uint32_t) rand();
+
+        *sources[i] = frame;
+    }
+
+    show->layers_total = 2;
+    show->layers[0].layer = (layer_t) {.blend = BLEND_SCREEN, .opacity = 128, .speed = 50};
+    show->layers[1].layer = (layer_t) {.blend = BLEND_ALPHA, .opacity = 200, .speed = 200};
+
+    render_state_t state = {
+        .speed = TARGET_FPS,
+        .preset = 0,
+        .mask = 0,
+        .opacity = {255, 255},
+        .control = {.master = 200, .sliders = {255, 128, 255}},
+    };
+
+    renderbench_t bench = {.state = &state};
+
+    if(!(bench.output = malloc((size_t) BITMAPSIZE * POOL_WORKERS)))
+        diep("malloc");
+
+    printf("[+] benchmark: rendering %d frames, %d layers, up to %d workers\n", frames, show->layers_total + 2, cores);
+
+    double single = 0;
+
+    // doubling workers up to every core
+    for(int workers = 1; ; workers *= 2) {
+        if(workers > cores)
+            workers = cores;
+
+        pool_t *pool = pool_new(workers);
+        uint64_t steals = 0;
+
+        for(int i = 0; i < workers; i++)
+            bench.renderers[i] = renderer_new(show);
+
+        uint64_t before = monotonic_ns();
+        pool_run(pool, frames, render_benchmark_task, &bench);
+        double elapsed = (monotonic_ns() - before) / 1000000000.0;
+
+        for(int i = 0; i < workers; i++) {
+            steals += pool->workers[i].steals;
+            renderer_free(bench.renderers[i]);
+        }
+
+        double rate = frames / elapsed;
+        if(workers == 1)
+            single = rate;
+
+        printf("[+] benchmark: render %2d workers %9.1f frames/s (%.2fx, %lu steals)\n",
+            workers, rate, rate / single, steals);
+
+        pool_free(pool);
+
+        if(workers == cores)
+            break;
+    }
+
+    free(bench.output);
+    show_free(show);
+}
+
+//
+// baked shows
+//
+// a cue list is rendered offline to wire format frames, then played
+// back from a mapped file without compositing nor transform
+//
+void *cuerr(char *path, int line, char *str) {
+    fprintf(stderr, "cues: %s: line %d: %s\n", path, line, str);
+    return NULL;
+}
+
+cuelist_t *cuelist_loadfile(char *path) {
+    cuelist_t *cuelist;
+    char buffer[512];
+    char *error = NULL;
+    FILE *fp;
+    int line = 0;
+
+    if(!(fp = fopen(path, "r")))
+        dieptr(path);
+
+    if(!(cuelist = calloc(sizeof(cuelist_t), 1)))
+        diep("calloc");
+
+    char *directory = show_directory(path);
+    cuelist->fps = TARGET_FPS;
+
+    while(fgets(buffer, sizeof(buffer), fp)) {
+        char *key, *value, *saveptr;
+        char *args[4] = {NULL, NULL, NULL, NULL};
+
+        line += 1;
+
+        if((value = strchr(buffer, '#')))
+            *value = '\0';
+
+        if(!(key = strtok_r(buffer, " \t\r\n", &saveptr)))
+            continue;
+
+        for(int i = 0; i < 4; i++)
+            args[i] = strtok_r(NULL, " \t\r\n", &saveptr);
+
+        if(!args[0]) {
+            error = "missing value";
+            goto cleanup;
+        }
+
+        if(strcmp(key, "show") == 0) {
+            free(cuelist->showpath);
+            cuelist->showpath = show_path_resolve(directory, args[0]);
+            continue;
+        }
+
+        if(strcmp(key, "fps") == 0) {
+            if((cuelist->fps = atoi(args[0])) <= 0 || cuelist->fps > 1000) {
+                error = "invalid fps";
+                goto cleanup;
+            }
+
+            continue;
+        }
+
+        if(strcmp(key, "length") == 0) {
+            if((cuelist->length = atof(args[0])) <= 0) {
+                error = "invalid length";
+                goto cleanup;
+            }
+
+            continue;
+        }
+
+        // cue <seconds> <kind> <value> [fade seconds]
+        if(strcmp(key, "cue") != 0 || !args[1] || !args[2]) {
+            error = "invalid statement";
+            goto cleanup;
+        }
+
+        if(cuelist->cues_total == BAKE_CUES) {
+            error = "too many cues";
+            goto cleanup;
+        }
+
+        cue_t *cue = &cuelist->cues[cuelist->cues_total];
+
+        cue->at = atof(args[0]);
+        cue->fade = args[3] ? atof(args[3]) : 0;
+        cue->kind = 0;
+
+        while(cue->kind < CUE_KINDS && strcmp(cue_names[cue->kind], args[1]) != 0)
+            cue->kind += 1;
+
+        if(cue->kind == CUE_KINDS) {
+            error = "unknown cue";
+            goto cleanup;
+        }
+
+        if(cuelist->cues_total && cue->at < cuelist->cues[cuelist->cues_total - 1].at) {
+            error = "cues not in time order";
+            goto cleanup;
+        }
+
+        if(cue->kind == CUE_PRESET || cue->kind == CUE_MASK) {
+            // slots numbered from 1, like show file
+            int slot = (strcmp(args[2], "off") == 0) ? 0 : atoi(args[2]);
+
+            if(slot < 0 || slot > SHOW_SLOTS || (slot == 0 && strcmp(args[2], "off") != 0)) {
+                error = "invalid slot";
+                goto cleanup;
+            }
+
+            cue->value = slot - 1;
+            cue->fade = 0;
+
+        } else {
+            cue->value = atof(args[2]);
+
+            if(cue->value < 0 || (cue->kind != CUE_SPEED && cue->value > 255) || cue->fade < 0) {
+                error = "invalid value";
+                goto cleanup;
+            }
+        }
+
+        cuelist->cues_total += 1;
+    }
+
+    if(!cuelist->showpath || cuelist->length == 0)
+        error = "show and length are required";
+
+cleanup:
+    free(directory);
+    fclose(fp);
+
+    if(error) {
+        free(cuelist->showpath);
+        free(cuelist);
+        return cuerr(path, line, error);
+    }
+
+    return cuelist;
+}
+
+// sequential sweep of cues: slots, faded values and layers positions
+void bake_sweep(cuelist_t *cuelist, show_t *show, render_state_t *states, int total) {
+    double values[CUE_KINDS], from[CUE_KINDS], start[CUE_KINDS], fade[CUE_KINDS];
+    double target[CUE_KINDS];
+    double positions[LAYERS_MAXIMUM] = {0};
+    double strobe = 0;
+    int layers = show->layers_total + 2;
+    int preset = -1, mask = -1, next = 0;
+
+    double defaults[CUE_KINDS] = {
+        [CUE_PRESET] = -1, [CUE_MASK] = -1, [CUE_MASTER] = 255,
+        [CUE_SEGMENT1] = 255, [CUE_SEGMENT2] = 255, [CUE_SEGMENT3] = 255, [CUE_SEGMENT4] = 255,
+        [CUE_SPEED] = 1000000.0 / show->speed,
+        [CUE_PRESET_OPACITY] = 255, [CUE_MASK_OPACITY] = 255,
+    };
+
+    for(int i = 0; i < CUE_KINDS; i++) {
+        values[i] = from[i] = target[i] = defaults[i];
+        start[i] = fade[i] = 0;
+    }
+
+    for(int f = 0; f < total; f++) {
+        double now = f / (double) cuelist->fps;
+        render_state_t *state = &states[f];
+
+        for(; next < cuelist->cues_total && cuelist->cues[next].at <= now; next++) {
+            cue_t *cue = &cuelist->cues[next];
+            int kind = cue->kind;
+            double elapsed = cue->at - start[kind];
+
+            // fading from where previous cue was at that time
+            if(fade[kind] > 0 && elapsed < fade[kind])
+                from[kind] += (target[kind] - from[kind]) * elapsed / fade[kind];
+            else
+                from[kind] = target[kind];
+
+            target[kind] = cue->value;
+            start[kind] = cue->at;
+            fade[kind] = cue->fade;
+        }
+
+        for(int i = 0; i < CUE_KINDS; i++) {
+            double elapsed = now - start[i];
+
+            values[i] = target[i];
+            if(fade[i] > 0 && elapsed < fade[i])
+                values[i] = from[i] + (target[i] - from[i]) * elapsed / fade[i];
+        }
+
+        // new template starts from its first row, like live
+        if((int) values[CUE_PRESET] != preset) {
+            preset = values[CUE_PRESET];
+            positions[0] = 0;
+        }
+
+        if((int) values[CUE_MASK] != mask) {
+            mask = values[CUE_MASK];
+            positions[layers - 1] = 0;
+        }
+
+        state->time = now;
+        state->speed = values[CUE_SPEED];
+        state->preset = preset;
+        state->mask = mask;
+        state->opacity[0] = values[CUE_PRESET_OPACITY];
+        state->opacity[1] = values[CUE_MASK_OPACITY];
+
+        record_control_t *control = &state->control;
+
+        control->master = values[CUE_MASTER];
+        control->strip_rgb[0] = values[CUE_RED];
+        control->strip_rgb[1] = values[CUE_GREEN];
+        control->strip_rgb[2] = values[CUE_BLUE];
+        control->blackout = values[CUE_BLACKOUT] > 0;
+        control->fullon = values[CUE_FULLON] > 0;
+        control->strobe = values[CUE_STROBE];
+        control->strobe_duty = values[CUE_STROBE_DUTY];
+        control->strobe_mode = show->strobe_mode;
+        control->strobe_bars = show->strobe_bars;
+
+        // strobe integrated like positions, its rate can fade
+        if(!control->strobe)
+            strobe = 0;
+
+        state->strobe = strobe;
+
+        if(control->strobe)
+            strobe += strobe_rate(control->strobe) / cuelist->fps;
+
+        for(int i = 0; i < GROUPS_TOTAL; i++)
+            control->sliders[i] = values[CUE_SEGMENT1 + i];
+
+        // positions now, then moving forward at layer speed, speed
+        // can fade so positions are integrated here
+        for(int i = 0; i < layers; i++) {
+            frame_t *source = NULL;
+            uint16_t speed = 100;
+
+            if(i == 0) {
+                source = (preset >= 0) ? show->presets[preset].frame : NULL;
+
+            } else if(i == layers - 1) {
+                source = (mask >= 0) ? show->masks[mask].frame : NULL;
+
+            } else {
+                source = show->layers[i - 1].source.frame;
+                speed = show->layers[i - 1].layer.speed;
+            }
+
+            state->positions[i] = positions[i];
+
+            if(!source)
+                continue;
+
+            positions[i] += values[CUE_SPEED] * (speed / 100.0) / cuelist->fps;
+            while(positions[i] >= source->height)
+                positions[i] -= source->height;
+        }
+    }
+}
+
+void bake_task(void *context, int worker, int index) {
+    baker_t *baker = (baker_t *) context;
+    render_state_t *state = &baker->states[index];
+
+    render_frame(baker->renderers[worker], state, state->time, baker->output + ((size_t) index * BITMAPSIZE));
+}
+
+int bake_run(char *cuepath, char *output) {
+    cuelist_t *cuelist;
+    show_t *show;
+    int fd;
+
+    if(!(cuelist = cuelist_loadfile(cuepath)))
+        return 1;
+
+    if(!(show = show_loadfile(cuelist->showpath))) {
+        free(cuelist->showpath);
+        free(cuelist);
+        return 1;
+    }
+
+    // empty slots render nothing, like live, but worth knowing
+    for(int i = 0; i < cuelist->cues_total; i++) {
+        cue_t *cue = &cuelist->cues[i];
+        source_t *sources = (cue->kind == CUE_PRESET) ? show->presets : show->masks;
+
+        if((cue->kind == CUE_PRESET || cue->kind == CUE_MASK) && cue->value >= 0 && !sources[(int) cue->value].frame)
+            printf("[-] bake: cue at %.2f s: %s %d is empty\n", cue->at, cue_names[cue->kind], (int) cue->value + 1);
+    }
+
+    int total = cuelist->length * cuelist->fps;
+    size_t length = BAKE_OFFSET + (size_t) total * BITMAPSIZE;
+
+    printf("[+] bake: %s, %d frames (%.1f seconds at %d fps) from show %s\n",
+        cuepath, total, cuelist->length, cuelist->fps, show->name);
+
+    if((fd = open(output, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+        diep(output);
+
+    if(ftruncate(fd, length) < 0)
+        diep("bake: ftruncate");
+
+    uint8_t *mapped = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(mapped == MAP_FAILED)
+        diep("bake: mmap");
+
+    render_state_t *states = calloc(sizeof(render_state_t), total);
+    if(!states)
+        diep("bake: calloc");
+
+    uint64_t begin = monotonic_ns();
+
+    bake_sweep(cuelist, show, states, total);
+
+    // frames are independent once swept, rendered on every core
+    pool_t *pool = pool_new(pool_cores());
+    baker_t baker = {.states = states, .output = mapped + BAKE_OFFSET};
+
+    for(int i = 0; i < pool->size; i++)
+        baker.renderers[i] = renderer_new(show);
+
+    pool_run(pool, total, bake_task, &baker);
+
+    for(int i = 0; i < pool->size; i++)
+        renderer_free(baker.renderers[i]);
+
+    bake_header_t header = {
+        .magic = BAKE_MAGIC,
+        .version = BAKE_VERSION,
+        .leds = LEDSTOTAL,
+        .fps = cuelist->fps,
+        .frames = total,
+        .length = BITMAPSIZE,
+        .offset = BAKE_OFFSET,
+    };
+
+    memcpy(mapped, &header, sizeof(header));
+
+    if(msync(mapped, length, MS_SYNC) < 0)
+        diep("bake: msync");
+
+    double elapsed = (monotonic_ns() - begin) / 1000000000.0;
+
+    printf("[+] bake: %s written, %.1f MB, %.2f seconds on %d workers (%.1fx real time)\n",
+        output, length / 1048576.0, elapsed, pool->size, elapsed > 0 ? cuelist->length / elapsed : 0);
+
+    munmap(mapped, length);
+    close(fd);
+
+    pool_free(pool);
+    free(states);
+    show_free(show);
+    free(cuelist->showpath);
+    free(cuelist);
+
+    return 0;
+}
+
+int bake_play(char *path, double speed, char *target) {
+    bake_header_t header;
+    struct stat st;
+    int fd;
+
+    if((fd = open(path, O_RDONLY)) < 0) {
+        perror(path);
+        return 1;
+    }
+
+    if(fstat(fd, &st) < 0 || read(fd, &header, sizeof(header)) != sizeof(header)) {
+        perror(path);
+        close(fd);
+        return 1;
+    }
+
+    if(header.magic != BAKE_MAGIC || header.version != BAKE_VERSION || header.leds != LEDSTOTAL || header.length != BITMAPSIZE || header.fps == 0) {
+        fprintf(stderr, "[-] playback: %s: unsupported baked show\n", path);
+        close(fd);
+        return 1;
+    }
+
+    if((size_t) st.st_size < header.offset + (size_t) header.frames * BITMAPSIZE) {
+        fprintf(stderr, "[-] playback: %s: truncated baked show\n", path);
+        close(fd);
+        return 1;
+    }
+
+    // frames are sent straight from the mapping, paged in upfront
+    uint8_t *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if(mapped == MAP_FAILED)
+        diep("playback: mmap");
+
+    madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+
+    printf("[+] playback: %s, %u frames at %u fps, %s at %.1fx\n",
+        path, header.frames, header.fps, target ? target : "no target", speed);
+
+    frame_header_t frameheader = {.magic = FRAME_MAGIC, .sequence = 0};
+    wakeup_t wakeup = {0};
+    uint64_t start = monotonic_ns();
+
+    for(uint32_t i = 0; i < header.frames; i++) {
+        uint8_t *bitmap = mapped + header.offset + ((size_t) i * BITMAPSIZE);
+
+        if(speed > 0) {
+            uint64_t deadline = start + (uint64_t) (i * 1000000000.0 / (header.fps * speed));
+            struct timespec next = {
+                .tv_sec = deadline / 1000000000,
+                .tv_nsec = deadline % 1000000000,
+            };
+
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+            wakeup_record(&wakeup, monotonic_ns() - deadline);
+        }
+
+        if(target) {
+            frameheader.sequence += 1;
+            frameheader.timestamp = monotonic_ns() / 1000;
+            frame_checksum(&frameheader, bitmap);
+            netsend_transmit_frame(&frameheader, bitmap, target);
+        }
+    }
+
+    double elapsed = (monotonic_ns() - start) / 1000000000.0;
+    uint64_t average = wakeup.count ? wakeup.total / wakeup.count : 0;
+
+    printf("[+] playback: %u frames in %.2f seconds, wakeup late avg/max %lu/%lu us\n",
+        header.frames, elapsed, average / 1000, wakeup.max / 1000);
+
+    munmap(mapped, st.st_size);
+    close(fd);
+
+    return 0;
+}
+
+//
+// recording replay
+//
+int replay_run(char *path, double speed, char *target) {
+    record_header_t header;
+    record_chunk_t chunk;
+    FILE *fp;
+
+    if(!(fp = fopen(path, "r"))) {
+        perror(path);
+        return 1;
+    }
+
+    if(fread(&header, sizeof(header), 1, fp) != 1) {
+        fprintf(stderr, "[-] replay: %s: not a recording\n", path);
+        fclose(fp);
+        return 1;
+    }
+
+    // baked shows are played from their own mapping
+    if(header.magic == BAKE_MAGIC) {
+        fclose(fp);
+        return bake_play(path, speed, target);
+    }
+
+    if(header.magic != RECORD_MAGIC) {
+        fprintf(stderr, "[-] replay: %s: not a recording\n", path);
+        fclose(fp);
+        return 1;
+    }
+
+    if(header.version != RECORD_VERSION || header.leds != LEDSTOTAL || header.length != sizeof(record_frame_t)) {
+        fprintf(stderr, "[-] replay: %s: unsupported recording (version %u, %u leds)\n", path, header.version, header.leds);
+        fclose(fp);
+        return 1;
+    }
+
+    if(target && !gethostbyname(target)) {
+        fprintf(stderr, "[-] replay: %s: cannot resolve target host\n", target);
+        fclose(fp);
+        return 1;
+    }
+
+    uLong deflatesize = compressBound(sizeof(record_frame_t) * RECORD_FRAMES);
+    record_frame_t *frames = malloc(sizeof(record_frame_t) * RECORD_FRAMES);
+    uint8_t *deflated = malloc(deflatesize);
+    uint8_t *bitmap = malloc(BITMAPSIZE);
+
+    if(!frames || !deflated || !bitmap)
+        diep("replay: malloc");
+
+    printf("[+] replay: %s, %s at %.1fx\n", path, target ? target : "no target", speed);
+
+    frame_header_t frameheader = {.magic = FRAME_MAGIC, .sequence = 0};
+    uint64_t replayed = 0, chunks = 0;
+    uint64_t start = monotonic_ns();
+    int corrupted = 0;
+
+    while(fread(&chunk, sizeof(chunk), 1, fp) == 1) {
+        uLongf rawsize = sizeof(record_frame_t) * chunk.frames;
+
+        if(chunk.magic != RECORD_CHUNK || chunk.frames == 0 || chunk.frames > RECORD_FRAMES || chunk.compressed > deflatesize) {
+            corrupted = 1;
+            break;
+        }
+
+        if(fread(deflated, chunk.compressed, 1, fp) != 1) {
+            corrupted = 1;
+            break;
+        }
+
+        if(uncompress((Bytef *) frames, &rawsize, deflated, chunk.compressed) != Z_OK) {
+            corrupted = 1;
+            break;
+        }
+
+        if(rawsize != sizeof(record_frame_t) * chunk.frames || crc32(0, (Bytef *) frames, rawsize) != chunk.checksum) {
+            corrupted = 1;
+            break;
+        }
+
+        for(uint32_t i = 0; i < chunk.frames; i++) {
+            record_frame_t *frame = &frames[i];
+
+            if(i == 0) {
+                memcpy(bitmap, frame->bitmap, BITMAPSIZE);
+
+            } else {
+                for(int j = 0; j < BITMAPSIZE; j++)
+                    bitmap[j] ^= frame->bitmap[j];
+            }
+
+            // original pacing, scaled, no speed means as fast as possible
+            if(speed > 0) {
+                uint64_t deadline = start + (uint64_t) (frame->timestamp * 1000 / speed);
+                struct timespec next = {
+                    .tv_sec = deadline / 1000000000,
+                    .tv_nsec = deadline % 1000000000,
+                };
+
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+            }
+
+            if(target) {
+                frameheader.sequence += 1;
+                frameheader.timestamp = monotonic_ns() / 1000;
+                frame_checksum(&frameheader, bitmap);
+                netsend_transmit_frame(&frameheader, bitmap, target);
+            }
+
+            replayed += 1;
+        }
+
+        chunks += 1;
+    }
+
+    if(corrupted)
+        fprintf(stderr, "[-] replay: %s: chunk %lu corrupted, stopping\n", path, chunks);
+
+    double elapsed = (monotonic_ns() - start) / 1000000000.0;
+
+    printf("[+] replay: %lu frames (%lu chunks) in %.2f seconds, %.1f frames/s\n",
+        replayed, chunks, elapsed, elapsed > 0 ? replayed / elapsed : 0);
+
+    free(frames);
+    free(deflated);
+    free(bitmap);
+    fclose(fp);
+
+    return corrupted;
+}
+
+void *thread_netsend(void *extra) {
+    kntxt_t *kntxt = (kntxt_t *) extra;
+    char *controladdr;
+
+    logger("[+] netsend: sending frames to controller");
+
+    pixel_t *monitor = arena_alloc(sizeof(pixel_t) * LEDSTOTAL); // live copy
+    pixel_t *preview = arena_alloc(sizeof(pixel_t) * LEDSTOTAL); // always visible copy
+
+    uint8_t *localbitmap = arena_alloc(BITMAPSIZE);
+
+    // sequence lets controller feedback account lost frames
+    frame_header_t header = {.magic = FRAME_MAGIC, .sequence = 0};
+
+    // settings applied to frame, kept by recorder
+    record_control_t control = {0};
+    strobe_t strobe = {0};
+
+    bumps_t bumps = {
+        .frame = arena_alloc(BITMAPSIZE),
+        .white = arena_alloc(sizeof(pixel_t) * LEDSTOTAL),
+    };
+
+    // transform time
+    struct timeval before, after;
+
+    // next frame deadline, ns on monotonic clock
+    uint64_t deadline = monotonic_ns();
+    uint64_t pressed = 0; // bump waiting for this frame
+    int scheduled = 1;    // frame is the periodic one, not a bump
+
+    while(kntxt->keepgoing) {
+        // fetch current frame pixel from animate
+        pthread_mutex_lock(&kntxt->lock);
+
+        memcpy(monitor, kntxt->pixels, sizeof(pixel_t) * LEDSTOTAL);
+        controladdr = kntxt->controladdr;
+        uint64_t period = 1000000000 / kntxt->client.rate;
+
+        pthread_mutex_unlock(&kntxt->lock);
+
+        // apply transformation
+        gettimeofday(&before, NULL);
+        netsend_pixels_transform(kntxt, &strobe, &bumps, monitor, preview, localbitmap, &control);
+
+        header.sequence += 1;
+        frame_checksum(&header, localbitmap);
+
+        gettimeofday(&after, NULL);
+
+        // commit transformation to monitor to see changes on console
+        pthread_mutex_lock(&kntxt->lock);
+
+        kntxt->client.time_transform = timediff(&after, &before);
+        memcpy(kntxt->monitor, monitor, sizeof(pixel_t) * LEDSTOTAL);
+        memcpy(kntxt->preview, preview, sizeof(pixel_t) * LEDSTOTAL);
+        kntxt->client.frames += 1;
+
+        frame_checksum_t *sent = &kntxt->client.checksums[header.sequence % FRAME_CHECKSUMS];
+        sent->sequence = header.sequence;
+        sent->checksum = header.checksum;
 
-    free(lines);
+        pthread_mutex_unlock(&kntxt->lock);
 
-    png_destroy_read_struct(&ctx, &info, NULL);
+        // sending the frame to the controller (if alive)
+        if(controladdr) {
+            header.timestamp = monotonic_ns() / 1000;
+            netsend_transmit_frame(&header, localbitmap, controladdr);
 
-    return frame;
+            if(pressed)
+                wakeup_record(&kntxt->trigger.latency, monotonic_ns() - pressed);
+        }
+
+        if(kntxt->recorder)
+            recorder_push(kntxt->recorder, &header, &control, localbitmap);
+
+        // pacing at current rate, not drifting with transform time,
+        // bump frames are extra ones and keep the schedule
+        uint64_t current = monotonic_ns();
+
+        if(scheduled) {
+            deadline += period;
+
+            if(deadline < current)
+                deadline = current; // too late, not bursting to catch up
+        }
+
+        pressed = trigger_wait(&kntxt->trigger, deadline);
+
+        int64_t late = monotonic_ns() - deadline;
+        scheduled = (late >= 0);
+
+        if(scheduled)
+            wakeup_record(&kntxt->wakeups[THREAD_NETSEND], late);
+    }
+
+    return NULL;
 }
 
-void *thread_animate(void *extra) {
-    kntxt_t *kntxt = (kntxt_t *) extra;
-    frame_t *frame, *maskframe;
-    int line = 0, maskline = 0;
+//
+// feedback management
+//
+// record value into its struct, records can be longer than we know
+static int feedback_value(void *target, size_t size, const uint8_t *value, int length) {
+    if(length < (int) size)
+        return 0;
 
-    // allocate local copy of pixels
-    pixel_t *localpixels = (pixel_t *) calloc(sizeof(pixel_t), LEDSTOTAL);
-    pixel_t *localmask = (pixel_t *) calloc(sizeof(pixel_t), LEDSTOTAL);
+    memcpy(target, value, size);
+    return 1;
+}
 
-    // fetch initial frame already loaded by loader
-    pthread_mutex_lock(&kntxt->lock);
+int feedback_decode(controller_stats_t *stats, const uint8_t *message, int bytes) {
+    feedback_header_t header;
+    int decoded = 0; // records types found
 
-    // remove frame from context, keeping it for us
-    frame = kntxt->frame;
-    kntxt->frame = NULL;
+    if(bytes < (int) sizeof(header))
+        return 0;
 
-    maskframe = NULL;
+    memcpy(&header, message, sizeof(header));
 
-    pthread_mutex_unlock(&kntxt->lock);
+    if(header.magic != FEEDBACK_MAGIC || header.version != FEEDBACK_VERSION || header.length != bytes)
+        return 0;
 
-    while(kntxt->keepgoing) {
-        // checking for changes
-        pthread_mutex_lock(&kntxt->lock);
+    memset(stats, 0x00, sizeof(controller_stats_t));
 
-        if(kntxt->frame != NULL) {
-            // cleaning frame not used anymore
-            free(frame->pixels);
-            free(frame);
+    for(int offset = sizeof(header); offset < bytes; ) {
+        feedback_record_t record;
 
-            // acquiring new frame
-            frame = kntxt->frame;
-            kntxt->frame = NULL;
+        if(bytes - offset < (int) sizeof(record))
+            return 0;
+
+        memcpy(&record, message + offset, sizeof(record));
+        offset += sizeof(record);
+
+        if(record.length > bytes - offset)
+            return 0;
+
+        const uint8_t *value = message + offset;
+        offset += record.length;
+
+        switch(record.type) {
+        case FEEDBACK_COUNTERS: {
+            feedback_counters_t c;
+
+            if(!feedback_value(&c, sizeof(c), value, record.length))
+                return 0;
 
-            // start from the begining of that frame
-            line = 0;
+            stats->state = c.state;
+            stats->frames = c.frames;
+            stats->fps = c.fps;
+            stats->time_last_frame = c.time_last_frame;
+            stats->time_current = c.time_current;
+            break;
         }
 
-        if(kntxt->maskframe != NULL) {
-            // cleaning frame not used anymore
-            if(maskframe) {
-                free(maskframe->pixels);
-                free(maskframe);
-            }
+        case FEEDBACK_LINK: {
+            feedback_link_t l;
 
-            // acquiring new frame
-            maskframe = kntxt->maskframe;
-            kntxt->maskframe = NULL;
+            if(!feedback_value(&l, sizeof(l), value, record.length))
+                return 0;
 
-            // start from the begining of that frame
-            maskline = 0;
+            stats->sequence = l.sequence;
+            stats->reordered = l.reordered;
+            stats->invalid = l.invalid;
+            stats->echo_age = l.echo_age;
+            stats->echo = l.echo;
+            break;
+        }
 
-            // special reset flag
-            if(maskframe == (frame_t *) &kntxt->maskreset) {
-                memset(localmask, 0x00, sizeof(pixel_t) * LEDSTOTAL);
-                maskframe = NULL;
-            }
+        case FEEDBACK_OUTPUT: {
+            feedback_output_t o;
+
+            if(!feedback_value(&o, sizeof(o), value, record.length))
+                return 0;
+
+            stats->lanes = o.lanes;
+            stats->show_last = o.show_last;
+            stats->show_max = o.show_max;
+            stats->busy = o.busy;
+            break;
         }
 
-        pthread_mutex_unlock(&kntxt->lock);
+        case FEEDBACK_TEMPERATURES: {
+            feedback_temperatures_t t;
 
-        // copy line (avoid copy pixel by pixel)
-        memcpy(localpixels, &frame->pixels[line * frame->width], LEDSTOTAL * sizeof(pixel_t));
+            if(!feedback_value(&t, sizeof(t), value, record.length))
+                return 0;
 
-        if(maskframe)
-            memcpy(localmask, &maskframe->pixels[maskline * maskframe->width], LEDSTOTAL * sizeof(pixel_t));
+            stats->main_core_temperature = t.main_core;
+            stats->mon_core_temperature = t.mon_core;
+            stats->ext_power_temperature = t.ext_power;
+            stats->ext_compute_temperature = t.ext_compute;
+            break;
+        }
 
-        // commit this frame pixel to main context
-        pthread_mutex_lock(&kntxt->lock);
+        case FEEDBACK_MAINS: {
+            feedback_mains_t m;
 
-        memcpy(kntxt->pixels, localpixels, sizeof(pixel_t) * LEDSTOTAL);
-        memcpy(kntxt->maskpixels, localmask, sizeof(pixel_t) * LEDSTOTAL);
-        useconds_t waiting = kntxt->speed;
+            if(!feedback_value(&m, sizeof(m), value, record.length))
+                return 0;
 
-        pthread_mutex_unlock(&kntxt->lock);
+            stats->main_ac_voltage = m.voltage;
+            break;
+        }
 
-        // wait relative to speed for the next frame
-        // usleep(waiting);
-        thread_wait(waiting);
+        case FEEDBACK_PSU: {
+            feedback_psu_t p;
 
-        line += 1;
-        if(line >= frame->height)
-            line = 0;
+            if(!feedback_value(&p, sizeof(p), value, record.length))
+                return 0;
+
+            // more modules than we display
+            if(p.index >= FEEDBACK_PSUS)
+                break;
 
-        if(maskframe) {
-            maskline += 1;
-            if(maskline >= maskframe->height)
-                maskline = 0;
+            stats->psu_volts[p.index] = p.volts;
+            stats->psu_amps[p.index] = p.amps;
+            break;
         }
-    }
 
-    return NULL;
-}
+        case FEEDBACK_TELEMETRY: {
+            feedback_telemetry_t t;
 
-//
-// presets worker and loader
-//
-void *thread_presets(void *extra) {
-    kntxt_t *kntxt = (kntxt_t *) extra;
-    // int retval;
-    frame_t *frame;
+            if(!feedback_value(&t, sizeof(t), value, record.length))
+                return 0;
+
+            stats->telemetry_frames = t.frames;
+            stats->telemetry_errors = t.errors;
+            break;
+        }
 
-    logger("[+] presets: initializing presets, loading default one");
+        case FEEDBACK_INTEGRITY: {
+            feedback_integrity_t i;
 
-    /*
-       struct timespec ts = {
-       .tv_sec = 1,
-       .tv_nsec = 100000,
-       };
-       */
+            if(!feedback_value(&i, sizeof(i), value, record.length))
+                return 0;
 
-    while(kntxt->keepgoing) {
-        /*
-           if((retval = pthread_cond_timedwait(&kntxt->cond_presets, &kntxt->mutcond_presets, &ts)) != 0) {
-           if(retval == ETIMEDOUT) {
-           logger("timeout");
-           continue;
-           }
-           }
-           */
-
-        pthread_mutex_lock(&kntxt->mutcond_presets);
-        pthread_cond_wait(&kntxt->cond_presets, &kntxt->mutcond_presets); // FIXME
-        pthread_mutex_unlock(&kntxt->mutcond_presets);
-
-        // loading new preset name
-        pthread_mutex_lock(&kntxt->lock);
-        char *preset = strdup(kntxt->preset);
-        pthread_mutex_unlock(&kntxt->lock);
+            stats->integrity_sequence = i.sequence;
+            stats->integrity_checksum = i.checksum;
+            stats->integrity_checked = i.checked;
+            stats->integrity_errors = i.errors;
+            break;
+        }
+
+        case FEEDBACK_POWER: {
+            if(!feedback_value(&stats->power, sizeof(stats->power), value, record.length))
+                return 0;
+
+            break;
+        }
 
-        // locally load the frame
-        logger("[+] presets: loading new presets: %s", preset);
-        if(!(frame = frame_loadfile(preset))) {
-            // load failed, skipping
-            free(preset);
+        default:
+            // newer record, not known yet
             continue;
         }
 
-        // commit frame
-        pthread_mutex_lock(&kntxt->lock);
-        // free previous frame not yet acquired by animate thread
-        if(kntxt->frame) {
-            free(kntxt->frame->pixels);
-            free(kntxt->frame);
+        decoded |= 1 << record.type;
+    }
+
+    // counters are required, except for power datagrams
+    if(!(decoded & ((1 << FEEDBACK_COUNTERS) | (1 << FEEDBACK_POWER))))
+        return 0;
+
+    return decoded;
+}
+
+void feedback_windows(control_stats_t *client, uint64_t now) {
+    uint64_t spans[] = {1000000, 10000000};
+
+    for(int w = 0; w < LINK_WINDOWS - 1; w++) {
+        linkwindow_t window = {0};
+        uint64_t rtts = 0, measured = 0;
+
+        for(int i = 0; i < LINK_SAMPLES; i++) {
+            linksample_t *sample = &client->samples[i];
+
+            if(!sample->time || now - sample->time > spans[w])
+                continue;
+
+            window.sent += sample->sent;
+            window.lost += sample->lost;
+            window.reordered += sample->reordered;
+
+            if(sample->rtt) {
+                rtts += sample->rtt;
+                measured += 1;
+
+                if(sample->rtt > window.rtt_maximum)
+                    window.rtt_maximum = sample->rtt;
+            }
         }
 
-        kntxt->frame = frame;
-        pthread_mutex_unlock(&kntxt->lock);
+        window.rtt_average = measured ? rtts / measured : 0;
+        window.lossrate = window.sent ? (window.lost * 100.0) / window.sent : 0;
 
-        free(preset);
+        client->windows[w] = window;
     }
+}
 
-    return NULL;
+void feedback_account(control_stats_t *client, controller_stats_t *current, controller_stats_t *previous, uint64_t now) {
+    linksample_t sample = {.time = now};
+
+    // sequence numbers wrap, differences stay right
+    uint32_t received = current->frames - previous->frames;
+
+    sample.sent = current->sequence - previous->sequence;
+    sample.reordered = current->reordered - previous->reordered;
+
+    if(received + sample.reordered < sample.sent)
+        sample.lost = sample.sent - received - sample.reordered;
+
+    // round trip of latest frame, without time it waited on controller
+    if(current->echo && now > current->echo + current->echo_age)
+        sample.rtt = now - current->echo - current->echo_age;
+
+    client->samples[client->samples_next] = sample;
+    client->samples_next = (client->samples_next + 1) % LINK_SAMPLES;
+
+    // session window
+    linkwindow_t *session = &client->windows[LINK_WINDOWS - 1];
+
+    session->sent += sample.sent;
+    session->lost += sample.lost;
+    session->reordered += sample.reordered;
+    session->lossrate = session->sent ? (session->lost * 100.0) / session->sent : 0;
+
+    if(sample.rtt > session->rtt_maximum)
+        session->rtt_maximum = sample.rtt;
+
+    if(sample.rtt)
+        session->rtt_average = session->rtt_average ? (session->rtt_average * 15 + sample.rtt) / 16 : sample.rtt;
+
+    client->showframes += received;
+    client->dropped = session->lost;
+    client->droprate = session->lossrate;
+
+    feedback_windows(client, now);
+}
+
+// last verified checksum against the one sent with same sequence
+void feedback_integrity(control_stats_t *client, controller_stats_t *current, controller_stats_t *previous) {
+    if(current->integrity_errors != previous->integrity_errors)
+        logger("[-] feedback: controller rejected %u frames, checksum mismatch", current->integrity_errors - previous->integrity_errors);
+
+    if(current->integrity_checked == previous->integrity_checked)
+        return;
+
+    frame_checksum_t *sent = &client->checksums[current->integrity_sequence % FRAME_CHECKSUMS];
+
+    // too old, already overwritten
+    if(sent->sequence != current->integrity_sequence)
+        return;
+
+    if(sent->checksum != current->integrity_checksum) {
+        logger("[-] feedback: frame %u checksum %08x, controller verified %08x",
+            sent->sequence, sent->checksum, current->integrity_checksum);
+
+        client->mismatches += 1;
+    }
+}
+
+void feedback_rate(control_stats_t *client, controller_stats_t *current, uint64_t now) {
+    linkwindow_t *second = &client->windows[0];
+
+    // controller not presenting anything, nothing to learn from
+    if(!second->sent || current->time_current - current->time_last_frame > 1000)
+        return;
+
+    // controller counts frames shown over 200 ms, averaged out
+    if(client->presented == 0)
+        client->presented = current->fps;
+
+    client->presented += (current->fps - client->presented) * RATE_SMOOTH;
+
+    // never sending much more than controller can show
+    double ceiling = client->presented + RATE_PROBE;
+
+    if(ceiling < RATE_MINIMUM)
+        ceiling = RATE_MINIMUM;
+
+    if(ceiling > RATE_MAXIMUM)
+        ceiling = RATE_MAXIMUM;
+
+    if(now < client->rate_hold)
+        return;
+
+    // frames dropped or waiting in controller queue for a whole period
+    if(second->lossrate > RATE_LOSS || second->rtt_average > 1000000 / client->rate) {
+        client->rate *= RATE_BACKOFF;
+        if(client->rate < RATE_MINIMUM)
+            client->rate = RATE_MINIMUM;
+
+        client->rate_hold = now + 1000000;
+        return;
+    }
+
+    // ahead of controller, halfway back to what it shows each time
+    if(client->rate > ceiling) {
+        client->rate -= (client->rate - ceiling) / 2;
+        return;
+    }
+
+    // clean second, probing up to what controller shows
+    if(second->lost == 0)
+        client->rate += RATE_STEP;
+
+    if(client->rate > ceiling)
+        client->rate = ceiling;
+}
+
+// metrics board frame, current kept with its peak over last window
+void feedback_power(power_stats_t *stats, feedback_power_t *power, uint64_t now) {
+    int channels[FEEDBACK_PSUS] = {TELEMETRY_PSU0_AMPS, TELEMETRY_PSU1_AMPS, TELEMETRY_PSU2_AMPS};
+    telemetry_t *frame = &power->frame;
+
+    if(stats->received) {
+        power_sample_t *previous = &stats->samples[(stats->next + POWER_SAMPLES - 1) % POWER_SAMPLES];
+        uint16_t elapsed = frame->sequence - previous->power.frame.sequence;
+
+        // larger jumps are a metrics board restart
+        if(elapsed > 1 && elapsed < POWER_SAMPLES)
+            stats->missing += elapsed - 1;
+    }
+
+    power_sample_t *sample = &stats->samples[stats->next];
+    sample->time = now;
+    sample->power = *power;
+
+    stats->next = (stats->next + 1) % POWER_SAMPLES;
+    stats->received += 1;
+    stats->last = now;
+    stats->age = 0;
+
+    for(int p = 0; p < FEEDBACK_PSUS; p++) {
+        int channel = channels[p];
+
+        if(frame->valid & (1 << channel)) {
+            stats->amps[p] = frame->channels[channel];
+
+            if(frame->ages[channel] > stats->age)
+                stats->age = frame->ages[channel];
+        }
+
+        stats->peak[p] = 0;
+
+        for(int i = 0; i < POWER_SAMPLES; i++) {
+            power_sample_t *s = &stats->samples[i];
+
+            if(!s->time || now - s->time > POWER_WINDOW || !(s->power.frame.valid & (1 << channel)))
+                continue;
+
+            if(s->power.frame.channels[channel] > stats->peak[p])
+                stats->peak[p] = s->power.frame.channels[channel];
+        }
+    }
 }
 
-void *thread_masks(void *extra) {
+void *thread_feedback(void *extra) {
     kntxt_t *kntxt = (kntxt_t *) extra;
-    // int retval;
-    frame_t *frame;
+    uint8_t message[FEEDBACK_MAXIMUM];
+    char ctrladdr[32];
+    struct sockaddr_in name;
+    struct sockaddr_in client;
+    unsigned long clientaddr = 0;
+    socklen_t clientlen = sizeof(client);
+    controller_stats_t stats, previous;
+    int rejected = 0;
+    int sock;
 
-    logger("[+] masks: initializing masks");
+    if((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        diep("feedback: socket");
+
+    memset(&name, 0x00, sizeof(name));
+    name.sin_family = AF_INET;
+    name.sin_addr.s_addr = htonl(INADDR_ANY);
+    name.sin_port = htons(1111);
+
+    if(bind(sock, (struct sockaddr *) &name, sizeof(name)) < 0)
+        diep("feedback: bind");
+
+    logger("[+] feedback: waiting for incoming packets");
 
-    /*
-       struct timespec ts = {
-       .tv_sec = 0,
-       .tv_nsec = 100000,
-       };
-       */
+    struct timeval read_timeout;
+    read_timeout.tv_sec = 0;
+    read_timeout.tv_usec = 10000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &read_timeout, sizeof read_timeout);
 
     while(kntxt->keepgoing) {
-        /*
-           if((retval = pthread_cond_timedwait(&kntxt->cond_masks, &kntxt->mutcond_masks, &ts)) != 0) {
-           if(retval == ETIMEDOUT)
-           continue;
-           }
-           */
+        int bytes = recvfrom(sock, message, sizeof(message), 0, (struct sockaddr *) &client, &clientlen);
+
+        if(bytes <= 0) {
+            thread_wait(10000);
+            continue;
+        }
 
-        pthread_mutex_lock(&kntxt->mutcond_masks);
-        pthread_cond_wait(&kntxt->cond_masks, &kntxt->mutcond_masks); // FIXME
-        pthread_mutex_unlock(&kntxt->mutcond_masks);
+        uint64_t now = monotonic_ns() / 1000;
 
-        // loading new mask name
         pthread_mutex_lock(&kntxt->lock);
-        char *mask = strdup(kntxt->mask);
-        pthread_mutex_unlock(&kntxt->lock);
 
-        // locally load the frame
-        logger("[+] mask: loading new mask: %s", mask);
-        if(!(frame = frame_loadfile(mask))) {
-            // load failed, skipping
-            free(mask);
+        int decoded = feedback_decode(&stats, message, bytes);
+
+        if(!decoded) {
+            // logging once until a valid packet comes again
+            if(!rejected)
+                logger("[-] feedback: unexpected packet (%d bytes), ignored", bytes);
+
+            kntxt->client.invalid += 1;
+            rejected = 1;
+
+            pthread_mutex_unlock(&kntxt->lock);
             continue;
         }
 
-        // commit frame
-        pthread_mutex_lock(&kntxt->lock);
-        // free previous frame not yet acquired by animate thread
-        if(kntxt->maskframe) {
-            free(kntxt->maskframe->pixels);
-            free(kntxt->maskframe);
+        rejected = 0;
+
+        // forwarded metrics frame, counters and link untouched
+        if(!(decoded & (1 << FEEDBACK_COUNTERS))) {
+            feedback_power(&kntxt->power, &stats.power, now);
+            pthread_mutex_unlock(&kntxt->lock);
+            continue;
         }
 
-        kntxt->maskframe = frame;
-        pthread_mutex_unlock(&kntxt->lock);
+        if(kntxt->controller.time_current == 0) {
+            logger("[+] feedback: first message received from the controller");
+            logger("[+] feedback: controller frames: %lu, time: %lu", stats.frames, stats.time_current);
 
-        free(mask);
-    }
+            kntxt->client.ctrl_initial_time = stats.time_current;
 
-    return NULL;
-}
+        } else if(stats.time_current < previous.time_current || stats.frames < previous.frames) {
+            // uptime went backward, counters restarted with it
+            logger("[-] feedback: controller rebooted (uptime %lu ms)", stats.time_current);
 
-//
-// network transmitter management
-//
-int netsend_transmit_frame(uint8_t *bitmap, char *target) {
-    struct sockaddr_in serveraddr;
-    struct hostent *hent;
-    int sockfd;
+            kntxt->client.ctrl_initial_time = stats.time_current;
+            kntxt->client.reboots += 1;
+            kntxt->client.rate = TARGET_FPS;
+            kntxt->client.presented = 0;
 
-    char *hostname = target;
-    int portno = 1111;
+        } else {
+            feedback_account(&kntxt->client, &stats, &previous, now);
+            feedback_integrity(&kntxt->client, &stats, &previous);
+            feedback_rate(&kntxt->client, &stats, now);
+        }
 
-    if((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
-        diep("socket");
+        previous = stats;
 
-    if((hent = gethostbyname(hostname)) == NULL) {
-        logger("[-] netsend: cannot resolve target host");
-        return 1;
-    }
+        if(clientaddr != client.sin_addr.s_addr) {
+            // save this address as last client address
+            clientaddr = client.sin_addr.s_addr;
 
-    memset(&serveraddr, 0x00, sizeof(serveraddr));
-    serveraddr.sin_family = AF_INET;
-    serveraddr.sin_port = htons(portno);
+            inet_ntop(AF_INET, &client.sin_addr, ctrladdr, sizeof(ctrladdr));
+            logger("[+] feedback: received from: %s, updating", ctrladdr);
 
-    memcpy(&serveraddr.sin_addr, hent->h_addr_list[0], hent->h_length);
+            // linking this client to main network stack
+            free(kntxt->controladdr);
+            kntxt->controladdr = strdup(ctrladdr);
+        }
 
-    int serverlen = sizeof(serveraddr);
+        kntxt->controller = stats;
+        gettimeofday(&kntxt->client.ctrl_last_feedback, NULL);
 
-    // sending bitmap
-    if(sendto(sockfd, bitmap, BITMAPSIZE, 0, (struct sockaddr *) &serveraddr, serverlen) < 0)
-        diep("sendto");
+        pthread_mutex_unlock(&kntxt->lock);
+    }
 
-    close(sockfd);
+    close(sock);
 
-    return 0;
+    return NULL;
 }
 
-void netsend_pixels_transform(kntxt_t *kntxt, pixel_t *monitor, pixel_t *preview, uint8_t *localbitmap) {
-    // fetch settings from main context
-    pthread_mutex_lock(&kntxt->lock);
+//
+// control surfaces profiles
+//
+// a profile binds notes and control changes of a surface to actions,
+// compiled into a dispatch table indexed by note (0-127) or control
+// change (128-255), a single lookup is needed per incoming event
+//
+// profile syntax, one statement per line, # for comments:
+//   name <pretty name>
+//   port <alsa sequencer address>
+//   sysex <0|1>            (bulk pads update, apc mini mk2 only)
+//   feedback <0|1>         (send leds state to the surface)
+//   clear <first> <last>   (notes reset to black when connecting)
+//   note <note> <action> [argument]
+//   cc <param> <action> [argument]
+//
+// arguments are numbered from 1 like in the show file: presets, masks,
+// segments, sliders, strip channels (1 red, 2 green, 3 blue) and layers
+// (opacity action) in stack order: preset is 1, then show layers, mask
+// is the last one, strobe modes are named
+//
+static const char *surface_actions[] = {
+    [ACTION_NONE] = "none",
+    [ACTION_PRESET] = "preset",
+    [ACTION_MASK] = "mask",
+    [ACTION_MASK_RESET] = "mask-reset",
+    [ACTION_BLACKOUT] = "blackout",
+    [ACTION_FULLON] = "fullon",
+    [ACTION_STRIP] = "strip",
+    [ACTION_SEGMENT] = "segment",
+    [ACTION_SLIDER] = "slider",
+    [ACTION_MASTER] = "master",
+    [ACTION_OPACITY] = "opacity",
+    [ACTION_STROBE] = "strobe",
+    [ACTION_FLASH] = "flash",
+};
+
+void *surferr(char *path, int line, char *str) {
+    fprintf(stderr, "surface: %s: line %d: %s\n", path, line, str);
+    return NULL;
+}
 
-    uint8_t rawmaster = kntxt->midi.master;
-    uint8_t blackout = kntxt->blackout;
-    uint8_t fullon = kntxt->fullon;
+void surface_free(surface_t *surface) {
+    free(surface->name);
+    free(surface->port);
+    free(surface);
+}
 
-    uint8_t strobe = kntxt->strobe;
-    uint8_t strobe_index = kntxt->strobe_index;
-    uint8_t strobe_state = kntxt->strobe_state;
+surface_t *surface_loadfile(char *path) {
+    surface_t *surface;
+    char buffer[256];
+    FILE *fp;
+    int line = 0;
 
-    uint8_t colorize[] = {
-        kntxt->midi.strip_rgb[0],
-        kntxt->midi.strip_rgb[1],
-        kntxt->midi.strip_rgb[2],
-    };
+    if(!(fp = fopen(path, "r")))
+        dieptr(path);
 
-    uint8_t segments[] = {
-        kntxt->midi.sliders[0].value,
-        kntxt->midi.sliders[1].value,
-        kntxt->midi.sliders[2].value,
-    };
+    if(!(surface = calloc(sizeof(surface_t), 1)))
+        diep("calloc");
 
-    if(strobe)
-        kntxt->strobe_index += 1;
+    surface->feedback = 1;
 
-    // applying settings to frame
-    if(blackout)
-        rawmaster = 0;
+    // leds not managed until something is set
+    for(int i = 0; i < APC_NOTES; i++)
+        surface->leds.wanted[i].mode = APC_UNKNOWN_MODE;
+
+    while(fgets(buffer, sizeof(buffer), fp)) {
+        char *key, *value, *saveptr;
+
+        line += 1;
 
-    // checking if a strobe mask needs to be applied
-    if(strobe && !blackout) {
-        int divider = ((256 - strobe) / 20) + 1;
-        int ontime = ((256 - kntxt->strobe_duration) / 20) + 1;
+        if((value = strchr(buffer, '#')))
+            *value = '\0';
+
+        if(!(key = strtok_r(buffer, " \t\r\n", &saveptr)))
+            continue;
+
+        if(strcmp(key, "name") == 0 || strcmp(key, "port") == 0) {
+            // keep the whole remaining line, names contain spaces
+            if(!(value = strtok_r(NULL, "\r\n", &saveptr))) {
+                fclose(fp);
+                surface_free(surface);
+                return surferr(path, line, "missing value");
+            }
 
-        if(strobe_state == 1 && ontime < divider)
-            divider = ontime;
+            while(*value == ' ' || *value == '\t')
+                value += 1;
 
-        // check if we need to change the state
-        if(strobe_index % divider == 0) {
-            kntxt->strobe_index = 1;
+            char **target = (key[0] == 'n') ? &surface->name : &surface->port;
+            free(*target);
+            *target = strdup(value);
 
-            strobe_state = (strobe_state) ? 0 : 1;
-            kntxt->strobe_state = strobe_state;
+            continue;
         }
 
-        // check if we need to apply something
-        if(strobe_state == 0)
-            rawmaster = 0;
-    }
+        char *args[3] = {NULL, NULL, NULL};
+        for(int i = 0; i < 3; i++)
+            args[i] = strtok_r(NULL, " \t\r\n", &saveptr);
 
-    pthread_mutex_unlock(&kntxt->lock);
+        if(strcmp(key, "sysex") == 0 || strcmp(key, "feedback") == 0) {
+            if(!args[0]) {
+                fclose(fp);
+                surface_free(surface);
+                return surferr(path, line, "missing value");
+            }
 
-    // copy current state to preview, which is monitor without master applied
-    memcpy(preview, monitor, sizeof(pixel_t) * LEDSTOTAL);
+            if(key[0] == 's')
+                surface->leds.sysex = atoi(args[0]);
+            else
+                surface->feedback = atoi(args[0]);
 
-    if(fullon)
-        memset(monitor, 0xffffffff, LEDSTOTAL * sizeof(pixel_t));
+            continue;
+        }
 
-    if(colorize[0] || colorize[1] || colorize[2]) {
-        float redmul = (255 - colorize[0]) / 255.0;
-        float greenmul = (255 - colorize[1]) / 255.0;
-        float bluemul = (255 - colorize[2]) / 255.0;
+        if(strcmp(key, "clear") == 0) {
+            long first = args[0] ? strtol(args[0], NULL, 0) : -1;
+            long last = args[1] ? strtol(args[1], NULL, 0) : -1;
 
-        for(int i = 0; i < LEDSTOTAL; i++) {
-            monitor[i].r = (uint8_t) (monitor[i].r * redmul);
-            monitor[i].g = (uint8_t) (monitor[i].g * greenmul);
-            monitor[i].b = (uint8_t) (monitor[i].b * bluemul);
-        }
-    }
+            if(first < 0 || last < first || last >= APC_NOTES) {
+                fclose(fp);
+                surface_free(surface);
+                return surferr(path, line, "invalid notes range");
+            }
 
-    int barperseg[3][8] = {
-        {0,  1,  2,  3,  4,  5,  6,  7},
-        {8,  9,  10, 11, 12, 13, 14, 15},
-        {16, 17, 18, 19, 20, 21, 22, 23},
-    };
+            for(long i = first; i <= last; i++)
+                surface->clears[i] = 1;
 
-    for(int segment = 0; segment < 3; segment++) {
-        // is segment faded
-        if(segments[segment] == 255)
             continue;
+        }
 
-        for(int xbar = 0; xbar < 8; xbar++) {
-            if(barperseg[segment][xbar] < 0)
-                break;
+        if(strcmp(key, "note") != 0 && strcmp(key, "cc") != 0) {
+            fclose(fp);
+            surface_free(surface);
+            return surferr(path, line, "unknown statement");
+        }
 
-            float mul = segments[segment] / 255.0;
+        long number = args[0] ? strtol(args[0], NULL, 0) : -1;
+        int action = -1;
 
-            for(int i = (barperseg[segment][xbar] * PERSEGMENT); i < ((barperseg[segment][xbar] + 1) * PERSEGMENT); i++) {
-                monitor[i].r = (uint8_t) (monitor[i].r * mul);
-                monitor[i].g = (uint8_t) (monitor[i].g * mul);
-                monitor[i].b = (uint8_t) (monitor[i].b * mul);
-            }
+        if(number < 0 || number >= SURFACE_CONTROL) {
+            fclose(fp);
+            surface_free(surface);
+            return surferr(path, line, "invalid note or control number");
         }
-    }
 
-    // apply mask
-    for(int i = 0; i < LEDSTOTAL; i++) {
-        if(kntxt->maskpixels[i].raw != 0) {
-            float mul = (255 - kntxt->maskpixels[i].a) / 255.0;
+        for(size_t i = 0; args[1] && i < sizeof(surface_actions) / sizeof(char *); i++)
+            if(strcmp(args[1], surface_actions[i]) == 0)
+                action = i;
 
-            monitor[i].r = (uint8_t) (monitor[i].r * mul);
-            monitor[i].g = (uint8_t) (monitor[i].g * mul);
-            monitor[i].b = (uint8_t) (monitor[i].b * mul);
+        if(action < 0) {
+            fclose(fp);
+            surface_free(surface);
+            return surferr(path, line, "unknown action");
         }
-    }
 
-    // only compute floating master transformation if needed
-    if(rawmaster < 255 && rawmaster > 0) {
-        double master = rawmaster / 255.0;
+        // indexes are numbered from 1 in profile
+        long argument = args[2] ? strtol(args[2], NULL, 0) : 0;
+        if(action == ACTION_PRESET || action == ACTION_MASK || action == ACTION_SEGMENT || action == ACTION_OPACITY || action == ACTION_STRIP || action == ACTION_SLIDER)
+            argument -= 1;
 
-        for(int i = 0; i < LEDSTOTAL; i++) {
-            monitor[i].r = (uint8_t) (monitor[i].r * master);
-            monitor[i].g = (uint8_t) (monitor[i].g * master);
-            monitor[i].b = (uint8_t) (monitor[i].b * master);
+        // strobe modes are named
+        if(action == ACTION_STROBE) {
+            for(argument = 0; argument < STROBE_MODES; argument++)
+                if(args[2] && strcmp(args[2], strobe_names[argument]) == 0)
+                    break;
+
+            if(argument == STROBE_MODES)
+                argument = -1;
         }
-    }
 
-    if(rawmaster == 0) {
-        // force setting all pixels to zero in a more efficient way
-        memset(monitor, 0x00, sizeof(pixel_t) * LEDSTOTAL);
-    }
+        if(argument < 0 || argument > 255) {
+            fclose(fp);
+            surface_free(surface);
+            return surferr(path, line, "invalid action argument");
+        }
 
-    // building network frame bitmap
-    for(int i = 0; i < LEDSTOTAL; i++) {
-        localbitmap[(i * 3) + 0] = monitor[i].r;
-        localbitmap[(i * 3) + 1] = monitor[i].g;
-        localbitmap[(i * 3) + 2] = monitor[i].b;
+        int index = (key[0] == 'c') ? SURFACE_CONTROL + number : number;
+
+        surface->dispatch[index].action = action;
+        surface->dispatch[index].argument = argument;
     }
-}
 
-void *thread_netsend(void *extra) {
-    kntxt_t *kntxt = (kntxt_t *) extra;
-    char *controladdr;
+    fclose(fp);
 
-    logger("[+] netsend: sending frames to controller");
+    if(!surface->port) {
+        surface_free(surface);
+        return surferr(path, line, "no sequencer port defined");
+    }
 
-    pixel_t *monitor = (pixel_t *) calloc(sizeof(pixel_t), LEDSTOTAL); // live copy
-    pixel_t *preview = (pixel_t *) calloc(sizeof(pixel_t), LEDSTOTAL); // always visible copy
+    if(!surface->name)
+        surface->name = strdup(surface->port);
 
-    uint8_t *localbitmap = (uint8_t *) calloc(sizeof(uint8_t), BITMAPSIZE);
+    return surface;
+}
 
-    // transform time
-    struct timeval before, after;
+//
+// surface leds feedback queue
+//
+// handlers only update the wanted state of a pad, the midi thread
+// then flushes the difference with the last sent state once per cycle,
+// draining the sequencer output a single time
+//
+static const uint8_t apc_solid_levels[] = {
+    10, 25, 50, 65, 75, 90, 100, // APC_SOLID_10 -> APC_SOLID_100
+};
+
+static const uint8_t apc_palette_rgb[][4] = {
+    // color index, red, green, blue
+    {APC_COLOR_BLACK,      0x00, 0x00, 0x00},
+    {APC_COLOR_WHITE,      0xff, 0xff, 0xff},
+    {APC_COLOR_RED,        0xff, 0x00, 0x00},
+    {APC_COLOR_GREEN,      0x00, 0xff, 0x00},
+    {APC_COLOR_BLUE,       0x00, 0x00, 0xff},
+    {APC_COLOR_YELLOW,     0xff, 0xff, 0x00},
+    {APC_COLOR_LIGHT_BLUE, 0x4c, 0xc3, 0xff},
+    {APC_COLOR_PURPLE,     0xff, 0x00, 0xff},
+};
+
+void midi_set_control(padqueue_t *leds, uint8_t mode, uint8_t button, uint8_t value) {
+    if(button >= APC_NOTES)
+        return;
+
+    leds->wanted[button].mode = mode;
+    leds->wanted[button].color = value;
+}
 
-    while(kntxt->keepgoing) {
-        // fetch current frame pixel from animate
-        pthread_mutex_lock(&kntxt->lock);
+void midi_controls_invalidate(padqueue_t *leds) {
+    // forget what the surface shows, next flush sends everything
+    for(int i = 0; i < APC_NOTES; i++)
+        leds->sent[i].mode = APC_UNKNOWN_MODE;
+}
 
-        memcpy(monitor, kntxt->pixels, sizeof(pixel_t) * LEDSTOTAL);
-        controladdr = kntxt->controladdr;
+static void midi_output_note(snd_seq_t *seq, uint8_t mode, uint8_t button, uint8_t value) {
+    snd_seq_event_t ev;
 
-        pthread_mutex_unlock(&kntxt->lock);
+    snd_seq_ev_clear(&ev);
+    snd_seq_ev_set_source(&ev, 0);
+    snd_seq_ev_set_subs(&ev);
+    snd_seq_ev_set_direct(&ev);
 
-        // apply transformation
-        gettimeofday(&before, NULL);
-        netsend_pixels_transform(kntxt, monitor, preview, localbitmap);
-        gettimeofday(&after, NULL);
+    ev.type = SND_SEQ_EVENT_NOTEON;
+    ev.data.note.channel = mode;
+    ev.data.note.note = button;
+    ev.data.note.velocity = value;
 
-        // commit transformation to monitor to see changes on console
-        pthread_mutex_lock(&kntxt->lock);
+    // only queued, drained once by flush
+    snd_seq_event_output(seq, &ev);
+}
 
-        kntxt->client.time_transform = timediff(&after, &before);
-        memcpy(kntxt->monitor, monitor, sizeof(pixel_t) * LEDSTOTAL);
-        memcpy(kntxt->preview, preview, sizeof(pixel_t) * LEDSTOTAL);
-        kntxt->client.frames += 1;
+static int midi_pad_rgb(padled_t *pad, uint8_t *rgb) {
+    // only solid pads can be expressed as plain rgb value
+    if(pad->mode < APC_SOLID_10 || pad->mode > APC_SOLID_100)
+        return 0;
 
-        pthread_mutex_unlock(&kntxt->lock);
+    for(size_t i = 0; i < sizeof(apc_palette_rgb) / sizeof(apc_palette_rgb[0]); i++) {
+        if(apc_palette_rgb[i][0] != pad->color)
+            continue;
 
-        // sending the frame to the controller (if alive)
-        if(controladdr)
-            netsend_transmit_frame(localbitmap, controladdr);
+        int level = apc_solid_levels[pad->mode - APC_SOLID_10];
 
-        thread_wait(1000000 / TARGET_FPS);
-    }
+        for(int c = 0; c < 3; c++)
+            rgb[c] = (apc_palette_rgb[i][c + 1] * level) / 100;
 
-    free(monitor);
-    free(preview);
-    free(localbitmap);
+        return 1;
+    }
 
-    return NULL;
+    return 0;
 }
 
-//
-// feedback management
-//
-void *thread_feedback(void *extra) {
-    kntxt_t *kntxt = (kntxt_t *) extra;
-    char message[1024], ctrladdr[32];
-    struct sockaddr_in name;
-    struct sockaddr_in client;
-    unsigned long clientaddr = 0;
-    socklen_t clientlen = sizeof(client);
-    int sock;
-
-    if((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
-        diep("feedback: socket");
-
-    memset(&name, 0x00, sizeof(name));
-    name.sin_family = AF_INET;
-    name.sin_addr.s_addr = htonl(INADDR_ANY);
-    name.sin_port = htons(1111);
+static int midi_flush_sysex(snd_seq_t *seq, padqueue_t *leds) {
+    // apc mini mk2 pad led color message:
+    //   f0 47 7f 4f 24 <length msb> <length lsb>
+    //   [<start pad> <end pad> <r msb> <r lsb> <g msb> <g lsb> <b msb> <b lsb>] ...
+    //   f7
+    //
+    // consecutive pads with the same color are merged in a single range
+    uint8_t message[7 + (APC_PADS * 8) + 1];
+    uint8_t current[3], rgb[3];
+    size_t length = 7;
+    int updated = 0;
+    int start = -1;
+
+    for(int pad = 0; pad <= APC_PADS; pad++) {
+        padled_t *wanted = &leds->wanted[pad];
+        padled_t *sent = &leds->sent[pad];
+        int usable = 0;
+
+        if(pad < APC_PADS)
+            if(wanted->mode != sent->mode || wanted->color != sent->color)
+                usable = midi_pad_rgb(wanted, rgb);
+
+        // extending current range
+        if(usable && start >= 0 && memcmp(rgb, current, 3) == 0)
+            continue;
 
-    if(bind(sock, (struct sockaddr *) &name, sizeof(name)) < 0)
-        diep("feedback: bind");
+        // closing current range
+        if(start >= 0) {
+            message[length++] = start;
+            message[length++] = pad - 1;
 
-    logger("[+] feedback: waiting for incoming packets");
+            for(int c = 0; c < 3; c++) {
+                message[length++] = current[c] >> 7;
+                message[length++] = current[c] & 0x7f;
+            }
 
-    struct timeval read_timeout;
-    read_timeout.tv_sec = 0;
-    read_timeout.tv_usec = 10000;
-    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &read_timeout, sizeof read_timeout);
+            for(int i = start; i < pad; i++)
+                leds->sent[i] = leds->wanted[i];
 
-    while(kntxt->keepgoing) {
-        int bytes = recvfrom(sock, message, sizeof(message), 0, (struct sockaddr *) &client, &clientlen);
+            updated += pad - start;
+            start = -1;
+        }
 
-        if(bytes <= 0) {
-            thread_wait(10000);
-            continue;
+        if(usable) {
+            memcpy(current, rgb, 3);
+            start = pad;
         }
+    }
 
-        pthread_mutex_lock(&kntxt->lock);
+    if(updated == 0)
+        return 0;
 
-        if(kntxt->controller.time_current == 0) {
-            logger("[+] feedback: first message received from the controller");
+    size_t datalen = length - 7;
 
-            // save a copy of initial message to be able
-            // to compute relative counters
-            controller_stats_t initial;
-            memcpy(&initial, message, bytes);
+    message[0] = 0xf0;
+    message[1] = 0x47;
+    message[2] = 0x7f;
+    message[3] = 0x4f;
+    message[4] = 0x24;
+    message[5] = (datalen >> 7) & 0x7f;
+    message[6] = datalen & 0x7f;
+    message[length++] = 0xf7;
 
-            // resetting internal frames counter
-            // to get droprate in sync
-            kntxt->client.frames = 0;
+    snd_seq_event_t ev;
 
-            kntxt->client.ctrl_initial_frames = initial.frames;
-            kntxt->client.ctrl_initial_time = initial.time_current;
+    snd_seq_ev_clear(&ev);
+    snd_seq_ev_set_source(&ev, 0);
+    snd_seq_ev_set_subs(&ev);
+    snd_seq_ev_set_direct(&ev);
+    snd_seq_ev_set_sysex(&ev, length, message);
 
-            logger("[+] feedback: relative frames: %lu, time: %lu", initial.frames, initial.time_current);
-        }
+    snd_seq_event_output(seq, &ev);
 
-        if(clientaddr != client.sin_addr.s_addr) {
-            // save this address as last client address
-            clientaddr = client.sin_addr.s_addr;
+    return updated;
+}
 
-            inet_ntop(AF_INET, &client.sin_addr, ctrladdr, sizeof(ctrladdr));
-            logger("[+] feedback: received from: %s, updating", ctrladdr);
+int midi_flush_controls(snd_seq_t *seq, padqueue_t *leds) {
+    int updated = 0;
 
-            // linking this client to main network stack
-            free(kntxt->controladdr);
-            kntxt->controladdr = strdup(ctrladdr);
-        }
+    if(leds->sysex)
+        updated += midi_flush_sysex(seq, leds);
 
-        // make a lazy binary copy from controller
-        memcpy(&kntxt->controller, message, bytes);
-        gettimeofday(&kntxt->client.ctrl_last_feedback, NULL);
+    for(int i = 0; i < APC_NOTES; i++) {
+        padled_t *wanted = &leds->wanted[i];
+        padled_t *sent = &leds->sent[i];
+
+        if(wanted->mode == APC_UNKNOWN_MODE)
+            continue;
 
-        kntxt->client.showframes = (kntxt->controller.frames - kntxt->client.ctrl_initial_frames);
-        kntxt->client.dropped = kntxt->client.frames - kntxt->client.showframes;
-        if(kntxt->client.frames)
-            kntxt->client.droprate = (kntxt->client.dropped / (double) kntxt->client.frames) * 100;
+        if(wanted->mode == sent->mode && wanted->color == sent->color)
+            continue;
 
-        pthread_mutex_unlock(&kntxt->lock);
+        midi_output_note(seq, wanted->mode, i, wanted->color);
+        *sent = *wanted;
+        updated += 1;
     }
 
-    close(sock);
+    if(updated)
+        snd_seq_drain_output(seq);
 
-    return NULL;
+    return updated;
 }
 
 //
@@ -924,235 +6034,415 @@ inline uint8_t midi_value_parser(uint8_t input) {
     return parsed;
 }
 
-void midi_set_control(snd_seq_t *seq, uint8_t mode, uint8_t button, uint8_t value) {
-    snd_seq_event_t ev;
+void midi_feedback(kntxt_t *kntxt, uint8_t action, uint8_t argument, uint8_t mode, uint8_t value) {
+    // update every pad bound to this action, on every surface
+    for(int s = 0; s < kntxt->surfaces_total; s++) {
+        surface_t *surface = kntxt->surfaces[s];
 
-    snd_seq_ev_clear(&ev);
-    snd_seq_ev_set_source(&ev, 0);
-    snd_seq_ev_set_subs(&ev);
-    snd_seq_ev_set_direct(&ev);
+        if(!surface->feedback)
+            continue;
 
-    ev.type = SND_SEQ_EVENT_NOTEON;
-    ev.data.note.channel = mode;
-    ev.data.note.note = button;
-    ev.data.note.velocity = value;
+        for(int note = 0; note < SURFACE_CONTROL; note++) {
+            binding_t *binding = &surface->dispatch[note];
 
-    snd_seq_event_output(seq, &ev);
-    snd_seq_drain_output(seq);
+            if(binding->action == action && binding->argument == argument)
+                midi_set_control(&surface->leds, mode, note, value);
+        }
+    }
 }
 
-int midi_handle_event(const snd_seq_event_t *ev, kntxt_t *kntxt, snd_seq_t *seq) {
-    // logger("[+] midi type: %d", ev->type);
+static int strip_colors[3] = {APC_COLOR_RED, APC_COLOR_GREEN, APC_COLOR_BLUE};
 
-    // matrix: 0 -> 63
-    // from bottom left to top right
-    //
-    // volume, pan, send, ...
-    // 100 -> 107
-    //
-    // shift: 122
-    //
-    // clip stop, solo, mute, ...
-    // 112 -> 119
-    //
-    // faders: 48 -> 56
+void midi_group_toggle(kntxt_t *kntxt, int bar) {
+    uint8_t group = 1 << (kntxt->grouping - 1);
 
-    // logger("midi: event type: %d", ev->type);
+    control_t *control = control_begin(&kntxt->controls);
+    control->bargroups[bar] ^= group;
 
-    // FIXME: use local copy, not main object
-    uint8_t *presets = kntxt->midi.presets;
-    uint8_t *masks = kntxt->midi.masks;
+    uint8_t member = control->bargroups[bar] & group;
+    control_commit(&kntxt->controls, control);
 
-    if(ev->type == SND_SEQ_EVENT_NOTEON) {
-        // logger("[+] midi: note on, note: %d", ev->data.note.note);
+    logger("[+] midi: bar %d %s segment %d", bar + 1, member ? "joins" : "leaves", kntxt->grouping);
 
-        for(int i = 0; i < kntxt->presets_total; i++) {
-            if(ev->data.note.note == presets[i]) {
-                // preset not set
-                if(!kntxt->presets[i])
-                    return 0;
+    if(member) {
+        midi_feedback(kntxt, ACTION_PRESET, bar, APC_SOLID_100, APC_COLOR_GREEN);
 
-                pthread_mutex_lock(&kntxt->lock);
+    } else {
+        midi_feedback(kntxt, ACTION_PRESET, bar, APC_SOLID_10, APC_COLOR_WHITE);
+    }
+}
 
-                // switch button blink
-                int oldindex = list_index_search(kntxt->presets, kntxt->preset, kntxt->presets_total);
-                if(oldindex >= 0)
-                    midi_set_control(seq, APC_SOLID_100, presets[oldindex], APC_PRESETS_COLOR);
+int midi_handle_event(const snd_seq_event_t *ev, kntxt_t *kntxt, surface_t *surface) {
+    // logger("midi: event type: %d", ev->type);
+    binding_t *binding;
+    int value;
 
-                midi_set_control(seq, APC_PULSE_1_4, presets[i], APC_PRESETS_COLOR);
+    if(ev->type == SND_SEQ_EVENT_NOTEON || ev->type == SND_SEQ_EVENT_NOTEOFF) {
+        if(ev->data.note.note >= SURFACE_CONTROL)
+            return 0;
 
-                logger("[+] loading preset %d: %s", i + 1, kntxt->presets[i]);
-                kntxt->preset = kntxt->presets[i];
-                pthread_cond_signal(&kntxt->cond_presets);
+        binding = &surface->dispatch[ev->data.note.note];
+        value = (ev->type == SND_SEQ_EVENT_NOTEON) ? ev->data.note.velocity : 0;
 
-                pthread_mutex_unlock(&kntxt->lock);
+    } else if(ev->type == SND_SEQ_EVENT_CONTROLLER) {
+        if(ev->data.control.param >= SURFACE_CONTROL)
+            return 0;
 
-                return 0;
-            }
-        }
+        binding = &surface->dispatch[SURFACE_CONTROL + ev->data.control.param];
+        value = ev->data.control.value;
 
-        if(ev->data.note.note == 112 && kntxt->mask) {
-            pthread_mutex_lock(&kntxt->lock);
+    } else {
+        return 0;
+    }
 
-            if(kntxt->mask) {
-                logger("[+] midi: resetting mask layer");
+    uint8_t argument = binding->argument;
+    int pressed = (ev->type == SND_SEQ_EVENT_NOTEON);
+    control_t *control;
 
-                int oldindex = list_index_search(kntxt->masks, kntxt->mask, kntxt->masks_total);
-                midi_set_control(seq, APC_SOLID_100, masks[oldindex], APC_MASKS_COLOR);
-            }
+    switch(binding->action) {
+    case ACTION_PRESET:
+        // segment button held, pad is a bar of that segment
+        if(kntxt->grouping) {
+            if(pressed && argument < SEGMENTS)
+                midi_group_toggle(kntxt, argument);
 
-            // disable reset button
-            midi_set_control(seq, APC_SINGLE_MODE, 0x70, APC_SINGLE_OFF);
+            return 0;
+        }
 
-            kntxt->mask = NULL;
-            kntxt->maskframe = (frame_t *) &kntxt->maskreset;
+        // preset not set
+        if(!pressed || argument >= kntxt->presets_total || !kntxt->presets[argument])
+            return 0;
 
-            pthread_mutex_unlock(&kntxt->lock);
-        }
+        pthread_mutex_lock(&kntxt->lock);
 
-        for(int i = 0; i < kntxt->masks_total; i++) {
-            if(ev->data.note.note == masks[i]) {
-                // preset not set
-                if(!kntxt->masks[i])
-                    return 0;
+        // switch button blink
+        int oldindex = list_index_search(kntxt->presets, kntxt->preset, kntxt->presets_total);
+        if(oldindex >= 0)
+            midi_feedback(kntxt, ACTION_PRESET, oldindex, APC_SOLID_100, APC_PRESETS_COLOR);
 
-                pthread_mutex_lock(&kntxt->lock);
+        midi_feedback(kntxt, ACTION_PRESET, argument, APC_PULSE_1_4, APC_PRESETS_COLOR);
 
-                // switch button blink
-                if(kntxt->mask) {
-                    int oldindex = list_index_search(kntxt->masks, kntxt->mask, kntxt->masks_total);
-                    midi_set_control(seq, APC_SOLID_100, masks[oldindex], APC_MASKS_COLOR);
-                }
+        logger("[+] loading preset %d: %s", argument + 1, kntxt->presets[argument]);
+        kntxt->preset = kntxt->presets[argument];
 
-                midi_set_control(seq, APC_PULSE_1_4, masks[i], APC_MASKS_COLOR);
+        pthread_mutex_unlock(&kntxt->lock);
 
-                // enable reset button
-                midi_set_control(seq, APC_SINGLE_MODE, 0x70, APC_SINGLE_ON);
+        loader_request(kntxt, LOADER_PRESET, argument);
 
-                logger("[+] loading mask %d: %s", i + 1, kntxt->masks[i]);
-                kntxt->mask = kntxt->masks[i];
-                pthread_cond_signal(&kntxt->cond_masks);
+        return 0;
 
-                pthread_mutex_unlock(&kntxt->lock);
+    case ACTION_MASK_RESET:
+        if(!pressed || !kntxt->mask)
+            return 0;
 
-                return 0;
-            }
-        }
+        // a mask still loading must not show up after reset
+        loader_cancel(kntxt, LOADER_MASK);
 
         pthread_mutex_lock(&kntxt->lock);
 
-        if(ev->data.note.note == 7) {
-            if(kntxt->blackout == 0) {
-                kntxt->blackout = 1;
-                midi_set_control(seq, APC_BLINK_1_24, 0x07, APC_BLACKOUT_COLOR);
+        if(kntxt->mask) {
+            logger("[+] midi: resetting mask layer");
 
-            } else {
-                kntxt->blackout = 0;
-                midi_set_control(seq, APC_SOLID_100, 0x07, APC_BLACKOUT_COLOR);
-            }
+            int oldindex = list_index_search(kntxt->masks, kntxt->mask, kntxt->masks_total);
+            midi_feedback(kntxt, ACTION_MASK, oldindex, APC_SOLID_100, APC_MASKS_COLOR);
         }
 
-        // full on enabled
-        if(ev->data.note.note == 0x06) {
-            kntxt->fullon = 1;
-            midi_set_control(seq, APC_SOLID_100, 0x06, APC_FULLON_COLOR);
+        // disable reset button
+        midi_feedback(kntxt, ACTION_MASK_RESET, 0, APC_SINGLE_MODE, APC_SINGLE_OFF);
+
+        kntxt->mask = NULL;
+
+        frame_release(kntxt->maskframe);
+        kntxt->maskframe = NULL;
+        kntxt->maskpending = 1;
+
+        pthread_mutex_unlock(&kntxt->lock);
+
+        return 0;
+
+    case ACTION_MASK:
+        // mask not set
+        if(!pressed || argument >= kntxt->masks_total || !kntxt->masks[argument])
+            return 0;
+
+        pthread_mutex_lock(&kntxt->lock);
+
+        // switch button blink
+        if(kntxt->mask) {
+            int oldindex = list_index_search(kntxt->masks, kntxt->mask, kntxt->masks_total);
+            midi_feedback(kntxt, ACTION_MASK, oldindex, APC_SOLID_100, APC_MASKS_COLOR);
         }
-        // strip color note
-        int strip_colors[3] = {APC_COLOR_RED, APC_COLOR_GREEN, APC_COLOR_BLUE};
-        if(ev->data.note.note < 3) { // >= 0 not needed, unsigned
-            if(kntxt->midi.strip_rgb[ev->data.note.note]) {
-                midi_set_control(seq, APC_SOLID_100, ev->data.note.note, strip_colors[ev->data.note.note]);
-                kntxt->midi.strip_rgb[ev->data.note.note] = 0;
 
-            } else {
-                midi_set_control(seq, APC_BLINK_1_8, ev->data.note.note, strip_colors[ev->data.note.note]);
-                kntxt->midi.strip_rgb[ev->data.note.note] = 255;
-            }
+        midi_feedback(kntxt, ACTION_MASK, argument, APC_PULSE_1_4, APC_MASKS_COLOR);
+
+        // enable reset button
+        midi_feedback(kntxt, ACTION_MASK_RESET, 0, APC_SINGLE_MODE, APC_SINGLE_ON);
+
+        logger("[+] loading mask %d: %s", argument + 1, kntxt->masks[argument]);
+        kntxt->mask = kntxt->masks[argument];
+
+        pthread_mutex_unlock(&kntxt->lock);
+
+        loader_request(kntxt, LOADER_MASK, argument);
+
+        return 0;
+
+    case ACTION_BLACKOUT:
+        if(!pressed)
+            return 0;
+
+        control = control_begin(&kntxt->controls);
+        control->blackout = !control->blackout;
+
+        uint8_t blackout = control->blackout;
+        control_commit(&kntxt->controls, control);
+        trigger_fire(&kntxt->trigger);
+
+        midi_feedback(kntxt, ACTION_BLACKOUT, 0, blackout ? APC_BLINK_1_24 : APC_SOLID_100, APC_BLACKOUT_COLOR);
+
+        return 0;
+
+    case ACTION_STROBE:
+        // strobe mode, rate and duty are on sliders
+        if(!pressed)
+            return 0;
+
+        control = control_begin(&kntxt->controls);
+        control->strobe_mode = argument;
+        control_commit(&kntxt->controls, control);
+
+        logger("[+] midi: strobe mode %s", strobe_names[argument]);
+
+        for(int s = 0; s < kntxt->surfaces_total; s++)
+            kntxt->surfaces[s]->show_version = -1;
+
+        return 0;
+
+    case ACTION_FLASH:
+        // full on decaying from press, whatever the press length
+        if(pressed) {
+            control = control_begin(&kntxt->controls);
+            control->flashes += 1;
+            control_commit(&kntxt->controls, control);
+            trigger_fire(&kntxt->trigger);
         }
 
-        // segment configuration
-        if(ev->data.note.note == 100)
-            logger("[+] midi: configure segments 1");
+        midi_feedback(kntxt, ACTION_FLASH, 0, pressed ? APC_SOLID_100 : APC_SOLID_10, APC_FULLON_COLOR);
 
-        if(ev->data.note.note == 101)
-            logger("[+] midi: configure segments 2");
+        return 0;
 
-        if(ev->data.note.note == 102)
-            logger("[+] midi: configure segments 3");
+    case ACTION_FULLON:
+        // full on enabled while pressed
+        control = control_begin(&kntxt->controls);
+        control->fullon = pressed;
+        control_commit(&kntxt->controls, control);
+        trigger_fire(&kntxt->trigger);
 
-        if(ev->data.note.note == 103)
-            logger("[+] midi: configure segments 4");
+        midi_feedback(kntxt, ACTION_FULLON, 0, pressed ? APC_SOLID_100 : APC_SOLID_10, APC_FULLON_COLOR);
 
-        pthread_mutex_unlock(&kntxt->lock);
+        return 0;
 
-    }
+    case ACTION_STRIP:
+        // strip color channel cut
+        if(!pressed || argument > 2)
+            return 0;
 
-    if(ev->type == SND_SEQ_EVENT_NOTEOFF) {
-        // logger("[+] midi: note off, note: %d", ev->data.note.note);
+        control = control_begin(&kntxt->controls);
+        control->strip_rgb[argument] = control->strip_rgb[argument] ? 0 : 255;
 
-        // full on disabled
-        if(ev->data.note.note == 0x06) {
-            pthread_mutex_lock(&kntxt->lock);
-            kntxt->fullon = 0;
-            pthread_mutex_unlock(&kntxt->lock);
+        uint8_t cut = control->strip_rgb[argument];
+        control_commit(&kntxt->controls, control);
+
+        midi_feedback(kntxt, ACTION_STRIP, argument, cut ? APC_BLINK_1_8 : APC_SOLID_100, strip_colors[argument]);
+
+        return 0;
+
+    case ACTION_SEGMENT:
+        // segment configuration, while button is held
+        if(argument >= GROUPS_TOTAL)
+            return 0;
 
-            midi_set_control(seq, APC_SOLID_10, 0x06, APC_FULLON_COLOR);
+        if(pressed) {
+            logger("[+] midi: configure segment %d, presets pads are bars", argument + 1);
+            kntxt->grouping = argument + 1;
+
+        } else if(kntxt->grouping == argument + 1) {
+            kntxt->grouping = 0;
+
+        } else {
+            return 0;
         }
-    }
 
-    if(ev->type == SND_SEQ_EVENT_CONTROLLER) {
-        // logger("[+] midi: fader: param: %d, value: %d", ev->data.control.param, ev->data.control.value);
+        // presets pads (and segment button) redrawn on every surface
+        for(int s = 0; s < kntxt->surfaces_total; s++)
+            kntxt->surfaces[s]->show_version = -1;
+
+        return 0;
+
+    case ACTION_SLIDER:
+        if(argument >= kntxt->midi.lines)
+            return 0;
 
         pthread_mutex_lock(&kntxt->lock);
+        kntxt->midi.sliders[argument].value = midi_value_parser(value);
+        pthread_mutex_unlock(&kntxt->lock);
+
+        break;
 
-        if(ev->data.control.param > 47 && ev->data.control.param < 56)
-            kntxt->midi.sliders[ev->data.control.param - 48].value = midi_value_parser(ev->data.control.value);
+    case ACTION_OPACITY:
+        // layer fader, in stack order
+        pthread_mutex_lock(&kntxt->lock);
 
-        // master channel
-        if(ev->data.control.param == 56)
-            kntxt->midi.master = midi_value_parser(ev->data.control.value);
+        if(argument < kntxt->layers_total)
+            kntxt->layers[argument].opacity = midi_value_parser(value);
 
         pthread_mutex_unlock(&kntxt->lock);
+
+        return 0;
+
+    case ACTION_MASTER:
+        // master channel, published with sliders
+        break;
+
+    default:
+        return 0;
     }
 
+    uint8_t sliders[RECORD_SLIDERS] = {0};
+
     pthread_mutex_lock(&kntxt->lock);
 
     if(kntxt->midi.sliders[7].value > 0) {
         kntxt->speed = (1000000 / kntxt->midi.sliders[7].value);
 
     } else {
-        kntxt->speed = 1000000 / TARGET_FPS;
+        kntxt->speed = kntxt->defspeed;
     }
 
+    for(int i = 0; i < RECORD_SLIDERS && i < kntxt->midi.lines; i++)
+        sliders[i] = kntxt->midi.sliders[i].value;
+
+    pthread_mutex_unlock(&kntxt->lock);
+
+    // publishing output settings, main lock not held
+    control = control_begin(&kntxt->controls);
+    memcpy(control->sliders, sliders, sizeof(control->sliders));
+
+    if(binding->action == ACTION_MASTER)
+        control->master = midi_value_parser(value);
+
     // apply strobe value
-    kntxt->strobe = kntxt->midi.sliders[6].value;
-    kntxt->strobe_duration = kntxt->midi.sliders[5].value;
+    control->strobe = sliders[6];
+    control->strobe_duty = sliders[5];
+
+    control_commit(&kntxt->controls, control);
+
+    return 0;
+}
+
+void *midi_no_interface(kntxt_t *kntxt) {
+    // force segments to full
+    for(int i = 0; i < GROUPS_TOTAL; i++)
+        kntxt->midi.sliders[i].value = 255;
+
+    // force master and segments to full
+    control_t *control = control_begin(&kntxt->controls);
+
+    control->master = 255;
+    memset(control->sliders, 255, GROUPS_TOTAL);
+
+    control_commit(&kntxt->controls, control);
+
+    return NULL;
+}
+
+void midi_refresh_feedback(kntxt_t *kntxt, surface_t *surface) {
+    padqueue_t *leds = &surface->leds;
+
+    surface->show_version = kntxt->show_version;
+
+    control_t *control = control_enter(&kntxt->controls, THREAD_MIDI);
+    uint8_t blackout = control->blackout;
+    uint8_t strobe_mode = control->strobe_mode;
+    uint8_t strip_rgb[3];
+    uint8_t bargroups[SEGMENTS];
+
+    memcpy(strip_rgb, control->strip_rgb, sizeof(strip_rgb));
+    memcpy(bargroups, control->bargroups, sizeof(bargroups));
+    control_leave(&kntxt->controls, THREAD_MIDI);
+
+    // reset all leds
+    for(int i = 0; i < APC_NOTES; i++)
+        if(surface->clears[i])
+            midi_set_control(leds, APC_SOLID_10, i, APC_COLOR_BLACK);
+
+    // restore current state, only on this surface
+    for(int note = 0; note < SURFACE_CONTROL; note++) {
+        binding_t *binding = &surface->dispatch[note];
+        uint8_t argument = binding->argument;
+
+        switch(binding->action) {
+        case ACTION_PRESET:
+            // editing a segment, pads show its bars
+            if(kntxt->grouping && argument < SEGMENTS) {
+                uint8_t member = bargroups[argument] & (1 << (kntxt->grouping - 1));
+                midi_set_control(leds, member ? APC_SOLID_100 : APC_SOLID_10, note, member ? APC_COLOR_GREEN : APC_COLOR_WHITE);
+                break;
+            }
+
+            if(argument < kntxt->presets_total && kntxt->presets[argument]) {
+                int selected = (kntxt->presets[argument] == kntxt->preset);
+                midi_set_control(leds, selected ? APC_PULSE_1_4 : APC_SOLID_100, note, APC_PRESETS_COLOR);
+            }
+            break;
+
+        case ACTION_MASK:
+            if(argument < kntxt->masks_total && kntxt->masks[argument]) {
+                int selected = (kntxt->masks[argument] == kntxt->mask);
+                midi_set_control(leds, selected ? APC_PULSE_1_4 : APC_SOLID_100, note, APC_MASKS_COLOR);
+            }
+            break;
+
+        case ACTION_MASK_RESET:
+            midi_set_control(leds, APC_SINGLE_MODE, note, kntxt->mask ? APC_SINGLE_ON : APC_SINGLE_OFF);
+            break;
 
-    if(kntxt->strobe == 0) {
-        kntxt->strobe_index = 0;
-        kntxt->strobe_state = 0;
-    }
+        case ACTION_SEGMENT:
+            midi_set_control(leds, APC_SINGLE_MODE, note, (kntxt->grouping == argument + 1) ? APC_SINGLE_ON : APC_SINGLE_OFF);
+            break;
 
-    pthread_mutex_unlock(&kntxt->lock);
+        case ACTION_STROBE:
+            midi_set_control(leds, APC_SINGLE_MODE, note, (strobe_mode == argument) ? APC_SINGLE_ON : APC_SINGLE_OFF);
+            break;
 
-    return 0;
-}
+        case ACTION_BLACKOUT:
+            midi_set_control(leds, blackout ? APC_BLINK_1_24 : APC_SOLID_100, note, APC_BLACKOUT_COLOR);
+            break;
 
-void *midi_no_interface(kntxt_t *kntxt) {
-    // force master to full
-    kntxt->midi.master = 255;
+        case ACTION_FULLON:
+        case ACTION_FLASH:
+            midi_set_control(leds, APC_SOLID_10, note, APC_FULLON_COLOR);
+            break;
 
-    // force segments to full
-    kntxt->midi.sliders[0].value = 255;
-    kntxt->midi.sliders[1].value = 255;
-    kntxt->midi.sliders[2].value = 255;
+        case ACTION_STRIP:
+            if(argument < 3) {
+                uint8_t mode = strip_rgb[argument] ? APC_BLINK_1_8 : APC_SOLID_100;
+                midi_set_control(leds, mode, note, strip_colors[argument]);
+            }
+            break;
+        }
+    }
+}
 
-    return NULL;
+void midi_initialize_feedback(kntxt_t *kntxt, surface_t *surface) {
+    // forget previous surface state, everything will be sent
+    midi_controls_invalidate(&surface->leds);
+    midi_refresh_feedback(kntxt, surface);
 }
 
-snd_seq_t *midi_initialize_interface(kntxt_t *kntxt) {
+snd_seq_t *midi_initialize_interface(kntxt_t *kntxt, surface_t *surface) {
     snd_seq_t *seq;
-    snd_seq_addr_t *ports;
+    snd_seq_addr_t port;
     int err;
 
     // prepare device link
@@ -1170,149 +6460,307 @@ snd_seq_t *midi_initialize_interface(kntxt_t *kntxt) {
     if((err = snd_seq_create_simple_port(seq, "midi-dmx", caps, type)) < 0)
         diea("create: simple port", err);
 
-    if(!(ports = calloc(sizeof(snd_seq_addr_t), 1)))
-        diep("ports: calloc");
-
-    // hardcoded keyboard port
-    if((err = snd_seq_parse_address(seq, &ports[0], "APC mini mk2")) < 0) {
-        logger("[-] midi: parse address: %s", snd_strerror(err));
+    // keyboard port from surface profile
+    if((err = snd_seq_parse_address(seq, &port, surface->port)) < 0) {
+        logger("[-] midi: %s: parse address: %s", surface->name, snd_strerror(err));
         snd_seq_close(seq);
-        // return midi_no_interface(kntxt);
         return NULL;
     }
 
-    if((err = snd_seq_connect_from(seq, 0, ports[0].client, ports[0].port)) < 0) {
-        logger("[-] midi: connect from: %s", snd_strerror(err));
+    if((err = snd_seq_connect_from(seq, 0, port.client, port.port)) < 0) {
+        logger("[-] midi: %s: connect from: %s", surface->name, snd_strerror(err));
         snd_seq_close(seq);
-        // return midi_no_interface(kntxt);
         return NULL;
     }
 
-    if((err = snd_seq_connect_to(seq, 0, ports[0].client, ports[0].port)) < 0) {
-        logger("[-] midi: connect to: %s", snd_strerror(err));
+    if(surface->feedback) {
+        if((err = snd_seq_connect_to(seq, 0, port.client, port.port)) < 0) {
+            logger("[-] midi: %s: connect to: %s", surface->name, snd_strerror(err));
+        }
     }
 
-    kntxt->interface = 1;
+    surface->interface = 1;
 
     // prepare device light states
+    pthread_mutex_lock(&kntxt->lock);
+    midi_initialize_feedback(kntxt, surface);
+    pthread_mutex_unlock(&kntxt->lock);
 
-    //
-    // presets
-    //
-    uint8_t hardcode_presets[] = {
-        0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,
-        0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
-        0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,
-    };
-
-    memcpy(kntxt->midi.presets, &hardcode_presets, sizeof(hardcode_presets));
+    // pads only written once each, with final state
+    int updated = 0;
+    if(surface->feedback)
+        updated = midi_flush_controls(seq, &surface->leds);
 
-    //
-    // masks
-    //
-    uint8_t hardcode_masks[] = {
-        0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,
-        0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
-        0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
-    };
+    logger("[+] midi: %s: interface initialized (%d leds updated)", surface->name, updated);
 
-    memcpy(kntxt->midi.masks, &hardcode_masks, sizeof(hardcode_masks));
+    return seq;
 
-    // reset all leds
-    for(int i = 0; i < 64; i++)
-        midi_set_control(seq, APC_SOLID_10, i, APC_COLOR_BLACK);
+}
 
-    for(int i = 0x64; i < 0x6b; i++)
-        midi_set_control(seq, APC_SOLID_10, i, APC_COLOR_BLACK);
+void *thread_midi(void *extra) {
+    kntxt_t *kntxt = (kntxt_t *) extra;
+    struct pollfd *pfds = NULL;
+    int err;
 
-    for(int i = 0x70; i < 0x7a; i++)
-        midi_set_control(seq, APC_SOLID_10, i, APC_COLOR_BLACK);
+    // polling events
+    while(kntxt->keepgoing) {
+        snd_seq_event_t *event;
+        int npfds = 0;
 
-    // set blackout default
-    midi_set_control(seq, APC_SOLID_100, 0x07, APC_BLACKOUT_COLOR);
+        // (re)connect missing surfaces and collect their descriptors
+        for(int s = 0; s < kntxt->surfaces_total; s++) {
+            surface_t *surface = kntxt->surfaces[s];
 
-    // set fullon default
-    midi_set_control(seq, APC_SOLID_10, 0x06, APC_FULLON_COLOR);
+            if(surface->interface != 1) {
+                // do not hammer the sequencer for missing surfaces
+                time_t now = time(NULL);
+                if(surface->retried == now)
+                    continue;
 
-    // set red, green, blue channel cut
-    midi_set_control(seq, APC_SOLID_100, 0x00, APC_COLOR_RED);
-    midi_set_control(seq, APC_SOLID_100, 0x01, APC_COLOR_GREEN);
-    midi_set_control(seq, APC_SOLID_100, 0x02, APC_COLOR_BLUE);
+                surface->retried = now;
 
-    // set presets pad colors
-    for(int i = 0; i < kntxt->presets_total; i++)
-        if(kntxt->presets[i])
-            midi_set_control(seq, APC_SOLID_100, kntxt->midi.presets[i], APC_PRESETS_COLOR);
+                if(!(surface->seq = midi_initialize_interface(kntxt, surface)))
+                    continue;
+            }
 
-    // set masks pad colors
-    for(int i = 0; i < kntxt->masks_total; i++)
-        if(kntxt->masks[i])
-            midi_set_control(seq, APC_SOLID_100, kntxt->midi.masks[i], APC_MASKS_COLOR);
+            int count = snd_seq_poll_descriptors_count(surface->seq, POLLIN);
 
-    // set initial preset
-    midi_set_control(seq, APC_PULSE_1_4, kntxt->midi.presets[0], APC_PRESETS_COLOR);
+            if(!(pfds = realloc(pfds, sizeof(*pfds) * (npfds + count))))
+                diep("midi: realloc");
 
-    logger("[+] midi: interface initialized");
+            surface->pfds = npfds;
+            surface->npfds = snd_seq_poll_descriptors(surface->seq, &pfds[npfds], count, POLLIN);
+            npfds += surface->npfds;
+        }
 
-    return seq;
+        if(npfds == 0) {
+            usleep(20000);
+            continue;
+        }
 
-}
+        uint64_t polling = monotonic_ns();
+        int ready;
 
-void *thread_midi(void *extra) {
-    kntxt_t *kntxt = (kntxt_t *) extra;
-    snd_seq_t *seq = NULL;
-    struct pollfd *pfds;
-    int err;
-    int npfds;
+        if((ready = poll(pfds, npfds, 100)) < 0)
+            diep("poll");
 
-    npfds = snd_seq_poll_descriptors_count(seq, POLLIN);
-    pfds = calloc(sizeof(*pfds), npfds);
+        // only timeouts tell how late the thread is woken up
+        if(ready == 0)
+            wakeup_record(&kntxt->wakeups[THREAD_MIDI], monotonic_ns() - polling - 100000000);
 
-    // polling events
-    while(kntxt->keepgoing) {
-        snd_seq_event_t *event;
+        for(int s = 0; s < kntxt->surfaces_total; s++) {
+            surface_t *surface = kntxt->surfaces[s];
+            snd_seq_t *seq = surface->seq;
 
-        if(kntxt->interface != 1) {
-            if(!(seq = midi_initialize_interface(kntxt))) {
-                usleep(20000);
+            if(surface->interface != 1)
                 continue;
+
+            unsigned short evid;
+            if(snd_seq_poll_descriptors_revents(seq, &pfds[surface->pfds], surface->npfds, &evid) == 0) {
+                // logger(">> processing %d", evid);
             }
-        }
 
-        snd_seq_poll_descriptors(seq, pfds, npfds, POLLIN);
-        if(poll(pfds, npfds, 100) < 0)
-            diep("poll");
+            int pending = snd_seq_event_input_pending(seq, 1);
 
-        unsigned short evid;
-        if(snd_seq_poll_descriptors_revents(seq, pfds, npfds, &evid) == 0) {
-            // logger(">> processing %d", evid);
-        }
+            // handle all buffered events before flushing leds feedback
+            while(pending > 0 && (err = snd_seq_event_input(seq, &event)) >= 0) {
+                pending = err;
 
-        int pending = snd_seq_event_input_pending(seq, 1);
-        if(pending == 0)
-            continue;
+                if(!event)
+                    continue;
 
-        if((err = snd_seq_event_input(seq, &event)) > 0) {
-            if(event) {
                 if(event->type == SND_SEQ_EVENT_PORT_UNSUBSCRIBED) {
-                    logger("[-] midi: interface disconnected, closing session");
+                    logger("[-] midi: %s: interface disconnected, closing session", surface->name);
 
                     snd_seq_close(seq);
-                    kntxt->interface = 2;
+                    surface->seq = NULL;
+                    surface->interface = 2;
 
-                    continue;
+                    break;
                 }
 
-                midi_handle_event(event, kntxt, seq);
+                midi_handle_event(event, kntxt, surface);
             }
         }
+
+        // send pending leds changes of this cycle at once, feedback
+        // of one surface can change leds on all of them
+        for(int s = 0; s < kntxt->surfaces_total; s++) {
+            surface_t *surface = kntxt->surfaces[s];
+
+            // show reloaded, slots could have changed
+            pthread_mutex_lock(&kntxt->lock);
+            if(surface->show_version != kntxt->show_version)
+                midi_refresh_feedback(kntxt, surface);
+            pthread_mutex_unlock(&kntxt->lock);
+
+            if(surface->interface == 1 && surface->feedback)
+                midi_flush_controls(surface->seq, &surface->leds);
+        }
     }
 
-    snd_seq_close(seq);
+    for(int s = 0; s < kntxt->surfaces_total; s++)
+        if(kntxt->surfaces[s]->seq)
+            snd_seq_close(kntxt->surfaces[s]->seq);
+
+    free(pfds);
+
+    return NULL;
+}
 
+//
+// real-time profile
+//
+// optional scheduling profile, per thread policy, priority and cpus,
+// anything not permitted is reported and left to default scheduling
+//
+// profile syntax, one statement per line, # for comments:
+//   lock memory
+//   thread <name> <other|fifo|rr> <priority> [cpus]   (cpus: 0-1,3)
+//
+void *rterr(char *path, int line, char *str) {
+    fprintf(stderr, "realtime: %s: line %d: %s\n", path, line, str);
     return NULL;
 }
 
+static int realtime_cpus_parse(char *list, cpu_set_t *cpus) {
+    char *saveptr, *range;
+
+    CPU_ZERO(cpus);
+
+    for(range = strtok_r(list, ",", &saveptr); range; range = strtok_r(NULL, ",", &saveptr)) {
+        char *dash = strchr(range, '-');
+        int first = atoi(range);
+        int last = dash ? atoi(dash + 1) : first;
+
+        if(first < 0 || last < first || last >= CPU_SETSIZE)
+            return -1;
+
+        for(int cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, cpus);
+    }
+
+    return CPU_COUNT(cpus) ? 0 : -1;
+}
+
+realtime_t *realtime_loadfile(char *path) {
+    realtime_t *realtime;
+    char buffer[256];
+    FILE *fp;
+    int line = 0;
+
+    if(!(fp = fopen(path, "r")))
+        dieptr(path);
+
+    if(!(realtime = calloc(sizeof(realtime_t), 1)))
+        diep("calloc");
+
+    while(fgets(buffer, sizeof(buffer), fp)) {
+        char *key, *value, *saveptr;
+        char *args[4] = {NULL, NULL, NULL, NULL};
+
+        line += 1;
+
+        if((value = strchr(buffer, '#')))
+            *value = '\0';
+
+        if(!(key = strtok_r(buffer, " \t\r\n", &saveptr)))
+            continue;
+
+        for(int i = 0; i < 4; i++)
+            args[i] = strtok_r(NULL, " \t\r\n", &saveptr);
+
+        if(strcmp(key, "lock") == 0 && args[0] && strcmp(args[0], "memory") == 0) {
+            realtime->lockall = 1;
+            continue;
+        }
+
+        if(strcmp(key, "thread") != 0 || !args[0] || !args[1] || !args[2]) {
+            fclose(fp);
+            free(realtime);
+            return rterr(path, line, "invalid statement");
+        }
+
+        int index = 0;
+        while(index < THREADS_TOTAL && strcmp(thread_names[index], args[0]) != 0)
+            index += 1;
+
+        if(index == THREADS_TOTAL) {
+            fclose(fp);
+            free(realtime);
+            return rterr(path, line, "unknown thread");
+        }
+
+        rtthread_t *thread = &realtime->threads[index];
+        thread->priority = atoi(args[2]);
+
+        if(strcmp(args[1], "other") == 0) {
+            thread->policy = SCHED_OTHER;
+
+        } else if(strcmp(args[1], "fifo") == 0) {
+            thread->policy = SCHED_FIFO;
+
+        } else if(strcmp(args[1], "rr") == 0) {
+            thread->policy = SCHED_RR;
+
+        } else {
+            fclose(fp);
+            free(realtime);
+            return rterr(path, line, "unknown policy");
+        }
+
+        int minimum = sched_get_priority_min(thread->policy);
+        int maximum = sched_get_priority_max(thread->policy);
+
+        if(thread->priority < minimum || thread->priority > maximum) {
+            fclose(fp);
+            free(realtime);
+            return rterr(path, line, "priority out of policy range");
+        }
+
+        if(args[3] && realtime_cpus_parse(args[3], &thread->cpus) < 0) {
+            fclose(fp);
+            free(realtime);
+            return rterr(path, line, "invalid cpus list");
+        }
+
+        thread->pinned = (args[3] != NULL);
+        thread->configured = 1;
+    }
+
+    fclose(fp);
+
+    return realtime;
+}
+
+void realtime_lock(realtime_t *realtime) {
+    if(!realtime || !realtime->lockall)
+        return;
+
+    // nothing paged out, including memory allocated later
+    if(mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        printf("[-] realtime: mlockall: %s, memory not locked\n", strerror(errno));
+        return;
+    }
+
+    printf("[+] realtime: process memory locked\n");
+}
+
+void realtime_apply(realtime_t *realtime, int index, pthread_t handle) {
+    if(!realtime || !realtime->threads[index].configured)
+        return;
+
+    rtthread_t *thread = &realtime->threads[index];
+    struct sched_param param = {.sched_priority = thread->priority};
+    int err;
+
+    if((err = pthread_setschedparam(handle, thread->policy, &param)))
+        printf("[-] realtime: %s: scheduling: %s, using default\n", thread_names[index], strerror(err));
+
+    if(thread->pinned && (err = pthread_setaffinity_np(handle, sizeof(cpu_set_t), &thread->cpus)))
+        printf("[-] realtime: %s: affinity: %s, running on any cpu\n", thread_names[index], strerror(err));
+}
+
 //
 // console management
 //
@@ -1462,46 +6910,86 @@ void *thread_console(void *extra) {
 
         float speedfps = 1000000.0 / kntxt->speed;
 
+        control_t *control = control_enter(&kntxt->controls, THREAD_CONSOLE);
+
         console_cursor_move(upper + 1, 2);
-        if(kntxt->blackout) {
-            printf("Master: %3d %s", kntxt->midi.master, CBAD(" BLACKOUT ENABLED "));
+        if(control->blackout) {
+            printf("Master: %3d %s", control->master, CBAD(" BLACKOUT ENABLED "));
 
         } else {
-            printf("Master: %3d %-18s", kntxt->midi.master, "");
+            printf("Master: %3d %-18s", control->master, "");
         }
 
         console_cursor_move(upper + 2, 2);
-        printf("Strobe: %s ", kntxt->strobe ? COK(" on ") : CNULL(" off "));
+        printf("Strobe: %s ", control->strobe ? COK(" on ") : CNULL(" off "));
 
         console_cursor_move(upper + 2, 14);
-        printf(" | refresh %3d / flash %03d / index %3d", kntxt->strobe, kntxt->strobe_duration, kntxt->strobe_index);
+        printf(" | %4.1f Hz / duty %2.0f%% / %-6s / version %-6lu", strobe_rate(control->strobe), strobe_duty(control->strobe_duty) * 100, strobe_names[control->strobe_mode], control->version);
+
+        // segments of each bar, * for more than one
+        char groups[SEGMENTS + 1] = {0};
+
+        for(int bar = 0; bar < SEGMENTS; bar++) {
+            uint8_t mask = control->bargroups[bar];
+
+            groups[bar] = '-';
+            if(mask)
+                groups[bar] = (mask & (mask - 1)) ? '*' : '1' + __builtin_ctz(mask);
+        }
+
+        control_leave(&kntxt->controls, THREAD_CONSOLE);
 
         console_cursor_move(upper + 3, 2);
         printf("Speed : % 4d [%.1f fps] %-10s", kntxt->speed, speedfps, "");
 
-        console_cursor_move(upper + 5, 2);
-        if(kntxt->interface == 0) {
-            printf("Interface: %s %-10s", CBAD(" offline "), "");
+        console_cursor_move(upper + 3, 40);
+        printf("| Segments: %s%s", groups, kntxt->grouping ? " (editing)" : "          ");
 
-        } else if(kntxt->interface == 1) {
-            printf("Interface: %s %-10s", COK(" online "), "");
+        console_cursor_move(upper + 4, 2);
+        printf("Layers: %d [", kntxt->layers_total);
+        for(int i = 0; i < kntxt->layers_total; i++)
+            printf(" %s %3d", blend_names[kntxt->layers[i].blend], kntxt->layers[i].opacity);
+        printf(" ] %-10s", "");
 
-        } else if(kntxt->interface == 2) {
-            printf("Interface: %s %-10s", CBAD("  lost  "), "");
+        // two lines available for surfaces status
+        for(int i = 0; i < 2; i++) {
+            console_cursor_move(upper + 5 + i, 2);
 
-        } else {
-            printf("Interface: %s %-10s", CWAIT(" unknown "), "");
+            if(i >= kntxt->surfaces_total) {
+                printf("%-40s", "");
+                continue;
+            }
 
-        }
+            surface_t *surface = kntxt->surfaces[i];
+            char *name = surface->name;
+
+            if(i == 1 && kntxt->surfaces_total > 2)
+                name = "(more surfaces)";
+
+            if(surface->interface == 0) {
+                printf("Interface: %s %-24.24s", CBAD(" offline "), name);
+
+            } else if(surface->interface == 1) {
+                printf("Interface: %s %-24.24s", COK(" online "), name);
 
-        // printf("Interface: %s %-10s", kntxt->interface ? COK(" online ") : CBAD(" offline "), "");
+            } else if(surface->interface == 2) {
+                printf("Interface: %s %-24.24s", CBAD("  lost  "), name);
+
+            } else {
+                printf("Interface: %s %-24.24s", CWAIT(" unknown "), name);
+
+            }
+        }
 
         console_cursor_move(upper + 7, 2);
-        printf("Preset: %-40s", kntxt->preset);
+        printf("Preset: %-40s", kntxt->preset ? kntxt->preset : "---");
 
         console_cursor_move(upper + 8, 2);
         printf("Mask  : %-40s", kntxt->mask ? kntxt->mask : "---");
 
+        console_cursor_move(upper + 9, 2);
+        printf("Show  : %-40.40s", kntxt->show->name);
+
         //
         // controller and client statistics
         //
@@ -1527,7 +7015,7 @@ void *thread_console(void *extra) {
             printf("Last seen: %s %-10s", CWAIT(" waiting "), "");
 
         } else {
-            printf("Last seen: %.2f seconds ago %-10s", lastping, "");
+            printf("Last seen: %.2f seconds ago | send rate %.1f fps %-10s", lastping, client->rate, "");
         }
 
 
@@ -1537,63 +7025,96 @@ void *thread_console(void *extra) {
         if(controller->fps < 20)
             sprintf(strfps, CWARN "%2lu fps" CRST, controller->fps);
 
+        linkwindow_t *windows = client->windows;
+
+        console_cursor_move(upper + 2, 2);
+        printf("Loss 1s/10s/all: %.1f %.1f %.1f%% | rtt %u/%u us | reboots %lu%-4s",
+            windows[0].lossrate, windows[1].lossrate, windows[2].lossrate,
+            windows[1].rtt_average, windows[1].rtt_maximum, client->reboots, "");
+
         console_cursor_move(upper + 3, 2);
         printf("Frames displayed: % 6ld, %s", client->showframes, strfps);
         printf(" | Total frames: % 6ld", controller->frames);
 
         console_cursor_move(upper + 4, 2);
-        printf("Frames committed: % 6ld, dropped: %lu [%.1f%%]", client->frames, client->dropped, client->droprate);
+        printf("Frames committed: % 6ld, dropped: %lu [%.1f%%], reordered: %lu", client->frames, client->dropped, client->droprate, windows[2].reordered);
+
+        if(!frame_checksums) {
+            printf(" | checksum off%-20s", "");
+
+        } else if(controller->integrity_errors || client->mismatches) {
+            printf(" | checksum " CWARN "errors %u, mismatches %lu" CRST "%-4s", controller->integrity_errors, client->mismatches, "");
+
+        } else {
+            printf(" | checksum " CGOOD "%u verified" CRST "%-10s", controller->integrity_checked, "");
+        }
 
         /*
         if(client->frames > 200)
             kntxt->keepgoing = 0;
         */
 
-        console_cursor_move(upper + 6, 2);
-        printf("Controler uptime: %s / %.4f ms", ctrlup, client->time_transform * 1000);
+        console_cursor_move(upper + 5, 2);
+        printf("Wakeup late (avg/max us):");
 
-        console_cursor_move(upper + 7, 2);
-        printf("Interface uptime: %s", sessup);
+        int wakeups[] = {THREAD_NETSEND, THREAD_ANIMATE, THREAD_MIDI};
 
-        free(sessup);
-        free(ctrlup);
+        for(int i = 0; i < 3; i++) {
+            wakeup_t *wakeup = &kntxt->wakeups[wakeups[i]];
+            uint64_t average = wakeup->count ? wakeup->total / wakeup->count : 0;
 
-        // FIXME: stop repeating yourself
-        console_cursor_move(upper + 0, 80);
+            printf(" %s %lu/%lu", thread_names[wakeups[i]], average / 1000, wakeup->max / 1000);
+        }
 
-        float psuv = controller->psu0_volt / 100.0;
-        float psua = controller->psu0_amps / 100.0;
-        int psuw = psuv * psua;
+        printf("%-6s", "");
 
-        printf("| PSU 1: % 4.1f v - % 4.2f A - % 4d w", psuv, psua, psuw);
+        console_cursor_move(upper + 6, 2);
+        printf("Controler uptime: %s / %.4f ms", ctrlup, client->time_transform * 1000);
 
-        console_cursor_move(upper + 1, 80);
+        console_cursor_move(upper + 7, 2);
+        printf("Interface uptime: %s", sessup);
 
-        psuv = controller->psu1_volt / 100.0;
-        psua = controller->psu1_amps / 100.0;
-        psuw = psuv * psua;
+        wakeup_t *latency = &kntxt->trigger.latency;
+        uint64_t bumpavg = latency->count ? latency->total / latency->count : 0;
+        printf(" | Bump to packet (last/avg/max us): %lu/%lu/%lu%-6s", latency->last / 1000, bumpavg / 1000, latency->max / 1000, "");
 
-        printf("| PSU 2: % 4.1f v - % 4.2f A - % 4d w", psuv, psua, psuw);
+        free(sessup);
+        free(ctrlup);
 
-        console_cursor_move(upper + 2, 80);
+        // forwarded metrics frames are newer than heartbeat, when coming
+        power_stats_t *power = &kntxt->power;
+        int live = power->last && monotonic_ns() / 1000 - power->last < POWER_WINDOW;
 
-        psuv = controller->psu2_volt / 100.0;
-        psua = controller->psu2_amps / 100.0;
-        psuw = psuv * psua;
+        for(int i = 0; i < FEEDBACK_PSUS; i++) {
+            float psuv = controller->psu_volts[i] / 100.0;
+            float psua = (live ? power->amps[i] : controller->psu_amps[i]) / 100.0;
+            float peak = (live ? power->peak[i] : controller->psu_amps[i]) / 100.0;
+            int psuw = psuv * psua;
 
-        printf("| PSU 3: % 4.1f v - % 4.2f A - % 4d w", psuv, psua, psuw);
+            console_cursor_move(upper + i, 80);
+            printf("| PSU %d: % 4.1f v - % 4.2f A (peak % 4.2f) - % 4d w", i + 1, psuv, psua, peak, psuw);
+        }
 
         console_cursor_move(upper + 3, 80);
-        printf("| Main : % 4.1f v", controller->main_ac_voltage / 100.0);
+        printf("| Main : % 4.1f v | show %u/%u us, busy %u", controller->main_ac_voltage / 100.0,
+            controller->show_last, controller->show_max, controller->busy);
 
         console_cursor_move(upper + 4, 80);
-        printf("| ");
+        if(kntxt->recorder) {
+            recorder_t *recorder = kntxt->recorder;
+            printf("| Rec  : %6lu frames - %.1f MB - %lu dropped%s", recorder->frames,
+                recorder->written / 1048576.0, (unsigned long) recorder->dropped, recorder->failed ? " (failed)" : "");
+
+        } else {
+            printf("| Rec  : off");
+        }
 
         console_cursor_move(upper + 5, 80);
         printf("| Core : % 4.1f°C - % 4.1f°C", controller->main_core_temperature / 100.0, controller->mon_core_temperature / 100.0);
 
         console_cursor_move(upper + 6, 80);
-        printf("| Power: % 4.1f°C", controller->ext_power_temperature / 100.0);
+        printf("| Power: % 4.1f°C | metrics %u frames, %u errors, %lu live (%lu missing, %u ms)", controller->ext_power_temperature / 100.0,
+            controller->telemetry_frames, controller->telemetry_errors, power->received, power->missing, power->age);
 
         console_cursor_move(upper + 7, 80);
         printf("| Ctrls: % 4.1f°C", controller->ext_compute_temperature / 100.0);
@@ -1601,9 +7122,6 @@ void *thread_console(void *extra) {
 
 
 
-        // we are done with main context
-        pthread_mutex_unlock(&kntxt->lock);
-
         //
         // presets list
         //
@@ -1614,6 +7132,9 @@ void *thread_console(void *extra) {
         //
         console_list_print(kntxt->masks, kntxt->masks_total, kntxt->mask, 41, 128);
 
+        // we are done with main context (lists belongs to show)
+        pthread_mutex_unlock(&kntxt->lock);
+
         //
         // last lines from logger (ring buffer)
         //
@@ -1650,12 +7171,39 @@ void *thread_console(void *extra) {
 //
 // initializer management
 //
+void shutdown_signal(int signum) {
+    (void) signum;
+
+    if(signaled)
+        signaled->keepgoing = 0;
+}
+
 void cleanup(kntxt_t *kntxt) {
     // master cleaner to check memory sanity (with, eg. valgrind)
-    free(kntxt->pixels);
-    free(kntxt->monitor);
+    munmap(arena.base, arena.size);
+
+    // FIXME: midi, ...
+
+    for(int i = 0; i < kntxt->surfaces_total; i++)
+        surface_free(kntxt->surfaces[i]);
+
+    show_free(kntxt->show);
+
+    // last chunk is flushed and file closed by recorder thread
+    if(kntxt->recorder) {
+        pthread_join(kntxt->recorder->thread, NULL);
+        recorder_free(kntxt->recorder);
+    }
 
-    // FIXME: preview, midi, ...
+    // pending samples are written and history closed by metrics thread
+    if(kntxt->metrics->started)
+        pthread_join(kntxt->metrics->thread, NULL);
+    else if(kntxt->metrics->fp)
+        fclose(kntxt->metrics->fp);
+
+    metrics_free(kntxt->metrics);
+
+    control_free(&kntxt->controls);
 
     for(int i = 0; i < LOGGER_SIZE; i++)
         free(mainlog.lines[i]);
@@ -1663,12 +7211,117 @@ void cleanup(kntxt_t *kntxt) {
     free(mainlog.lines);
 }
 
+void usage(char *name) {
+    fprintf(stderr, "Usage: %s [-b] [-r realtime-profile] [-w capture] [-m history] [-e port] [-c] [-s surface-profile] ... [show-file]\n", name);
+    fprintf(stderr, "       %s -p capture [-x speed] [-t controller] [-c]\n", name);
+    fprintf(stderr, "       %s -k cue-list -o baked-show\n", name);
+    fprintf(stderr, "       %s -d history\n", name);
+    fprintf(stderr, "  -s  control surface profile to use, can be repeated\n");
+    fprintf(stderr, "      (default: surfaces declared by the show)\n");
+    fprintf(stderr, "  -r  scheduling profile (priorities, cpus, memory locking)\n");
+    fprintf(stderr, "  -b  benchmark checksum and layers compositing and exit\n");
+    fprintf(stderr, "  -w  record frames sent and control state to capture file\n");
+    fprintf(stderr, "  -p  replay capture file or baked show and exit\n");
+    fprintf(stderr, "  -x  replay speed factor, 0 for as fast as possible (default: 1)\n");
+    fprintf(stderr, "  -t  replay target controller (default: none, decoding only)\n");
+    fprintf(stderr, "  -k  render cue list offline to baked show file (-o) and exit\n");
+    fprintf(stderr, "  -m  append metrics history (one sample per second) to file\n");
+    fprintf(stderr, "  -d  dump metrics history as text (tab separated) and exit\n");
+    fprintf(stderr, "  -e  metrics endpoint port on localhost, 0 to disable (default: %d)\n", METRICS_PORT);
+    fprintf(stderr, "  -c  send frames without pixels checksum\n");
+    fprintf(stderr, "  show file defaults to: %s\n", SHOW_DEFAULT);
+    exit(EXIT_FAILURE);
+}
+
 int main(int argc, char *argv[]) {
-    (void) argc;
-    (void) argv;
+    char *profiles[SURFACE_MAXIMUM];
+    int profiles_total = 0;
+    char *showfile = SHOW_DEFAULT;
+    realtime_t *realtime = NULL;
+    char *capture = NULL, *replay = NULL, *target = NULL;
+    char *cues = NULL, *baked = NULL;
+    char *history = NULL, *dump = NULL;
+    int metrics_port = METRICS_PORT;
+    double speed = 1.0;
+    int option;
+
+    crc32c_init();
+
+    while((option = getopt(argc, argv, "br:s:w:p:x:t:k:o:m:d:e:ch")) != -1) {
+        switch(option) {
+        case 'b':
+            arena_init(ARENA_SIZE);
+            checksum_benchmark();
+            layers_benchmark();
+            render_benchmark();
+            exit(EXIT_SUCCESS);
+
+        case 's':
+            if(profiles_total == SURFACE_MAXIMUM) {
+                fprintf(stderr, "[-] too many surfaces (maximum %d)\n", SURFACE_MAXIMUM);
+                exit(EXIT_FAILURE);
+            }
+
+            profiles[profiles_total++] = optarg;
+            break;
+
+        case 'r':
+            if(!(realtime = realtime_loadfile(optarg)))
+                exit(EXIT_FAILURE);
+
+            break;
+
+        case 'w':
+            capture = optarg;
+            break;
+
+        case 'p':
+            replay = optarg;
+            break;
+
+        case 'x':
+            speed = atof(optarg);
+            break;
+
+        case 't':
+            target = optarg;
+            break;
+
+        case 'k':
+            cues = optarg;
+            break;
+
+        case 'o':
+            baked = optarg;
+            break;
+
+        case 'm':
+            history = optarg;
+            break;
+
+        case 'd':
+            dump = optarg;
+            break;
+
+        case 'e':
+            metrics_port = atoi(optarg);
+            break;
+
+        case 'c':
+            frame_checksums = 0;
+            break;
+
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if(optind < argc)
+        showfile = argv[optind];
 
     printf("[+] initializing stage-led controle interface\n");
-    pthread_t netsend, feedback, midi, console, animate, presets, masks;
+    pthread_t netsend, feedback, midi, console, animate, show;
+    pthread_t loaders[LOADER_WORKERS];
 
     // logger initializer
     memset(&mainlog, 0x00, sizeof(logger_t));
@@ -1676,6 +7329,24 @@ int main(int argc, char *argv[]) {
     mainlog.capacity = LOGGER_SIZE;
     mainlog.lines = (char **) calloc(sizeof(char *), mainlog.capacity);
 
+    if(dump)
+        exit(metrics_dump(dump) ? EXIT_FAILURE : EXIT_SUCCESS);
+
+    if(cues) {
+        if(!baked)
+            usage(argv[0]);
+
+        exit(bake_run(cues, baked) ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    if(replay) {
+        // playing in place of netsend, with its scheduling
+        realtime_lock(realtime);
+        realtime_apply(realtime, THREAD_NETSEND, pthread_self());
+
+        exit(replay_run(replay, speed, target) ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
     // create a local context
     kntxt_t mainctx;
     void *kntxt = &mainctx;
@@ -1684,91 +7355,126 @@ int main(int argc, char *argv[]) {
     memset(kntxt, 0x00, sizeof(kntxt_t));
 
     mainctx.keepgoing = 1;
+    mainctx.client.rate = TARGET_FPS;
 
-    mainctx.pixels = (pixel_t *) calloc(sizeof(pixel_t), LEDSTOTAL);
-    mainctx.maskpixels = (pixel_t *) calloc(sizeof(pixel_t), LEDSTOTAL);
-    mainctx.monitor = (pixel_t *) calloc(sizeof(pixel_t), LEDSTOTAL);
-    mainctx.preview = (pixel_t *) calloc(sizeof(pixel_t), LEDSTOTAL);
+    arena_init(ARENA_SIZE);
+
+    mainctx.pixels = arena_alloc(sizeof(pixel_t) * LEDSTOTAL);
+    mainctx.monitor = arena_alloc(sizeof(pixel_t) * LEDSTOTAL);
+    mainctx.preview = arena_alloc(sizeof(pixel_t) * LEDSTOTAL);
 
     mainctx.midi.lines = 8; // 8 channels
     mainctx.midi.sliders = calloc(sizeof(slider_t), mainctx.midi.lines);
-    mainctx.speed = 1000000 / TARGET_FPS;
-
-    mainctx.presets_total = 24;
-    mainctx.masks_total = 24;
-
-    mainctx.presets = calloc(sizeof(char *), mainctx.presets_total);
-    mainctx.masks = calloc(sizeof(char *), mainctx.masks_total);
-    mainctx.midi.presets = calloc(sizeof(uint8_t), mainctx.presets_total);
-    mainctx.midi.masks = calloc(sizeof(uint8_t), mainctx.masks_total);
-
-    // mainctx.presets[1] = "/home/maxux/git/stageled/templates/kermesse.png";
-    // mainctx.presets[2] = "/home/maxux/git/stageled/templates/spectre3.png";
-    // mainctx.presets[3] = "/home/maxux/git/stageled/templates/stan.png";
-    // mainctx.presets[4] = "/home/maxux/git/stageled/templates/spectre2.png";
-    // mainctx.presets[5] = "/home/maxux/git/stageled/templates/follow1.png";
-    // mainctx.presets[6] = "/home/maxux/git/stageled/templates/cedric.png";
-
-    int i = 0;
-    mainctx.presets[i++] = "debug.png";
-    mainctx.presets[i++] = "thunder-colors-1.png";
-    mainctx.presets[i++] = "thunder-colors-2.png";
-    mainctx.presets[i++] = "thunder-colors-3.png";
-    mainctx.presets[i++] = "thunder-test.png";
-    mainctx.presets[i++] = "linear-solid.png";
-
-    mainctx.presets[i++] = "rainbow.png";
-    mainctx.presets[i++] = "testku.png";
-    mainctx.presets[22] = "full-black.png";
-    mainctx.presets[23] = "full.png";
-
-    mainctx.preset = mainctx.presets[0];
-
-    i = 0;
-    mainctx.masks[i++] = "mask-diagonal.png";
-    mainctx.masks[i++] = "mask-holes.png";
-    mainctx.masks[i++] = "mask-thunder.png";
-    mainctx.masks[i++] = "mask-thunder-1.png";
-    mainctx.masks[i++] = "mask-thunder-2.png";
-    mainctx.masks[i++] = "mask-thunder-front-string.png";
-    mainctx.masks[i++] = "mask-thunder-full-string.png";
-    mainctx.masks[i++] = "mask-thunder-segment-smooth.png";
-    mainctx.masks[i++] = "mask-thunder-segment-smooth-2.png";
-    mainctx.masks[i++] = "mask-thunder-pattern-1.png";
-    mainctx.masks[i++] = "mask-thunder-pattern-2.png";
-    mainctx.masks[i++] = "mask-segments-roll.png";
-    mainctx.masks[i++] = "mask-smooth-cross.png";
+
+    pthread_mutex_init(&mainctx.lock, NULL);
+    pthread_rwlock_init(&mainctx.showlock, NULL);
+    control_init(&mainctx.controls);
+    trigger_init(&mainctx.trigger);
+
+    pthread_mutex_init(&mainctx.loader.lock, NULL);
+    pthread_cond_init(&mainctx.loader.wakeup, NULL);
+
+    for(int i = 0; i < LOADER_KINDS; i++)
+        mainctx.loader.pending[i] = -1;
+
+    // loading and decoding the show
+    printf("[+] loading show: %s\n", showfile);
+
+    show_t *initial;
+    if(!(initial = show_loadfile(showfile)))
+        exit(EXIT_FAILURE);
+
+    show_apply(kntxt, initial);
+    printf("[+] show loaded: %s\n", initial->name);
+
+    // loading control surfaces profiles, from command line or show
+    if(profiles_total == 0) {
+        for(int i = 0; i < initial->surfaces_total; i++)
+            profiles[profiles_total++] = initial->surfaces[i];
+    }
+
+    for(int i = 0; i < profiles_total; i++) {
+        surface_t *surface;
+
+        if(!(surface = surface_loadfile(profiles[i])))
+            exit(EXIT_FAILURE);
+
+        printf("[+] surface profile loaded: %s\n", surface->name);
+        mainctx.surfaces[mainctx.surfaces_total++] = surface;
+    }
+
+    // first available preset is the default one
+    for(int i = 0; i < mainctx.presets_total && !mainctx.preset; i++)
+        if(mainctx.presets[i])
+            mainctx.preset = mainctx.presets[i];
+
+    if(!mainctx.preset) {
+        fprintf(stderr, "[-] show: no preset available\n");
+        exit(EXIT_FAILURE);
+    }
 
     // loading default frame
-    mainctx.frame = frame_loadfile(mainctx.preset);
+    int index = list_index_search(mainctx.presets, mainctx.preset, mainctx.presets_total);
+    mainctx.frame = frame_share(initial->presets[index].frame);
+    loader_prefetch(kntxt, LOADER_PRESET, index);
 
-    pthread_mutex_init(&mainctx.lock, NULL);
-    pthread_cond_init(&mainctx.cond_presets, NULL);
-    pthread_cond_init(&mainctx.cond_masks, NULL);
+    if(capture) {
+        if(!(mainctx.recorder = recorder_open(capture)))
+            exit(EXIT_FAILURE);
+
+        printf("[+] recording output to: %s\n", capture);
+    }
+
+    if(!(mainctx.metrics = metrics_new(history, metrics_port)))
+        exit(EXIT_FAILURE);
+
+    // show is decoded, locking everything allocated so far
+    realtime_lock(realtime);
+
+    // stop signals only handled by main thread, threads never see EINTR
+    sigset_t stopping;
+    sigemptyset(&stopping);
+    sigaddset(&stopping, SIGINT);
+    sigaddset(&stopping, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopping, NULL);
 
     printf("[+] starting network dispatcher thread\n");
     if(pthread_create(&netsend, NULL, thread_netsend, kntxt))
         perror("thread: netsend");
 
+    realtime_apply(realtime, THREAD_NETSEND, netsend);
+
     printf("[+] starting controller feedback thread\n");
     if(pthread_create(&feedback, NULL, thread_feedback, kntxt))
         perror("thread: feedback");
 
+    realtime_apply(realtime, THREAD_FEEDBACK, feedback);
+
     printf("[+] starting midi mapping thread\n");
     if(pthread_create(&midi, NULL, thread_midi, kntxt))
         perror("thread: midi");
 
+    realtime_apply(realtime, THREAD_MIDI, midi);
+
     printf("[+] starting animator thread\n");
     if(pthread_create(&animate, NULL, thread_animate, kntxt))
         perror("thread: animate");
 
-    printf("[+] starting presets thread\n");
-    if(pthread_create(&presets, NULL, thread_presets, kntxt))
-        perror("thread: presets");
+    realtime_apply(realtime, THREAD_ANIMATE, animate);
 
-    printf("[+] starting masks thread\n");
-    if(pthread_create(&masks, NULL, thread_masks, kntxt))
-        perror("thread: masks");
+    printf("[+] starting %d loader threads\n", LOADER_WORKERS);
+    for(int i = 0; i < LOADER_WORKERS; i++) {
+        if(pthread_create(&loaders[i], NULL, thread_loader, kntxt))
+            perror("thread: loader");
+
+        realtime_apply(realtime, THREAD_LOADER, loaders[i]);
+    }
+
+    printf("[+] starting show watcher thread\n");
+    if(pthread_create(&show, NULL, thread_show, kntxt))
+        perror("thread: show");
+
+    realtime_apply(realtime, THREAD_SHOW, show);
 
     // starting console at the very end to keep screen clean
     // if some early error appears
@@ -1776,15 +7482,50 @@ int main(int argc, char *argv[]) {
     if(pthread_create(&console, NULL, thread_console, kntxt))
         perror("thread: console");
 
+    realtime_apply(realtime, THREAD_CONSOLE, console);
+
+    if(mainctx.recorder) {
+        printf("[+] starting output recorder thread\n");
+        if(pthread_create(&mainctx.recorder->thread, NULL, thread_recorder, kntxt))
+            perror("thread: recorder");
+
+        realtime_apply(realtime, THREAD_RECORDER, mainctx.recorder->thread);
+    }
+
+    printf("[+] starting metrics thread\n");
+    if(pthread_create(&mainctx.metrics->thread, NULL, thread_metrics, kntxt)) {
+        perror("thread: metrics");
+
+    } else {
+        mainctx.metrics->started = 1;
+        realtime_apply(realtime, THREAD_METRICS, mainctx.metrics->thread);
+    }
+
+    struct sigaction action = {.sa_handler = shutdown_signal};
+    sigemptyset(&action.sa_mask);
+
+    signaled = &mainctx;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    pthread_sigmask(SIG_UNBLOCK, &stopping, NULL);
+
     pthread_join(netsend, NULL);
     pthread_join(feedback, NULL);
     pthread_join(midi, NULL);
     pthread_join(animate, NULL);
-    pthread_join(presets, NULL);
-    pthread_join(masks, NULL);
+
+    // idle loaders are waiting for a request
+    pthread_mutex_lock(&mainctx.loader.lock);
+    pthread_cond_broadcast(&mainctx.loader.wakeup);
+    pthread_mutex_unlock(&mainctx.loader.lock);
+
+    for(int i = 0; i < LOADER_WORKERS; i++)
+        pthread_join(loaders[i], NULL);
+    pthread_join(show, NULL);
     pthread_join(console, NULL);
 
     cleanup(kntxt);
+    free(realtime);
 
     return 0;
 }
@@ -0,0 +1,280 @@
+//
+// feedback records round trip, encoded like the controller does
+// (see controller/StageLED.ino) and decoded by feedback_decode
+//
+#define main stage_control_main
+#include "../stage-control.c"
+#undef main
+
+int failures = 0;
+
+#define check(condition) do { \
+    if(!(condition)) { \
+        printf("[-] %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+        failures += 1; \
+    } \
+} while(0)
+
+typedef struct encoder_t {
+    uint8_t buffer[FEEDBACK_MAXIMUM];
+    size_t length;
+
+} encoder_t;
+
+void encoder_begin(encoder_t *encoder) {
+    memset(encoder->buffer, 0x00, sizeof(encoder->buffer));
+    encoder->length = sizeof(feedback_header_t);
+}
+
+void encoder_append(encoder_t *encoder, uint8_t type, const void *value, uint8_t length) {
+    feedback_record_t record = {.type = type, .length = length};
+
+    memcpy(encoder->buffer + encoder->length, &record, sizeof(record));
+    memcpy(encoder->buffer + encoder->length + sizeof(record), value, length);
+    encoder->length += sizeof(record) + length;
+}
+
+int encoder_end(encoder_t *encoder) {
+    feedback_header_t header = {
+        .magic = FEEDBACK_MAGIC,
+        .version = FEEDBACK_VERSION,
+        .length = encoder->length,
+    };
+
+    memcpy(encoder->buffer, &header, sizeof(header));
+
+    return encoder->length;
+}
+
+feedback_counters_t counters = {.state = 2, .frames = 1234, .fps = 30, .time_last_frame = 5000, .time_current = 5010};
+feedback_link_t linkvalue = {.sequence = 1300, .reordered = 3, .invalid = 1, .echo_age = 250, .echo = 987654321};
+feedback_output_t output = {.lanes = 3, .show_last = 29100, .show_max = 29400, .busy = 7};
+feedback_temperatures_t temperatures = {.main_core = 4512, .mon_core = 3900, .ext_power = -150, .ext_compute = 2800};
+feedback_mains_t mains = {.voltage = 23010};
+feedback_telemetry_t telemetry = {.frames = 4000, .errors = 2};
+feedback_integrity_t integrity = {.sequence = 1299, .checksum = 0xe3069283, .checked = 1200, .errors = 4};
+
+int encode_all(encoder_t *encoder) {
+    encoder_begin(encoder);
+
+    encoder_append(encoder, FEEDBACK_COUNTERS, &counters, sizeof(counters));
+    encoder_append(encoder, FEEDBACK_LINK, &linkvalue, sizeof(linkvalue));
+    encoder_append(encoder, FEEDBACK_OUTPUT, &output, sizeof(output));
+    encoder_append(encoder, FEEDBACK_TEMPERATURES, &temperatures, sizeof(temperatures));
+    encoder_append(encoder, FEEDBACK_MAINS, &mains, sizeof(mains));
+    encoder_append(encoder, FEEDBACK_TELEMETRY, &telemetry, sizeof(telemetry));
+    encoder_append(encoder, FEEDBACK_INTEGRITY, &integrity, sizeof(integrity));
+
+    for(int i = 0; i < FEEDBACK_PSUS; i++) {
+        feedback_psu_t psu = {.index = i, .volts = 1200 + i, .amps = 500 + i};
+        encoder_append(encoder, FEEDBACK_PSU, &psu, sizeof(psu));
+    }
+
+    return encoder_end(encoder);
+}
+
+void test_roundtrip() {
+    encoder_t encoder;
+    controller_stats_t stats;
+
+    int length = encode_all(&encoder);
+    check(feedback_decode(&stats, encoder.buffer, length));
+
+    check(stats.state == 2 && stats.frames == 1234 && stats.fps == 30);
+    check(stats.time_last_frame == 5000 && stats.time_current == 5010);
+    check(stats.sequence == 1300 && stats.reordered == 3 && stats.invalid == 1);
+    check(stats.echo_age == 250 && stats.echo == 987654321);
+    check(stats.lanes == 3 && stats.show_last == 29100 && stats.show_max == 29400 && stats.busy == 7);
+    check(stats.main_core_temperature == 4512 && stats.ext_power_temperature == -150);
+    check(stats.main_ac_voltage == 23010);
+    check(stats.telemetry_frames == 4000 && stats.telemetry_errors == 2);
+    check(stats.integrity_sequence == 1299 && stats.integrity_checksum == 0xe3069283);
+    check(stats.integrity_checked == 1200 && stats.integrity_errors == 4);
+
+    for(int i = 0; i < FEEDBACK_PSUS; i++)
+        check(stats.psu_volts[i] == 1200 + i && stats.psu_amps[i] == 500 + i);
+}
+
+// newer controller: unknown records skipped, longer records truncated
+void test_newer() {
+    encoder_t encoder;
+    controller_stats_t stats;
+    uint8_t unknown[40] = {0xff};
+    uint8_t longer[sizeof(feedback_mains_t) + 6];
+
+    memset(longer, 0xee, sizeof(longer));
+    memcpy(longer, &mains, sizeof(mains));
+
+    encoder_begin(&encoder);
+    encoder_append(&encoder, 200, unknown, sizeof(unknown));
+    encoder_append(&encoder, FEEDBACK_COUNTERS, &counters, sizeof(counters));
+    encoder_append(&encoder, FEEDBACK_MAINS, longer, sizeof(longer));
+    encoder_append(&encoder, 201, unknown, 0);
+
+    int length = encoder_end(&encoder);
+
+    check(feedback_decode(&stats, encoder.buffer, length));
+    check(stats.frames == 1234);
+    check(stats.main_ac_voltage == 23010);
+}
+
+void test_rejected() {
+    encoder_t encoder;
+    controller_stats_t stats;
+    feedback_header_t header;
+
+    int length = encode_all(&encoder);
+
+    // truncated datagram, announced length not matching
+    for(int i = 0; i < length; i++)
+        check(!feedback_decode(&stats, encoder.buffer, i));
+
+    // truncated datagram with a consistent header, last record cut
+    for(int i = sizeof(feedback_header_t) + 1; i < length; i++) {
+        uint8_t cut[FEEDBACK_MAXIMUM];
+
+        memcpy(cut, encoder.buffer, i);
+        memcpy(&header, cut, sizeof(header));
+        header.length = i;
+        memcpy(cut, &header, sizeof(header));
+
+        int boundary = feedback_decode(&stats, cut, i);
+
+        // only valid when cut right between two records
+        if(boundary)
+            check(stats.frames == 1234);
+    }
+
+    // record announcing more than the datagram holds
+    encoder_begin(&encoder);
+    encoder_append(&encoder, FEEDBACK_COUNTERS, &counters, sizeof(counters));
+    encoder_append(&encoder, FEEDBACK_LINK, &linkvalue, sizeof(linkvalue));
+    length = encoder_end(&encoder);
+    encoder.buffer[sizeof(feedback_header_t) + sizeof(feedback_record_t) + sizeof(counters) + 1] = 0xff;
+    check(!feedback_decode(&stats, encoder.buffer, length));
+
+    // record shorter than the value known
+    encoder_begin(&encoder);
+    encoder_append(&encoder, FEEDBACK_COUNTERS, &counters, sizeof(counters) - 1);
+    length = encoder_end(&encoder);
+    check(!feedback_decode(&stats, encoder.buffer, length));
+
+    // counters are required
+    encoder_begin(&encoder);
+    encoder_append(&encoder, FEEDBACK_LINK, &linkvalue, sizeof(linkvalue));
+    length = encoder_end(&encoder);
+    check(!feedback_decode(&stats, encoder.buffer, length));
+
+    // header magic and version
+    length = encode_all(&encoder);
+    encoder.buffer[0] ^= 0x01;
+    check(!feedback_decode(&stats, encoder.buffer, length));
+
+    length = encode_all(&encoder);
+    encoder.buffer[4] += 1;
+    check(!feedback_decode(&stats, encoder.buffer, length));
+}
+
+// forwarded metrics frames, decoded alone then kept with their peak
+void test_power() {
+    encoder_t encoder;
+    controller_stats_t stats;
+    power_stats_t power;
+    feedback_power_t forwarded = {.received = 123456};
+
+    forwarded.frame.sequence = 10;
+    forwarded.frame.valid = (1 << TELEMETRY_PSU0_AMPS) | (1 << TELEMETRY_PSU1_AMPS);
+    forwarded.frame.time = 998877;
+    forwarded.frame.channels[TELEMETRY_PSU0_AMPS] = 1250;
+    forwarded.frame.channels[TELEMETRY_PSU1_AMPS] = 300;
+    forwarded.frame.ages[TELEMETRY_PSU0_AMPS] = 4;
+
+    encoder_begin(&encoder);
+    encoder_append(&encoder, FEEDBACK_POWER, &forwarded, sizeof(forwarded));
+    int length = encoder_end(&encoder);
+
+    int decoded = feedback_decode(&stats, encoder.buffer, length);
+    check(decoded == (1 << FEEDBACK_POWER));
+    check(stats.power.received == 123456 && stats.power.frame.time == 998877);
+    check(stats.power.frame.channels[TELEMETRY_PSU0_AMPS] == 1250);
+
+    // full datagram still flagged with its counters
+    length = encode_all(&encoder);
+    check(feedback_decode(&stats, encoder.buffer, length) & (1 << FEEDBACK_COUNTERS));
+
+    memset(&power, 0x00, sizeof(power));
+    feedback_power(&power, &forwarded, 1000);
+
+    // spike then back down, two frames lost before the last one
+    forwarded.frame.sequence = 11;
+    forwarded.frame.channels[TELEMETRY_PSU0_AMPS] = 2000;
+    feedback_power(&power, &forwarded, 11000);
+
+    forwarded.frame.sequence = 14;
+    forwarded.frame.valid = 1 << TELEMETRY_PSU0_AMPS;
+    forwarded.frame.channels[TELEMETRY_PSU0_AMPS] = 900;
+    feedback_power(&power, &forwarded, 41000);
+
+    check(power.received == 3 && power.missing == 2 && power.age == 4);
+    check(power.amps[0] == 900 && power.peak[0] == 2000);
+    check(power.amps[1] == 300 && power.peak[1] == 300);
+    check(power.amps[2] == 0 && power.peak[2] == 0);
+
+    // spike out of the window
+    forwarded.frame.sequence = 15;
+    feedback_power(&power, &forwarded, 11000 + POWER_WINDOW + 1);
+    check(power.peak[0] == 900 && power.missing == 2);
+
+    // metrics board restarted
+    forwarded.frame.sequence = 1;
+    feedback_power(&power, &forwarded, 12000 + POWER_WINDOW);
+    check(power.missing == 2);
+}
+
+// random corruption, decoder must never read outside the datagram
+void test_fuzz() {
+    encoder_t encoder;
+    controller_stats_t stats;
+    uint8_t mutated[FEEDBACK_MAXIMUM];
+
+    srand(42);
+
+    int length = encode_all(&encoder);
+
+    for(int i = 0; i < 200000; i++) {
+        int size = (rand() % 4) ? length : rand() % FEEDBACK_MAXIMUM;
+
+        memcpy(mutated, encoder.buffer, sizeof(mutated));
+
+        for(int j = rand() % 8; j > 0; j--)
+            mutated[sizeof(feedback_header_t) + rand() % (length - sizeof(feedback_header_t))] = rand();
+
+        feedback_header_t header;
+        memcpy(&header, mutated, sizeof(header));
+        header.length = size;
+        memcpy(mutated, &header, sizeof(header));
+
+        // exact size buffer, overreads are caught by sanitizers
+        uint8_t *message = malloc(size);
+        memcpy(message, mutated, size);
+        feedback_decode(&stats, message, size);
+        free(message);
+    }
+}
+
+int main(void) {
+    memset(&mainlog, 0x00, sizeof(logger_t));
+    pthread_mutex_init(&mainlog.lock, NULL);
+    mainlog.capacity = LOGGER_SIZE;
+    mainlog.lines = (char **) calloc(sizeof(char *), mainlog.capacity);
+
+    test_roundtrip();
+    test_newer();
+    test_rejected();
+    test_power();
+    test_fuzz();
+
+    printf("[%c] feedback: %s\n", failures ? '-' : '+', failures ? "failed" : "all checks passed");
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
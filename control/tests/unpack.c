@@ -0,0 +1,83 @@
+//
+// controller frame unpacking (see controller/unpack.h) against the color
+// swaps OctoWS2811 setPixel does, for every 3 bytes per led order
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../controller/unpack.h"
+
+// OctoWS2811 color orders
+enum { WS2811_RGB, WS2811_RBG, WS2811_GRB, WS2811_GBR, WS2811_BRG, WS2811_BGR };
+
+#define LEDS 2880
+
+int failures = 0;
+
+#define check(condition) do { \
+    if(!(condition)) { \
+        printf("[-] %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+        failures += 1; \
+    } \
+} while(0)
+
+// setPixel(num, r, g, b) on teensy 4: color swapped then written msb first
+void setpixel(uint8_t *drawing, int config, int num, uint8_t r, uint8_t g, uint8_t b) {
+    uint32_t color = (r << 16) | (g << 8) | b;
+
+    switch(config & 7) {
+    case WS2811_RBG:
+        color = (color & 0xff0000) | ((color << 8) & 0x00ff00) | ((color >> 8) & 0x0000ff);
+        break;
+    case WS2811_GRB:
+        color = ((color << 8) & 0xff0000) | ((color >> 8) & 0x00ff00) | (color & 0x0000ff);
+        break;
+    case WS2811_GBR:
+        color = ((color << 16) & 0xff0000) | ((color >> 8) & 0x00ffff);
+        break;
+    case WS2811_BRG:
+        color = ((color << 8) & 0xffff00) | ((color >> 16) & 0x0000ff);
+        break;
+    case WS2811_BGR:
+        color = ((color << 16) & 0xff0000) | (color & 0x00ff00) | ((color >> 16) & 0x0000ff);
+        break;
+    }
+
+    uint8_t *dest = drawing + num * 3;
+    dest[0] = color >> 16;
+    dest[1] = color >> 8;
+    dest[2] = color;
+}
+
+void test_orders() {
+    static uint8_t pattern[LEDS * 3];
+    static uint8_t reference[LEDS * 3];
+    static uint8_t unpacked[LEDS * 3];
+
+    for(size_t i = 0; i < sizeof(pattern); i++)
+        pattern[i] = (i * 7) ^ (i >> 8);
+
+    for(int config = WS2811_RGB; config <= WS2811_BGR; config++) {
+        for(int i = 0; i < LEDS; i++)
+            setpixel(reference, config, i, pattern[i * 3], pattern[i * 3 + 1], pattern[i * 3 + 2]);
+
+        memset(unpacked, 0x00, sizeof(unpacked));
+        color_unpack(unpacked, pattern, color_orders[config], sizeof(pattern));
+
+        if(memcmp(reference, unpacked, sizeof(reference)))
+            printf("[-] unpack: color order %d not matching setPixel\n", config);
+
+        check(memcmp(reference, unpacked, sizeof(reference)) == 0);
+    }
+
+    // bulk copy path only taken for identity order
+    check(color_orders[WS2811_RGB][0] == 0 && color_orders[WS2811_RGB][1] == 1 && color_orders[WS2811_RGB][2] == 2);
+}
+
+int main(void) {
+    test_orders();
+
+    printf("[%c] unpack: %s\n", failures ? '-' : '+', failures ? "failed" : "all checks passed");
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,20 +1,37 @@
 #include <OctoWS2811.h>
 #include <QNEthernet.h>
+#include "feedback.h"
+#include "telemetry.h"
+#include "unpack.h"
 
 #define SERIAL_DEBUG  0
+#define UNPACK_BENCH  0     // compare fast unpack with setPixel at boot (needs debug)
 #define NETSYNC_FREQ  200   // interval in ms between network heartbeat
 
+#define CRC32C_POLY    0x82f63b78  // reflected castagnoli
+#define REORDER_WINDOW 32          // older frames means sender restarted
+
 #define Monitoring Serial1
 char monbuffer[512];
 
-// line by line buffer
-char monliner[128];
-size_t monlinerlen = 0;
+// metrics board telemetry (see telemetry.h)
+#define TELEMETRY_CHUNK    64    // serial bytes parsed at once
+
+enum telemetry_state {
+  TELEMETRY_WAIT_SYNC1,
+  TELEMETRY_WAIT_SYNC2,
+  TELEMETRY_WAIT_VERSION,
+  TELEMETRY_WAIT_LENGTH,
+  TELEMETRY_WAIT_PAYLOAD,
+  TELEMETRY_WAIT_CRC1,
+  TELEMETRY_WAIT_CRC2,
+};
 
 // internal core temperature prototype
 extern float tempmonGetTemp(void);
 
-typedef struct __attribute__ ((packed)) server_stats_t {
+// local state, encoded as feedback records (see feedback.h)
+typedef struct server_stats_t {
   uint64_t state;
   uint64_t old_frames;
   uint64_t frames;
@@ -36,7 +53,20 @@ typedef struct __attribute__ ((packed)) server_stats_t {
   uint16_t psu2_volt;
   uint16_t psu2_amps;
 
-  uint16_t padding;
+  uint32_t sequence;   // highest frame sequence received
+  uint32_t reordered;  // frames received behind highest one, not shown
+  uint32_t invalid;    // packets rejected (size, magic)
+  uint32_t echo_age;   // us since highest frame was received
+  uint64_t echo;       // sender timestamp of highest frame
+
+  uint32_t show_last;  // us spent in leds.show()
+  uint32_t show_max;
+  uint32_t busy;       // previous frame still being sent
+
+  uint32_t integrity_sequence; // last frame with a valid checksum
+  uint32_t integrity_checksum;
+  uint32_t integrity_checked;
+  uint32_t integrity_errors;   // frames rejected, checksum mismatch
 
 } server_stats_t;
 
@@ -65,6 +95,59 @@ int drawing_memory[dma_size];
 const int config = WS2811_RGB | WS2811_800kHz;
 OctoWS2811 leds(PER_LANE, display_memory, drawing_memory, config, NUM_LANES, stripe_pins_list);
 
+//
+// frame unpacking
+//
+// on teensy 4, drawing memory is 3 bytes per led in wire color order,
+// bits interleaving for lanes is done by the library dma interrupt while
+// sending, setPixel only reorders colors (one call per led), see unpack.h
+static_assert((config & 7) < 6, "color order outside frame unpack table");
+static_assert(bytes_per_led == 3, "rgbw orders not supported by frame unpack");
+
+void frame_unpack(const uint8_t *data) {
+  uint8_t *dest = (uint8_t *) drawing_memory;
+  const uint8_t *order = color_orders[config & 7];
+
+  // same order as network frame, one bulk (word) copy
+  if(order[0] == 0 && order[1] == 1 && order[2] == 2) {
+    memcpy(dest, data, TOTAL_LEDS * bytes_per_led);
+    return;
+  }
+
+  color_unpack(dest, data, order, TOTAL_LEDS * bytes_per_led);
+}
+
+#if SERIAL_DEBUG && UNPACK_BENCH
+// cycles of both paths on a test pattern, fast one must match setPixel
+void frame_unpack_bench() {
+  static uint8_t pattern[TOTAL_LEDS * bytes_per_led];
+  static int reference[dma_size];
+
+  for(size_t i = 0; i < sizeof(pattern); i++)
+    pattern[i] = (i * 7) ^ (i >> 8);
+
+  ARM_DEMCR |= ARM_DEMCR_TRCENA;
+  ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+
+  uint32_t start = ARM_DWT_CYCCNT;
+
+  for(int i = 0; i < TOTAL_LEDS; i++)
+    leds.setPixel(i, pattern[i * 3], pattern[i * 3 + 1], pattern[i * 3 + 2]);
+
+  uint32_t slow = ARM_DWT_CYCCNT - start;
+  memcpy(reference, drawing_memory, sizeof(reference));
+  memset(drawing_memory, 0x00, sizeof(reference));
+
+  start = ARM_DWT_CYCCNT;
+  frame_unpack(pattern);
+  uint32_t fast = ARM_DWT_CYCCNT - start;
+
+  bool match = memcmp(reference, drawing_memory, sizeof(reference)) == 0;
+
+  Serial.printf("[+] unpack: setPixel %u cycles, bulk %u cycles, %s\n", slow, fast, match ? "matching" : "MISMATCH");
+}
+#endif
+
 //////////////////////////////
 
 bool netstate = false;
@@ -72,6 +155,8 @@ bool linkinit = false;
 elapsedMillis main_temp_update = 0;
 
 server_stats_t mainstats;
+uint32_t echo_received = 0;  // micros() when highest frame came in
+bool sequenced = false;      // a sequenced frame was already received
 
 void setup() {
   #if SERIAL_DEBUG
@@ -82,12 +167,15 @@ void setup() {
   Monitoring.begin(250000);
   Monitoring.addMemoryForRead(monbuffer, sizeof(monbuffer));
 
-  // Starting from a clean buffer
-  memset(monliner, 0x00, sizeof(monliner));
-
   leds.begin();
   leds.show();
 
+  crc32c_init();
+
+  #if SERIAL_DEBUG && UNPACK_BENCH
+  frame_unpack_bench();
+  #endif
+
   #if SERIAL_DEBUG
   Serial.print("[+] leds configured: ");
   Serial.println(TOTAL_LEDS);
@@ -137,82 +225,324 @@ void ethernet_status() {
 int received = 0;
 uint32_t lastcheck = 0;
 
-void monitoring_reset_buffer() {
-  memset(monliner, 0x00, sizeof(monliner));
-  monlinerlen = 0;
+//
+// metrics board telemetry
+//
+uint16_t *telemetry_targets[TELEMETRY_CHANNELS] = {
+  [TELEMETRY_MAIN_INV] = &mainstats.main_ac_voltage,
+  [TELEMETRY_PSU0_VOLT] = &mainstats.psu0_volt,
+  [TELEMETRY_PSU1_VOLT] = &mainstats.psu1_volt,
+  [TELEMETRY_PSU2_VOLT] = &mainstats.psu2_volt,
+  [TELEMETRY_PSU0_AMPS] = &mainstats.psu0_amps,
+  [TELEMETRY_PSU1_AMPS] = &mainstats.psu1_amps,
+  [TELEMETRY_PSU2_AMPS] = &mainstats.psu2_amps,
+  [TELEMETRY_TEMP_EXT0] = &mainstats.ext_power_temperature,
+  [TELEMETRY_TEMP_EXT1] = &mainstats.ext_compute_temperature,
+  [TELEMETRY_TEMP_CORE] = &mainstats.mon_core_temperature,
+};
+
+void feedback_power(const telemetry_t *frame);
+
+struct {
+  uint8_t state;
+  uint8_t length;
+  uint8_t received;
+  uint16_t crc;
+  uint16_t expected;
+  uint8_t payload[sizeof(telemetry_t)];
+
+  uint32_t frames;
+  uint32_t errors; // crc, version or length mismatch
+
+} telemetry;
+
+void telemetry_apply() {
+  telemetry_t frame;
+  memcpy(&frame, telemetry.payload, sizeof(frame));
+
+  for(int i = 0; i < TELEMETRY_CHANNELS; i++)
+    if(frame.valid & (1 << i))
+      *telemetry_targets[i] = frame.channels[i];
+
+  telemetry.frames += 1;
+
+  // samples forwarded right away, heartbeat only keeps the latest
+  feedback_power(&frame);
 }
 
-char *monitoring_prefix_map[] = {
-  "PSUV 0",
-  "PSUV 1",
-  "PSUV 2",
-  "PSUA 0",
-  "PSUA 1",
-  "PSUA 2",
-  "TEMP EXT 0",
-  "TEMP EXT 1",
-  "TEMP CORE 0",
-  "MAIN INV 0",
-};
+// one byte at a time, never waiting for the rest of a frame
+void telemetry_feed(uint8_t byte) {
+  switch(telemetry.state) {
+  case TELEMETRY_WAIT_SYNC1:
+    if(byte == TELEMETRY_SYNC1)
+      telemetry.state = TELEMETRY_WAIT_SYNC2;
+    break;
+
+  case TELEMETRY_WAIT_SYNC2:
+    if(byte == TELEMETRY_SYNC2) {
+      telemetry.state = TELEMETRY_WAIT_VERSION;
+      telemetry.crc = 0xffff;
+
+    } else if(byte != TELEMETRY_SYNC1) {
+      telemetry.state = TELEMETRY_WAIT_SYNC1;
+    }
+    break;
 
-uint16_t *monitoring_target_map[] = {
-  &mainstats.psu0_volt,
-  &mainstats.psu1_volt,
-  &mainstats.psu2_volt,
-  &mainstats.psu0_amps,
-  &mainstats.psu1_amps,
-  &mainstats.psu2_amps,
-  &mainstats.ext_power_temperature,
-  &mainstats.ext_compute_temperature,
-  &mainstats.mon_core_temperature,
-  &mainstats.main_ac_voltage,
-};
+  case TELEMETRY_WAIT_VERSION:
+    telemetry.crc = crc16_update(telemetry.crc, byte);
+    telemetry.state = TELEMETRY_WAIT_LENGTH;
 
-void monitoring_parse_line() {
-  #if SERIAL_DEBUG
-  Serial.print("<< ");
-  Serial.print(monliner);
-  #endif
+    if(byte != TELEMETRY_VERSION) {
+      telemetry.errors += 1;
+      telemetry.state = TELEMETRY_WAIT_SYNC1;
+    }
+    break;
 
-  if(monliner[0] != '+') {
-    // Serial.println("[-] string prefix malformed");
-    return;
-  }
+  case TELEMETRY_WAIT_LENGTH:
+    telemetry.crc = crc16_update(telemetry.crc, byte);
+    telemetry.length = byte;
+    telemetry.received = 0;
+    telemetry.state = TELEMETRY_WAIT_PAYLOAD;
+
+    if(byte != sizeof(telemetry_t)) {
+      telemetry.errors += 1;
+      telemetry.state = TELEMETRY_WAIT_SYNC1;
+    }
+    break;
+
+  case TELEMETRY_WAIT_PAYLOAD:
+    telemetry.crc = crc16_update(telemetry.crc, byte);
+    telemetry.payload[telemetry.received++] = byte;
 
-  for(int i = 0; i < sizeof(monitoring_prefix_map) / sizeof(uint16_t *); i++) {
-    size_t prelen = strlen(monitoring_prefix_map[i]);
+    if(telemetry.received == telemetry.length)
+      telemetry.state = TELEMETRY_WAIT_CRC1;
+    break;
 
-    if(strncmp(monliner + 6, monitoring_prefix_map[i], prelen) == 0) {
-      *monitoring_target_map[i] = atoi(monliner + 6 + prelen + 1);
-      return;
+  case TELEMETRY_WAIT_CRC1:
+    telemetry.expected = byte;
+    telemetry.state = TELEMETRY_WAIT_CRC2;
+    break;
+
+  case TELEMETRY_WAIT_CRC2:
+    telemetry.expected |= byte << 8;
+    telemetry.state = TELEMETRY_WAIT_SYNC1;
+
+    if(telemetry.expected != telemetry.crc) {
+      telemetry.errors += 1;
+      break;
     }
+
+    telemetry_apply();
+    break;
   }
 }
 
-void loop() {
-  if(Monitoring.available() > 0) {
-    int incomingByte = Monitoring.read();
-    monliner[monlinerlen] = incomingByte;
-    monlinerlen += 1;
-
-    if(monlinerlen >= sizeof(monliner)) {
-      #if SERIAL_DEBUG
-      Serial.println("[-] overflow from monitoring serial, resetting buffer");
-      #endif
-
-      Monitoring.clear();
-      monitoring_reset_buffer();
-
-    } else if(incomingByte == '\n') {
-      monitoring_parse_line();
-      monitoring_reset_buffer();
+// only what is already buffered, bounded per call
+void telemetry_poll() {
+  uint8_t chunk[TELEMETRY_CHUNK];
+  int available = Monitoring.available();
+
+  if(available <= 0)
+    return;
+
+  if(available > (int) sizeof(chunk))
+    available = sizeof(chunk);
+
+  int length = Monitoring.readBytes((char *) chunk, available);
+
+  for(int i = 0; i < length; i++)
+    telemetry_feed(chunk[i]);
+}
+
+//
+// feedback encoding
+//
+uint8_t feedback[FEEDBACK_MAXIMUM];
+size_t feedback_length = 0;
+
+void feedback_append(uint8_t type, const void *value, uint8_t length) {
+  feedback_record_t record = {.type = type, .length = length};
+
+  memcpy(feedback + feedback_length, &record, sizeof(record));
+  memcpy(feedback + feedback_length + sizeof(record), value, length);
+  feedback_length += sizeof(record) + length;
+}
+
+void feedback_send() {
+  feedback_counters_t counters = {
+    .state = mainstats.state,
+    .frames = mainstats.frames,
+    .fps = mainstats.fps,
+    .time_last_frame = mainstats.time_last_frame,
+    .time_current = mainstats.time_current,
+  };
+
+  feedback_link_t link = {
+    .sequence = mainstats.sequence,
+    .reordered = mainstats.reordered,
+    .invalid = mainstats.invalid,
+    .echo_age = mainstats.echo_age,
+    .echo = mainstats.echo,
+  };
+
+  feedback_output_t output = {
+    .lanes = NUM_LANES,
+    .padding = {0, 0, 0},
+    .show_last = mainstats.show_last,
+    .show_max = mainstats.show_max,
+    .busy = mainstats.busy,
+  };
+
+  feedback_temperatures_t temperatures = {
+    .main_core = (int16_t) mainstats.main_core_temperature,
+    .mon_core = (int16_t) mainstats.mon_core_temperature,
+    .ext_power = (int16_t) mainstats.ext_power_temperature,
+    .ext_compute = (int16_t) mainstats.ext_compute_temperature,
+  };
+
+  feedback_mains_t mains = {.voltage = mainstats.main_ac_voltage};
+  feedback_telemetry_t link_metrics = {.frames = telemetry.frames, .errors = telemetry.errors};
+
+  feedback_integrity_t integrity = {
+    .sequence = mainstats.integrity_sequence,
+    .checksum = mainstats.integrity_checksum,
+    .checked = mainstats.integrity_checked,
+    .errors = mainstats.integrity_errors,
+  };
+
+  feedback_psu_t psus[FEEDBACK_PSUS] = {
+    {.index = 0, .padding = 0, .volts = mainstats.psu0_volt, .amps = mainstats.psu0_amps},
+    {.index = 1, .padding = 0, .volts = mainstats.psu1_volt, .amps = mainstats.psu1_amps},
+    {.index = 2, .padding = 0, .volts = mainstats.psu2_volt, .amps = mainstats.psu2_amps},
+  };
+
+  feedback_length = sizeof(feedback_header_t);
+
+  feedback_append(FEEDBACK_COUNTERS, &counters, sizeof(counters));
+  feedback_append(FEEDBACK_LINK, &link, sizeof(link));
+  feedback_append(FEEDBACK_OUTPUT, &output, sizeof(output));
+  feedback_append(FEEDBACK_TEMPERATURES, &temperatures, sizeof(temperatures));
+  feedback_append(FEEDBACK_MAINS, &mains, sizeof(mains));
+  feedback_append(FEEDBACK_TELEMETRY, &link_metrics, sizeof(link_metrics));
+  feedback_append(FEEDBACK_INTEGRITY, &integrity, sizeof(integrity));
+
+  for(int i = 0; i < FEEDBACK_PSUS; i++)
+    feedback_append(FEEDBACK_PSU, &psus[i], sizeof(psus[i]));
+
+  feedback_header_t header = {
+    .magic = FEEDBACK_MAGIC,
+    .version = FEEDBACK_VERSION,
+    .length = (uint16_t) feedback_length,
+  };
+
+  memcpy(feedback, &header, sizeof(header));
+
+  udp.send("10.241.0.255", 1111, feedback, feedback_length);
+}
+
+// own buffer, heartbeat one stays untouched
+void feedback_power(const telemetry_t *frame) {
+  uint8_t datagram[sizeof(feedback_header_t) + sizeof(feedback_record_t) + sizeof(feedback_power_t)];
+
+  if(!Ethernet.linkState())
+    return;
+
+  feedback_header_t header = {
+    .magic = FEEDBACK_MAGIC,
+    .version = FEEDBACK_VERSION,
+    .length = (uint16_t) sizeof(datagram),
+  };
+
+  feedback_record_t record = {.type = FEEDBACK_POWER, .length = sizeof(feedback_power_t)};
+  feedback_power_t power = {.received = micros(), .frame = *frame};
+
+  memcpy(datagram, &header, sizeof(header));
+  memcpy(datagram + sizeof(header), &record, sizeof(record));
+  memcpy(datagram + sizeof(header) + sizeof(record), &power, sizeof(power));
+
+  udp.send("10.241.0.255", 1111, datagram, sizeof(datagram));
+}
+
+//
+// frames validation
+//
+// bytewise crc32c (~60 us per frame), no crc instruction on cortex-m7
+uint32_t crc32c_table[256];
+
+void crc32c_init() {
+  for(int i = 0; i < 256; i++) {
+    uint32_t crc = i;
+
+    for(int bit = 0; bit < 8; bit++)
+      crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+
+    crc32c_table[i] = crc;
+  }
+}
+
+uint32_t crc32c(const uint8_t *data, size_t length) {
+  uint32_t crc = 0xffffffff;
+
+  while(length--)
+    crc = crc32c_table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+
+  return ~crc;
+}
+
+uint8_t *frame_validate(uint8_t *packet, int length) {
+  // legacy frame, raw pixels without header
+  if(length == TOTAL_LEDS * bytes_per_led)
+    return packet;
+
+  frame_header_t header;
+
+  if(length != (int) sizeof(frame_header_t) + TOTAL_LEDS * bytes_per_led) {
+    mainstats.invalid += 1;
+    return NULL;
+  }
+
+  memcpy(&header, packet, sizeof(header));
+
+  if(header.magic != FRAME_MAGIC) {
+    mainstats.invalid += 1;
+    return NULL;
+  }
+
+  uint8_t *pixels = packet + sizeof(frame_header_t);
+
+  // pixels not matching what sender produced are not shown
+  if(header.flags & FRAME_CHECKSUM) {
+    uint32_t checksum = crc32c(pixels, TOTAL_LEDS * bytes_per_led);
+
+    if(checksum != header.checksum) {
+      mainstats.integrity_errors += 1;
+      return NULL;
     }
 
-    // char buffer[8];
-    // sprintf(buffer, "%c", incomingByte);
-    // Serial.println(buffer);
+    mainstats.integrity_sequence = header.sequence;
+    mainstats.integrity_checksum = checksum;
+    mainstats.integrity_checked += 1;
+  }
+
+  int32_t ahead = (int32_t) (header.sequence - mainstats.sequence);
+
+  // late frame, a newer one is already shown
+  if(sequenced && ahead <= 0 && ahead > -REORDER_WINDOW) {
+    mainstats.reordered += 1;
+    return NULL;
   }
 
+  sequenced = true;
+  mainstats.sequence = header.sequence;
+  mainstats.echo = header.timestamp;
+  echo_received = micros();
+
+  return pixels;
+}
+
+void loop() {
+  telemetry_poll();
+
   bool linkstate = Ethernet.linkState();
   if(!linkstate && !linkinit) {
     waiting_network();
@@ -220,8 +550,12 @@ void loop() {
   }
 
   int packetsize = udp.parsePacket();
+  uint8_t *data = NULL;
+
+  if(packetsize >= 0)
+    data = frame_validate((uint8_t *) udp.data(), packetsize);
 
-  if(packetsize >= 0) {
+  if(data) {
     #if SERIAL_DEBUG
     // Serial.println(packetsize);
     #endif
@@ -230,20 +564,18 @@ void loop() {
 
     digitalWrite(LED_BUILTIN, HIGH);
 
-    uint8_t *data = (uint8_t *) udp.data();
-    int led = 0;
-    int maximum = leds.numPixels();
+    frame_unpack(data);
 
-    for(int i = 0; i < packetsize; i += 3) {
-      leds.setPixel(led, data[i], data[i + 1], data[i + 2]);
-      led += 1;
-
-      if(led >= maximum)
-        break;
-    }
+    if(leds.busy())
+      mainstats.busy += 1;
 
+    uint32_t showstart = micros();
     leds.show();
 
+    mainstats.show_last = micros() - showstart;
+    if(mainstats.show_last > mainstats.show_max)
+      mainstats.show_max = mainstats.show_last;
+
     digitalWrite(LED_BUILTIN, LOW);
 
     mainstats.frames += 1;
@@ -254,6 +586,7 @@ void loop() {
   if(millis() > lastcheck + NETSYNC_FREQ) {
     mainstats.time_current = millis();
     mainstats.fps = (mainstats.frames - mainstats.old_frames) * (1000 / NETSYNC_FREQ);
+    mainstats.echo_age = micros() - echo_received;
 
     if(main_temp_update > 1000) {
       mainstats.main_core_temperature = (tempmonGetTemp() * 100);
@@ -261,7 +594,7 @@ void loop() {
     }
 
     // broadcasting feedback
-    udp.send("10.241.0.255", 1111, (uint8_t *) &mainstats, sizeof(mainstats));
+    feedback_send();
 
     lastcheck = millis();
     mainstats.old_frames = mainstats.frames;
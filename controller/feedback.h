@@ -0,0 +1,136 @@
+#ifndef STAGELED_FEEDBACK_H
+#define STAGELED_FEEDBACK_H
+
+#include <stdint.h>
+#include "telemetry.h"
+
+//
+// controller feedback datagram, sent by controller and read by console
+//
+// fixed header, then records: type (1 byte), length (1 byte), value
+//  - header version only changes with header layout
+//  - unknown records are skipped by reader
+//  - records only grow at their end, reader ignores extra bytes
+//
+// power datagrams carry a single FEEDBACK_POWER record, sent for each
+// metrics board frame as it arrives, without counters
+//
+// frames header, the other way, is shared here too
+//
+#define FEEDBACK_MAGIC    0x42464c53 // "SLFB"
+#define FEEDBACK_VERSION  2
+#define FEEDBACK_MAXIMUM  1024       // bytes, whole datagram
+#define FEEDBACK_PSUS     3
+
+// frame datagram, sent by console: header then pixels, 3 bytes per led
+#define FRAME_MAGIC       0x52464c53 // "SLFR"
+#define FRAME_CHECKSUM    0x01       // header flag, pixels checksum set
+
+enum feedback_types {
+  FEEDBACK_COUNTERS = 1, // required, except power datagrams
+  FEEDBACK_LINK,
+  FEEDBACK_OUTPUT,
+  FEEDBACK_TEMPERATURES,
+  FEEDBACK_MAINS,
+  FEEDBACK_PSU,          // one record per module
+  FEEDBACK_TELEMETRY,
+  FEEDBACK_INTEGRITY,
+  FEEDBACK_POWER,        // alone in its datagram
+};
+
+typedef struct __attribute__ ((packed)) frame_header_t {
+  uint32_t magic;
+  uint32_t sequence;
+  uint64_t timestamp; // sender monotonic clock (us), echoed back
+  uint32_t flags;
+  uint32_t checksum;  // crc32c of pixels, verified by controller
+
+} frame_header_t;
+
+typedef struct __attribute__ ((packed)) feedback_header_t {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t length; // whole datagram
+
+} feedback_header_t;
+
+typedef struct __attribute__ ((packed)) feedback_record_t {
+  uint8_t type;
+  uint8_t length; // value bytes following
+
+} feedback_record_t;
+
+typedef struct __attribute__ ((packed)) feedback_counters_t {
+  uint64_t state;
+  uint64_t frames;
+  uint64_t fps;
+  uint64_t time_last_frame; // ms, controller uptime
+  uint64_t time_current;
+
+} feedback_counters_t;
+
+typedef struct __attribute__ ((packed)) feedback_link_t {
+  uint32_t sequence;  // highest frame sequence received
+  uint32_t reordered; // frames received behind highest one, not shown
+  uint32_t invalid;   // packets rejected (size, magic)
+  uint32_t echo_age;  // us since highest frame was received
+  uint64_t echo;      // sender timestamp of highest frame
+
+} feedback_link_t;
+
+// lanes are sent together by one dma transfer, timing is shared
+typedef struct __attribute__ ((packed)) feedback_output_t {
+  uint8_t lanes;
+  uint8_t padding[3];
+  uint32_t show_last; // us spent in show(), waiting included
+  uint32_t show_max;
+  uint32_t busy;      // frames arrived while previous one was still sent
+
+} feedback_output_t;
+
+// values * 100
+typedef struct __attribute__ ((packed)) feedback_temperatures_t {
+  int16_t main_core;
+  int16_t mon_core;
+  int16_t ext_power;
+  int16_t ext_compute;
+
+} feedback_temperatures_t;
+
+typedef struct __attribute__ ((packed)) feedback_mains_t {
+  uint16_t voltage;
+
+} feedback_mains_t;
+
+typedef struct __attribute__ ((packed)) feedback_psu_t {
+  uint8_t index;
+  uint8_t padding;
+  uint16_t volts;
+  uint16_t amps;
+
+} feedback_psu_t;
+
+// metrics board serial link
+typedef struct __attribute__ ((packed)) feedback_telemetry_t {
+  uint32_t frames;
+  uint32_t errors;
+
+} feedback_telemetry_t;
+
+// frames pixels checksum (crc32c), for frames sent with one
+typedef struct __attribute__ ((packed)) feedback_integrity_t {
+  uint32_t sequence; // last frame with a valid checksum
+  uint32_t checksum; // its checksum, as verified
+  uint32_t checked;  // frames verified
+  uint32_t errors;   // frames rejected, checksum mismatch
+
+} feedback_integrity_t;
+
+// metrics board frame forwarded as is (about 100 Hz), sample ages included
+typedef struct __attribute__ ((packed)) feedback_power_t {
+  uint32_t received; // us, controller clock when frame was read
+  telemetry_t frame;
+
+} feedback_power_t;
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef STAGELED_TELEMETRY_H
+#define STAGELED_TELEMETRY_H
+
+#include <stdint.h>
+
+//
+// metrics board telemetry frame, sent over serial to controller
+//
+//   sync (2 bytes), version, payload length, payload, crc16 (ccitt, le)
+//   crc covers version, length and payload
+//
+#define TELEMETRY_SYNC1    0xa5
+#define TELEMETRY_SYNC2    0x5a
+#define TELEMETRY_VERSION  2
+
+enum telemetry_channels {
+  TELEMETRY_MAIN_INV,
+  TELEMETRY_PSU0_VOLT,
+  TELEMETRY_PSU1_VOLT,
+  TELEMETRY_PSU2_VOLT,
+  TELEMETRY_PSU0_AMPS,
+  TELEMETRY_PSU1_AMPS,
+  TELEMETRY_PSU2_AMPS,
+  TELEMETRY_TEMP_EXT0,
+  TELEMETRY_TEMP_EXT1,
+  TELEMETRY_TEMP_CORE,
+  TELEMETRY_CHANNELS,
+};
+
+typedef struct __attribute__ ((packed)) telemetry_t {
+  uint16_t sequence;
+  uint16_t valid;                       // channels set in this frame
+  uint32_t time;                        // us, metrics board clock when sent
+  int16_t channels[TELEMETRY_CHANNELS]; // values * 100
+  uint8_t ages[TELEMETRY_CHANNELS];     // ms between sample and frame
+
+} telemetry_t;
+
+static inline uint16_t crc16_update(uint16_t crc, uint8_t byte) {
+  crc ^= byte << 8;
+
+  for(int i = 0; i < 8; i++)
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+
+  return crc;
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef STAGELED_UNPACK_H
+#define STAGELED_UNPACK_H
+
+#include <stdint.h>
+
+//
+// network frame (red, green, blue) to drawing memory (wire order)
+//
+// position of red, green and blue inside a led, by color order
+// (same swaps as OctoWS2811 setPixel, only 3 bytes per led orders),
+// checked on host against setPixel by control/tests/unpack.c
+//
+static const uint8_t color_orders[6][3] = {
+  {0, 1, 2}, // WS2811_RGB
+  {0, 2, 1}, // WS2811_RBG
+  {1, 0, 2}, // WS2811_GRB
+  {1, 2, 0}, // WS2811_GBR
+  {2, 0, 1}, // WS2811_BRG
+  {2, 1, 0}, // WS2811_BGR
+};
+
+static inline void color_unpack(uint8_t *dest, const uint8_t *data, const uint8_t *order, int length) {
+  for(int i = 0; i < length; i += 3) {
+    dest[i + order[0]] = data[i];
+    dest[i + order[1]] = data[i + 1];
+    dest[i + order[2]] = data[i + 2];
+  }
+}
+
+#endif
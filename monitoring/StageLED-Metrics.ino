@@ -2,25 +2,62 @@
 #include <DallasTemperature.h>
 #include <ZMPT101B.h>
 #include "ADS1X15.h"
+#include "../controller/telemetry.h" // frame sent upstream, shared with controller
 
 // Hardware Serial pretty name
 #define Upstream Serial1
 
+#define TELEMETRY_INTERVAL 10    // ms, frames only carry fresh samples
+
+telemetry_t telemetry;
+
+// sampling schedule and last sample of each channel
+typedef struct channel_t {
+  uint16_t interval;     // ms between samples
+  unsigned long sampled; // us, 0 never sampled
+  float value;
+  bool fresh;            // not sent yet
+
+} channel_t;
+
+channel_t channels[TELEMETRY_CHANNELS] = {
+  [TELEMETRY_MAIN_INV] = {.interval = 1000},
+  [TELEMETRY_PSU0_VOLT] = {.interval = 100},
+  [TELEMETRY_PSU1_VOLT] = {.interval = 100},
+  [TELEMETRY_PSU2_VOLT] = {.interval = 100},
+  [TELEMETRY_PSU0_AMPS] = {.interval = 10},
+  [TELEMETRY_PSU1_AMPS] = {.interval = 10},
+  [TELEMETRY_PSU2_AMPS] = {.interval = 10},
+  [TELEMETRY_TEMP_EXT0] = {.interval = 5000},
+  [TELEMETRY_TEMP_EXT1] = {.interval = 5000},
+  [TELEMETRY_TEMP_CORE] = {.interval = 1000},
+};
+
 // Temperatures sensors
 #define ONE_WIRE_BUS 14
 
 OneWire oneWire(ONE_WIRE_BUS);
 DallasTemperature temperature(&oneWire);
 
-unsigned long sensors_cooldown = 0;
+unsigned long temperature_requested = 0; // ms, conversion running when set
 
 // internal core temperature prototype
 extern float tempmonGetTemp(void);
 
 // PSU Modules Instances
+//
+// each module converts current (differential 0-1) and voltage (input 2)
+// alternately, one single shot conversion requested at a time and
+// collected when ready, from ALERT/RDY pin when wired (-1 otherwise)
+#define PSU_DATA_RATE  6  // 475 samples per second, ~2.1 ms per conversion
+#define PSU_IDLE      -1
+
 typedef struct psu_t {
   ADS1115 *raw;
-  
+  int alert;            // ALERT/RDY pin, low when ready
+  bool online;
+  int converting;       // channel of pending conversion
+
   unsigned long updated;
   float volts;
   float amps;
@@ -28,13 +65,13 @@ typedef struct psu_t {
 } psu_t;
 
 ADS1115 rPSU1(0x48);
-psu_t PSU1 = {.raw = &rPSU1};
+psu_t PSU1 = {.raw = &rPSU1, .alert = -1};
 
 ADS1115 rPSU2(0x49);
-psu_t PSU2 = {.raw = &rPSU2};
+psu_t PSU2 = {.raw = &rPSU2, .alert = -1};
 
 ADS1115 rPSU3(0x4A);
-psu_t PSU3 = {.raw = &rPSU3};
+psu_t PSU3 = {.raw = &rPSU3, .alert = -1};
 
 psu_t *psus[] = {&PSU1, &PSU2, &PSU3};
 
@@ -62,6 +99,7 @@ void setup() {
 
   Serial.println("[+] initializing temperature sensors");
   temperature.begin();
+  temperature.setWaitForConversion(false);
   
   int sensors = temperature.getDeviceCount();
   Serial.print("[+] temperature: ");
@@ -90,8 +128,19 @@ void setup() {
       continue;
     }
 
-    psu->raw->setDataRate(1);
+    psu->raw->setDataRate(PSU_DATA_RATE);
+    psu->raw->setMode(1); // single shot, requested by scheduler
 
+    // conversion ready signal on ALERT/RDY pin
+    if(psu->alert >= 0) {
+      psu->raw->setComparatorThresholdLow(0x0000);
+      psu->raw->setComparatorThresholdHigh(0x8000);
+      psu->raw->setComparatorQueConvert(0);
+      pinMode(psu->alert, INPUT_PULLUP);
+    }
+
+    psu->online = true;
+    psu->converting = PSU_IDLE;
     psu->updated = 0;
     psu->volts = 0.0;
     psu->amps = 0.0;
@@ -106,99 +155,181 @@ void setup() {
   Serial.println("[+] metrics system initialized, measuring");
 }
 
-void loop() {
-  int state = 0;
+void channel_sample(int channel, float value) {
+  channels[channel].value = value;
+  channels[channel].sampled = micros();
+  channels[channel].fresh = true;
+}
 
-  digitalWrite(13, HIGH);
-  analogWrite(POWER_MAIN_LED, 2);
+bool channel_due(int channel) {
+  channel_t *target = &channels[channel];
 
-  Serial.print("Metrics: ");
- 
-  // float main_voltage = acvoltage.getRmsVoltage();
-  float main_voltage = 0.00;
-  
-  Serial.print(main_voltage);
-  Serial.print(" v | ");
+  if(target->sampled == 0)
+    return true;
 
-  Upstream.print("+DATA MAIN INV 0 ");
-  Upstream.println((int) (main_voltage * 100));
+  return micros() - target->sampled >= target->interval * 1000UL;
+}
 
-  for(size_t i = 0; i < sizeof(psus) / sizeof(*psus); i++) {
-    psu_t *psu = psus[i];
+// fresh channels only, in one write, nothing when none is fresh
+void telemetry_send() {
+  uint8_t buffer[4 + sizeof(telemetry_t) + 2];
+  uint16_t crc = 0xffff;
+  unsigned long now = micros();
+
+  telemetry.valid = 0;
+  telemetry.time = now;
+
+  for(int i = 0; i < TELEMETRY_CHANNELS; i++) {
+    channel_t *channel = &channels[i];
+
+    if(!channel->fresh)
+      continue;
+
+    unsigned long age = (now - channel->sampled) / 1000;
 
-    int16_t diff = psu->raw->readADC_Differential_0_1();
+    telemetry.channels[i] = (int16_t) (channel->value * 100);
+    telemetry.ages[i] = (age > 255) ? 255 : age;
+    telemetry.valid |= (1 << i);
+    channel->fresh = false;
+  }
 
-    int16_t v1 = psu->raw->readADC(2);
-    float vv1 = (psu->raw->toVoltage(v1) / 5.0) * 15.0;
-    
-    float hallVoltage = psu->raw->toVoltage(diff);
-    float hallAmps = hallVoltage * (20.0 / 0.625); // 20 ampere
+  if(!telemetry.valid)
+    return;
 
-    /*
-    Serial.print("Current: ");
-    Serial.print(hallAmps);
-    Serial.print(" amp, ");
-    // Serial.println(hallVoltage);
-    Serial.print(hallAmps * vv1);
-    Serial.println(" watt");
-    */
+  buffer[0] = TELEMETRY_SYNC1;
+  buffer[1] = TELEMETRY_SYNC2;
+  buffer[2] = TELEMETRY_VERSION;
+  buffer[3] = sizeof(telemetry_t);
+  memcpy(buffer + 4, &telemetry, sizeof(telemetry_t));
+
+  for(size_t i = 2; i < 4 + sizeof(telemetry_t); i++)
+    crc = crc16_update(crc, buffer[i]);
+
+  buffer[4 + sizeof(telemetry_t)] = crc & 0xff;
+  buffer[5 + sizeof(telemetry_t)] = crc >> 8;
+
+  Upstream.write(buffer, sizeof(buffer));
+
+  telemetry.sequence += 1;
+}
+
+//
+// psu modules scheduling
+//
+bool psu_ready(psu_t *psu) {
+  if(psu->alert >= 0)
+    return digitalRead(psu->alert) == LOW;
+
+  return psu->raw->isReady();
+}
+
+void psu_poll(int index) {
+  psu_t *psu = psus[index];
+
+  if(!psu->online)
+    return;
+
+  // collecting pending conversion
+  if(psu->converting != PSU_IDLE) {
+    if(!psu_ready(psu))
+      return;
+
+    float volts = psu->raw->toVoltage(psu->raw->getValue());
+
+    if(psu->converting == TELEMETRY_PSU0_AMPS + index) {
+      psu->amps = volts * (20.0 / 0.625); // 20 ampere
+      channel_sample(psu->converting, psu->amps);
+
+    } else {
+      psu->volts = (volts / 5.0) * 15.0;
+      channel_sample(psu->converting, psu->volts);
+    }
 
     psu->updated = micros();
-    psu->volts = vv1;
-    psu->amps = hallAmps;
+    psu->converting = PSU_IDLE;
   }
 
+  // current first, it has the highest rate
+  if(channel_due(TELEMETRY_PSU0_AMPS + index)) {
+    psu->converting = TELEMETRY_PSU0_AMPS + index;
+    psu->raw->requestADC_Differential_0_1();
 
-  for(size_t i = 0; i < sizeof(psus) / sizeof(*psus); i++) {
-    psu_t *psu = psus[i];
+  } else if(channel_due(TELEMETRY_PSU0_VOLT + index)) {
+    psu->converting = TELEMETRY_PSU0_VOLT + index;
+    psu->raw->requestADC(2);
+  }
+}
+
+//
+// 1-wire temperatures, conversion (~750 ms) runs in background
+//
+void temperature_poll() {
+  if(temperature_requested) {
+    uint16_t waiting = temperature.millisToWaitForConversion(temperature.getResolution());
 
-    Serial.print(psu->volts, 2);
-    Serial.print(" v, ");
-    Serial.print(psu->amps, 2);
-    Serial.print(" A | ");
+    if(millis() - temperature_requested < waiting)
+      return;
 
-    Upstream.print("+DATA PSUV ");
-    Upstream.print(i);
-    Upstream.print(" ");
-    Upstream.println((int) (psu->volts * 100));
+    for(size_t i = 0; i < temperature.getDeviceCount() && i < 2; i++)
+      channel_sample(TELEMETRY_TEMP_EXT0 + i, temperature.getTempCByIndex(i));
 
-    Upstream.print("+DATA PSUA ");
-    Upstream.print(i);
-    Upstream.print(" ");
-    Upstream.println((int) (psu->amps * 100));
+    temperature_requested = 0;
   }
 
-  //
-  // temperature sensors rate limitted
-  //
+  if(channel_due(TELEMETRY_TEMP_EXT0)) {
+    temperature.requestTemperatures();
+    temperature_requested = millis();
 
-  if(sensors_cooldown > millis()) {
-    Serial.println("---");
-    delay(100);
-    return;
+    // next conversion scheduled even without sensors
+    channels[TELEMETRY_TEMP_EXT0].sampled = micros();
+    channels[TELEMETRY_TEMP_EXT1].sampled = micros();
   }
+}
 
-  temperature.requestTemperatures();
+elapsedMillis telemetry_elapsed = 0;
+elapsedMillis debug_elapsed = 0;
 
-  for(size_t i = 0; i < temperature.getDeviceCount(); i++) {
-    float temp = temperature.getTempCByIndex(i);
-    Upstream.print("+DATA TEMP EXT ");
-    Upstream.print(i);
-    Upstream.print(" ");
-    Upstream.println((int) (temp * 100));
+void loop() {
+  analogWrite(POWER_MAIN_LED, 2);
 
-    Serial.print(temp, 2);
-    Serial.print("°C | ");
+  for(size_t i = 0; i < sizeof(psus) / sizeof(*psus); i++)
+    psu_poll(i);
+
+  temperature_poll();
+
+  if(channel_due(TELEMETRY_MAIN_INV)) {
+    // float main_voltage = acvoltage.getRmsVoltage();
+    channel_sample(TELEMETRY_MAIN_INV, 0.00);
   }
 
-  float core = tempmonGetTemp();
-  Serial.print(core, 2);
-  Serial.print("°C | ");
+  if(channel_due(TELEMETRY_TEMP_CORE))
+    channel_sample(TELEMETRY_TEMP_CORE, tempmonGetTemp());
 
-  Upstream.print("+DATA TEMP CORE 0 ");
-  Upstream.println((int) (core * 100));
+  if(telemetry_elapsed >= TELEMETRY_INTERVAL) {
+    telemetry_send();
+    telemetry_elapsed = 0;
+  }
 
-  // Cooldown for 5 seconds
-  sensors_cooldown = millis() + 5000;
-  Serial.println("");
-}
\ No newline at end of file
+  // human readable summary, once per second
+  if(debug_elapsed >= 1000) {
+    Serial.print("Metrics: ");
+    Serial.print(channels[TELEMETRY_MAIN_INV].value);
+    Serial.print(" v | ");
+
+    for(size_t i = 0; i < sizeof(psus) / sizeof(*psus); i++) {
+      Serial.print(psus[i]->volts, 2);
+      Serial.print(" v, ");
+      Serial.print(psus[i]->amps, 2);
+      Serial.print(" A | ");
+    }
+
+    Serial.print(channels[TELEMETRY_TEMP_EXT0].value, 2);
+    Serial.print("°C | ");
+    Serial.print(channels[TELEMETRY_TEMP_EXT1].value, 2);
+    Serial.print("°C | ");
+    Serial.print(channels[TELEMETRY_TEMP_CORE].value, 2);
+    Serial.println("°C");
+
+    debug_elapsed = 0;
+  }
+}